@@ -7,6 +7,21 @@ Window {
     visible: true
     title: qsTr("Hello World")
 
+    // Shows the output of a compile stage, or its errors next to the untouched source
+    function showResult(result) {
+        var lines = []
+        for (var i = 0; i < result.diagnostics.length; ++i) {
+            var diag = result.diagnostics[i]
+            lines.push(diag.line + ":" + diag.column + ": " + diag.severity + ": " + diag.message)
+        }
+        diagnostics.text = lines.join("\n")
+
+        if (result.ok) {
+            txtarea.text = result.text
+            txtarea.readOnly = true
+        }
+    }
+
     ScrollView {
         id: view
         anchors.fill: parent
@@ -17,6 +32,24 @@ Window {
             width: 640
             height: 480
             text: qsTr("exit(1 * 3 - 6 / 2 + 2)")
+
+            Component.onCompleted: myBackend.attachHighlighter(textDocument)
+        }
+    }
+
+    Rectangle {
+        id: errorBar
+        width: parent.width
+        height: diagnostics.implicitHeight + 10
+        anchors.bottom: toolBar.top
+        color: "#fde8e8"
+        visible: diagnostics.text.length > 0
+
+        Text {
+            id: diagnostics
+            anchors.fill: parent
+            anchors.margins: 5
+            color: "darkred"
         }
     }
 
@@ -35,6 +68,7 @@ Window {
             onClicked: {
                 txtarea.text = myBackend.deleteFile(txtarea.text);
                 txtarea.readOnly = false
+                diagnostics.text = ""
             }
         }
 
@@ -45,27 +79,35 @@ Window {
                 text: "Tokenize"
                 onClicked: {
                     txtarea.text = myBackend.checkFile(txtarea.text);
-                    var result = myBackend.tokens_str(txtarea.text)
-                    txtarea.text = result
-                    txtarea.readOnly = true
+                    showResult(myBackend.tokens_str(txtarea.text))
                 }
             }
             Button {
                 text: "Parse"
                 onClicked: {
                     txtarea.text = myBackend.checkFile(txtarea.text);
-                    var result = myBackend.parse_str(txtarea.text)
-                    txtarea.text = result
-                    txtarea.readOnly = true;
+                    showResult(myBackend.parse_str(txtarea.text))
                 }
             }
             Button {
                 text: "Asembly"
                 onClicked: {
                     txtarea.text = myBackend.checkFile(txtarea.text);
-                    var result = myBackend.assemble_str(txtarea.text)
-                    txtarea.text = result
-                    txtarea.readOnly = true;
+                    showResult(myBackend.assemble_str(txtarea.text))
+                }
+            }
+            Button {
+                text: "Executable"
+                onClicked: {
+                    txtarea.text = myBackend.checkFile(txtarea.text);
+                    showResult(myBackend.build_executable(txtarea.text))
+                }
+            }
+            Button {
+                text: "Run"
+                onClicked: {
+                    txtarea.text = myBackend.checkFile(txtarea.text);
+                    showResult(myBackend.run_str(txtarea.text))
                 }
             }
         }
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+// Shared by the benchmarks: a generated source to feed the compiler and a timer
+
+namespace bench {
+
+// Valid Brouss source of about `bytes` bytes: declarations over the earlier
+// variables, strings, prints, if/elif/else and nested scopes, with a comment
+// now and then. The same seed gives the same source.
+[[nodiscard]] inline std::string generate_source(size_t bytes, uint32_t seed = 1) {
+    std::mt19937 rng(seed);
+    const auto pick = [&](uint32_t n) { return static_cast<uint32_t>(rng() % n); };
+    std::string src;
+    src.reserve(bytes + 256);
+    uint32_t ints = 0;
+    uint32_t strings = 0;
+    const auto var = [&] { return ints == 0 ? std::to_string(pick(100)) : "v" + std::to_string(pick(ints)); };
+
+    while (src.size() < bytes) {
+        switch (pick(8)) {
+        case 0:
+            src += "string s" + std::to_string(strings++) + " = \"text number " + std::to_string(pick(1000)) + "\"\n";
+            break;
+        case 1:
+            if (strings > 0) {
+                src += "print(s" + std::to_string(pick(strings)) + ")\n";
+            }
+            break;
+        case 2:
+            src += "if (" + var() + ") {\n    int t = " + var() + " + 1\n} elif (" + var() + ") {\n    print(\"elif\")\n} else {\n}\n";
+            break;
+        case 3:
+            src += "{\n    int inner = (" + var() + " * 3) - 7\n    inner = inner + " + var() + "\n}\n";
+            break;
+        case 4:
+            src += "// comment line " + std::to_string(pick(1000)) + "\n";
+            break;
+        default:
+            src += "int v" + std::to_string(ints) + " = ((" + var() + " + " + std::to_string(pick(1000)) + ") * " + var() + ") - " + var() + " / " + std::to_string(1 + pick(9)) + "\n";
+            ints++;
+            break;
+        }
+    }
+    return src;
+}
+
+// Best wall time of `runs` calls of f, in seconds
+template <typename F>
+[[nodiscard]] double best_of(int runs, F&& f) {
+    double best = 1e300;
+    for (int i = 0; i < runs; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+        f();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+// Size of the generated source, from argv[1] in MB (default `mb`)
+[[nodiscard]] inline size_t source_bytes(int argc, char** argv, size_t mb) {
+    if (argc > 1) {
+        mb = static_cast<size_t>(std::max(1L, std::strtol(argv[1], nullptr, 10)));
+    }
+    return mb << 20;
+}
+
+} // namespace bench
@@ -0,0 +1,265 @@
+// Executed instructions and memory operations of loop-heavy programs, with
+// the int variables in stack slots (no register allocation), in registers, and
+// in registers after constant folding (what the compiler does). Each build is
+// written by the ELF writer, single-stepped under ptrace to count what runs,
+// then timed without ptrace (fork and exec included). An instruction counts as
+// a memory operation when it has a memory operand or is a push or pop. Exits
+// non-zero when the builds of a program disagree on its exit code.
+//   bench_exec
+
+#include "bench.hpp"
+
+#include "arena.hpp"
+#include "constant_folding.hpp"
+#include "diagnostics.hpp"
+#include "elf_writer.hpp"
+#include "flat_ast.hpp"
+#include "generation.hpp"
+#include "ir.hpp"
+#include "parser.hpp"
+#include "tokenization.hpp"
+#include "x86_encoder.hpp"
+
+#include <fcntl.h>
+#include <sys/ptrace.h>
+#include <sys/stat.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+struct Program {
+    std::string_view name;
+    std::string_view source;
+};
+
+constexpr std::array<Program, 3> k_programs { {
+    { "nested loops", R"(int step = 2 * 3 - 5
+int sum = 0
+int i = 150
+while (i) {
+    int j = 150
+    while (j) {
+        sum = sum + i * j
+        j = j - step
+    }
+    i = i - step
+}
+exit(sum - sum / 256 * 256)
+)" },
+    { "collatz", R"(int total = 0
+int start = 100
+while (start) {
+    int n = start
+    while (n - 1) {
+        int half = n / 2
+        if (n - half * 2) {
+            n = n * 3 + 1
+        } else {
+            n = half
+        }
+        total = total + 1
+    }
+    start = start - 1
+}
+exit(total - total / 256 * 256)
+)" },
+    // Seven variables live across the loop, two more than there are registers
+    { "pressure", R"(int a = 1
+int b = 2
+int c = 3
+int d = 4
+int e = 5
+int f = 6
+int g = 7
+int n = 5000
+while (n) {
+    a = a + b
+    b = b + c
+    c = c + d
+    d = d + e
+    e = e + f
+    f = f + g
+    g = g + a
+    n = n - 1
+}
+exit(g - g / 256 * 256)
+)" },
+} };
+
+struct Build {
+    std::string_view name;
+    size_t registers;
+    bool fold;
+};
+
+constexpr std::array<Build, 3> k_builds { {
+    { "stack slots", 0, false },
+    { "registers", RegisterAllocator::k_registers.size(), false },
+    { "registers+fold", RegisterAllocator::k_registers.size(), true },
+} };
+
+struct Compiled {
+    std::vector<uint8_t> executable;
+    size_t spilled = 0;
+    size_t folded = 0;
+};
+
+Compiled compile(std::string_view src, const Build& build) {
+    Diagnostics diagnostics;
+    ArenaAllocator arena;
+    Tokenizer tokenizer(src, &diagnostics);
+    Parser parser(tokenizer, diagnostics, arena);
+    const NodeProg prog = parser.parse_prog().value();
+    FlatAst ast = FlatAst::lower(prog);
+
+    Compiled compiled;
+    if (build.fold) {
+        ConstantFolder folder(ast, diagnostics);
+        folder.run();
+        compiled.folded = folder.folded_count();
+    }
+    Generator generator(ast, diagnostics, build.registers);
+    IrProgram ir = generator.gen_ir();
+    compiled.spilled = generator.spilled_count();
+    if (diagnostics.has_errors()) {
+        std::fprintf(stderr, "does not compile: %s\n", diagnostics.all().front().message.c_str());
+        std::exit(1);
+    }
+    PassManager::standard().run(ir);
+    MachineCode code = X86Encoder(ir).encode();
+    compiled.executable = ElfWriter::write(code);
+    return compiled;
+}
+
+// Writes the executable to a temporary file, removed by the caller
+std::string save(const std::vector<uint8_t>& executable) {
+    const char* dir = std::getenv("TMPDIR");
+    std::string path = std::string(dir != nullptr ? dir : "/tmp") + "/bench_exec_XXXXXX";
+    const int fd = ::mkstemp(path.data());
+    if (fd < 0 || ::fchmod(fd, 0755) != 0 || ::write(fd, executable.data(), executable.size()) != static_cast<ssize_t>(executable.size())) {
+        std::perror("bench_exec: temporary executable");
+        std::exit(1);
+    }
+    ::close(fd);
+    return path;
+}
+
+// Starts the executable with its output discarded, traced or not
+pid_t spawn(const std::string& path, bool traced) {
+    const pid_t pid = ::fork();
+    if (pid == 0) {
+        const int null = ::open("/dev/null", O_WRONLY);
+        ::dup2(null, STDOUT_FILENO);
+        if (traced) {
+            ::ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+        }
+        ::execl(path.c_str(), path.c_str(), static_cast<char*>(nullptr));
+        ::_exit(127);
+    }
+    return pid;
+}
+
+std::optional<int> exit_code(int status) {
+    if (!WIFEXITED(status)) {
+        return std::nullopt;
+    }
+    return WEXITSTATUS(status);
+}
+
+// Whether the instruction at `code` reads or writes memory, for the forms
+// X86Encoder produces (see its encode)
+bool touches_memory(const uint8_t* code) {
+    while (*code == 0x66 || (*code & 0xF0) == 0x40) {
+        code++; // operand size and REX prefixes
+    }
+    const uint8_t opcode = *code++;
+    if ((opcode >= 0x50 && opcode <= 0x5F) || opcode == 0x68 || opcode == 0x6A || opcode == 0xFF || opcode == 0xE8) {
+        return true; // push, pop, call
+    }
+    if ((opcode >= 0xB8 && opcode <= 0xBF) || opcode == 0xE9 || opcode == 0x8D) {
+        return false; // mov r, imm - jmp - lea (address only)
+    }
+    if (opcode == 0x0F) {
+        const uint8_t second = *code++;
+        if (second == 0x05 || second == 0x84) {
+            return false; // syscall, jz
+        }
+    }
+    return (*code >> 6) != 0b11; // ModRM with a memory operand
+}
+
+struct Counts {
+    size_t instructions = 0;
+    size_t memory = 0;
+    std::optional<int> exit_code;
+};
+
+Counts single_step(const std::string& path) {
+    Counts counts;
+    const pid_t pid = spawn(path, true);
+    int status = 0;
+    ::waitpid(pid, &status, 0); // stopped at the exec
+    while (WIFSTOPPED(status)) {
+        user_regs_struct regs {};
+        ::ptrace(PTRACE_GETREGS, pid, nullptr, &regs);
+        std::array<long, 2> words {};
+        for (size_t i = 0; i < words.size(); ++i) {
+            words[i] = ::ptrace(PTRACE_PEEKTEXT, pid, regs.rip + i * sizeof(long), nullptr);
+        }
+        uint8_t code[sizeof(words)];
+        std::memcpy(code, words.data(), sizeof(words));
+        counts.instructions++;
+        counts.memory += touches_memory(code);
+        ::ptrace(PTRACE_SINGLESTEP, pid, nullptr, nullptr);
+        ::waitpid(pid, &status, 0);
+    }
+    counts.exit_code = exit_code(status);
+    return counts;
+}
+
+} // namespace
+
+int main() {
+    constexpr int runs = 20;
+    int failures = 0;
+
+    for (const Program& program : k_programs) {
+        std::printf("%.*s\n", static_cast<int>(program.name.size()), program.name.data());
+        std::printf("  %-15s %12s %12s %10s %8s %7s\n", "build", "instructions", "memory ops", "time", "spilled", "folded");
+        std::optional<int> expected;
+        for (const Build& build : k_builds) {
+            const Compiled compiled = compile(program.source, build);
+            const std::string path = save(compiled.executable);
+
+            const Counts counts = single_step(path);
+            const double seconds = bench::best_of(runs, [&] {
+                int status = 0;
+                ::waitpid(spawn(path, false), &status, 0);
+            });
+            ::unlink(path.c_str());
+
+            std::printf("  %-15.*s %12zu %12zu %8.0f us %8zu %7zu\n", static_cast<int>(build.name.size()), build.name.data(),
+                        counts.instructions, counts.memory, seconds * 1e6, compiled.spilled, compiled.folded);
+            if (!counts.exit_code.has_value() || (expected.has_value() && counts.exit_code != expected)) {
+                std::fprintf(stderr, "  the exit code differs from the first build\n");
+                failures++;
+            }
+            if (!expected.has_value()) {
+                expected = counts.exit_code;
+            }
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+// Parse time and allocations of the streaming parser (the path of
+// Backend::parse_source) on a generated source, then lowering to the flat AST,
+// which is a copy held next to the arena, not a replacement of it.
+// The arena counts its own allocations (about one per AST node). Heap
+// allocations are counted by replacing operator new, they should not grow
+// with the source once the arena is warm.
+//   bench_parser [MB]
+
+#include "bench.hpp"
+
+#include "arena.hpp"
+#include "diagnostics.hpp"
+#include "flat_ast.hpp"
+#include "parser.hpp"
+#include "tokenization.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+namespace {
+
+std::atomic<size_t> g_heap_allocations { 0 };
+
+void* counted_alloc(size_t size, size_t alignment = 0) {
+    g_heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    size = size == 0 ? 1 : size;
+    // aligned_alloc wants a multiple of the alignment
+    void* pointer = alignment == 0 ? std::malloc(size) : std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+    if (pointer == nullptr) {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+} // namespace
+
+// Every replaceable form, so that no allocation is missed and each one is
+// freed by the matching replacement. The nothrow forms call these.
+void* operator new(size_t size) {
+    return counted_alloc(size);
+}
+
+void* operator new[](size_t size) {
+    return counted_alloc(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    return counted_alloc(size, static_cast<size_t>(alignment));
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return counted_alloc(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, std::align_val_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, size_t, std::align_val_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, size_t, std::align_val_t) noexcept {
+    std::free(pointer);
+}
+
+int main(int argc, char** argv) {
+    const std::string src = bench::generate_source(bench::source_bytes(argc, argv, 8));
+    const double bytes = static_cast<double>(src.size());
+    constexpr int runs = 5;
+
+    ArenaAllocator arena;
+    const auto parse = [&] {
+        arena.reset();
+        Diagnostics diagnostics;
+        Tokenizer tokenizer(src, &diagnostics);
+        Parser parser(tokenizer, diagnostics, arena);
+        NodeProg prog = parser.parse_prog().value();
+        if (diagnostics.has_errors()) {
+            std::fprintf(stderr, "the generated source does not parse: %s\n", diagnostics.all().front().message.c_str());
+            std::exit(1);
+        }
+        return prog;
+    };
+
+    parse(); // grows the arena, later parses reuse its block
+    const size_t heap_before = g_heap_allocations.load();
+    (void)parse();
+    const size_t heap_allocations = g_heap_allocations.load() - heap_before;
+    const size_t arena_allocations = arena.allocation_count();
+    const double parse_time = bench::best_of(runs, parse);
+
+    // Each parse rewinds the arena, so only the last one can be read
+    const NodeProg last = parse();
+    FlatAst ast;
+    const double lower_time = bench::best_of(runs, [&] { ast = FlatAst::lower(last); });
+
+    std::printf("source: %.1f MB\n", bytes / (1 << 20));
+    std::printf("parse           %6.2f ns/byte  %7.1f MB/s\n", parse_time * 1e9 / bytes, bytes / parse_time / (1 << 20));
+    std::printf("  arena allocations  %zu (%.3f per byte)\n", arena_allocations, static_cast<double>(arena_allocations) / bytes);
+    std::printf("  heap allocations   %zu\n", heap_allocations);
+    std::printf("  arena size         %.1f MB\n", static_cast<double>(arena.capacity()) / (1 << 20));
+    std::printf("lower to flat   %6.2f ns/byte\n", lower_time * 1e9 / bytes);
+    std::printf("  flat ast copy      %.1f MB, %zu expressions\n", static_cast<double>(ast.memory_bytes()) / (1 << 20), ast.expr_count());
+    std::printf("  peak (both)        %.1f MB\n", static_cast<double>(arena.capacity() + ast.memory_bytes()) / (1 << 20));
+    return 0;
+}
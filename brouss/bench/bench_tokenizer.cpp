@@ -0,0 +1,190 @@
+// Per-byte cost of the tokenizer on a generated source: the lexer as it was
+// before the DFA tables (kept below as a reference), the buffered DFA lexer,
+// the pull API used to stream mapped files and the parallel lexer used for
+// big sources. The "lex only" rows drop the tokens instead of buffering them,
+// the rest is the cost of writing the TokenBuffer. Exits non-zero when the
+// token streams differ.
+//   bench_tokenizer [MB]
+
+#include "bench.hpp"
+
+#include "parallel_tokenizer.hpp"
+#include "thread_pool.hpp"
+#include "tokenization.hpp"
+
+#include <cctype>
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace {
+
+// The lexer before the DFA tables: locale-dependent <cctype> classification,
+// optional<char> lookahead and a chain of string compares for the keywords.
+// Hands each token to push(type, offset, length).
+template <typename Push>
+void lex_reference(std::string_view src, Push&& push) {
+    size_t index = 0;
+    const auto peek = [&](size_t offset = 0) -> std::optional<char> {
+        if (index + offset >= src.size()) {
+            return {};
+        }
+        return src[index + offset];
+    };
+
+    while (peek().has_value()) {
+        const size_t start = index;
+        const char c = peek().value();
+        if (std::isalpha(c)) {
+            index++;
+            while (peek().has_value() && std::isalnum(peek().value())) {
+                index++;
+            }
+            const std::string_view buf = src.substr(start, index - start);
+            TokenType type = TokenType::ident;
+            if (buf == "exit") type = TokenType::exit;
+            else if (buf == "return") type = TokenType::return_;
+            else if (buf == "int") type = TokenType::int_type;
+            else if (buf == "float") type = TokenType::float_type;
+            else if (buf == "bool") type = TokenType::bool_type;
+            else if (buf == "true") type = TokenType::bool_true_lit;
+            else if (buf == "false") type = TokenType::bool_false_lit;
+            else if (buf == "char") type = TokenType::char_type;
+            else if (buf == "string") type = TokenType::string_type;
+            else if (buf == "print") type = TokenType::print;
+            else if (buf == "if") type = TokenType::if_;
+            else if (buf == "elif") type = TokenType::elif;
+            else if (buf == "else") type = TokenType::else_;
+            else if (buf == "while") type = TokenType::while_;
+            push(type, start, buf.size());
+        } else if (std::isdigit(c)) {
+            while (peek().has_value() && std::isdigit(peek().value())) {
+                index++;
+            }
+            TokenType type = TokenType::int_lit;
+            if (peek().has_value() && peek().value() == '.') {
+                index++;
+                while (peek().has_value() && std::isdigit(peek().value())) {
+                    index++;
+                }
+                type = TokenType::float_lit;
+            }
+            push(type, start, index - start);
+        } else if (c == '/' && peek(1).has_value() && peek(1).value() == '/') {
+            while (peek().has_value() && peek().value() != '\n') {
+                index++;
+            }
+        } else if (c == '/') {
+            index++;
+            push(TokenType::slash, start, 1);
+        } else if (c == '"') {
+            index++;
+            push(TokenType::quote_d, start, 1);
+            while (peek().has_value() && peek().value() != '"' && peek().value() != '\n') {
+                index++;
+            }
+            push(TokenType::string_lit, start + 1, index - start - 1);
+            push(TokenType::quote_d, index, 1);
+            index++;
+        } else if (c != '\n' && std::isspace(c)) {
+            index++;
+        } else {
+            index++;
+            push(k_punct_tokens[static_cast<unsigned char>(c)], start, 1);
+        }
+    }
+}
+
+TokenBuffer tokenize_reference(std::string_view src) {
+    TokenBuffer tokens(src);
+    tokens.reserve(src.size() / 2); // as Tokenizer::tokenize
+    lex_reference(src, [&](TokenType type, size_t offset, size_t length) {
+        tokens.push(type, offset, length);
+    });
+    return tokens;
+}
+
+// Same types and spans, and same decoded literals when the expected tokens
+// have them (the reference lexer does not decode numbers)
+bool same_tokens(const char* name, const TokenBuffer& expected, const TokenBuffer& tokens, bool literals) {
+    if (tokens.size() != expected.size()) {
+        std::fprintf(stderr, "%s: %zu tokens, expected %zu\n", name, tokens.size(), expected.size());
+        return false;
+    }
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        const Span span = tokens.span(i);
+        const Span expected_span = expected.span(i);
+        bool same = tokens.type(i) == expected.type(i) && span.offset == expected_span.offset && span.length == expected_span.length;
+        if (same && literals && tokens.type(i) == TokenType::int_lit) {
+            same = tokens.literal(i).int_value == expected.literal(i).int_value;
+        } else if (same && literals && tokens.type(i) == TokenType::float_lit) {
+            same = tokens.literal(i).float_value == expected.literal(i).float_value;
+        }
+        if (!same) {
+            std::fprintf(stderr, "%s: token %zu differs at offset %u\n", name, i, expected_span.offset);
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const std::string src = bench::generate_source(bench::source_bytes(argc, argv, 16));
+    const double bytes = static_cast<double>(src.size());
+    constexpr int runs = 5;
+
+    const double reference = bench::best_of(runs, [&] {
+        (void)tokenize_reference(src);
+    });
+
+    size_t lexed = 0;
+    const double reference_lex = bench::best_of(runs, [&] {
+        lexed = 0;
+        lex_reference(src, [&](TokenType, size_t, size_t) {
+            lexed++;
+        });
+    });
+
+    const double buffered = bench::best_of(runs, [&] {
+        Tokenizer tokenizer(src);
+        (void)tokenizer.tokenize();
+    });
+
+    size_t pulled = 0;
+    const double pull = bench::best_of(runs, [&] {
+        Tokenizer tokenizer(src);
+        pulled = 0;
+        while (tokenizer.next_token().has_value()) {
+            pulled++;
+        }
+    });
+
+    const double parallel = bench::best_of(runs, [&] {
+        (void)tokenize_parallel(src, ThreadPool::shared());
+    });
+
+    // The streams are compared outside of the timed runs
+    const TokenBuffer expected = tokenize_reference(src);
+    Tokenizer tokenizer(src);
+    const TokenBuffer tokens = tokenizer.tokenize();
+    TokenBuffer pulled_tokens(src);
+    Tokenizer puller(src);
+    while (const std::optional<Token> token = puller.next_token()) {
+        pulled_tokens.push(token->type, token->span.offset, token->span.length, token->literal);
+    }
+    const bool same = same_tokens("tokenize", expected, tokens, false)
+        && same_tokens("next_token", tokens, pulled_tokens, true)
+        && same_tokens("parallel", tokens, tokenize_parallel(src, ThreadPool::shared()), true)
+        && lexed == tokens.size() && pulled == tokens.size();
+
+    std::printf("source: %.1f MB, %zu tokens\n", bytes / (1 << 20), tokens.size());
+    std::printf("reference            %6.2f ns/byte  %7.1f MB/s\n", reference * 1e9 / bytes, bytes / reference / (1 << 20));
+    std::printf("reference, lex only  %6.2f ns/byte  %7.1f MB/s\n", reference_lex * 1e9 / bytes, bytes / reference_lex / (1 << 20));
+    std::printf("tokenize             %6.2f ns/byte  %7.1f MB/s\n", buffered * 1e9 / bytes, bytes / buffered / (1 << 20));
+    std::printf("next_token, lex only %6.2f ns/byte  %7.1f MB/s\n", pull * 1e9 / bytes, bytes / pull / (1 << 20));
+    std::printf("parallel x%-2zu         %6.2f ns/byte  %7.1f MB/s\n", ThreadPool::shared().size(), parallel * 1e9 / bytes, bytes / parallel / (1 << 20));
+    return same ? 0 : 1;
+}
@@ -1,85 +1,356 @@
 // git push -u origin main
 
 #include <cctype>
+#include <chrono>
 #include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <optional>
 #include <ostream>
 #include <string>
 #include <utility>
 #include <vector>
 #include <filesystem>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "compiler.hpp"
+#include "highlighter.hpp"
+
+#include <QQuickTextDocument>
+#include <QVariantList>
 
 #include "../src/include/tokenization.hpp"
+#include "../src/include/constant_folding.hpp"
+#include "../src/include/flat_ast.hpp"
+#include "../src/include/tree_view.hpp"
 #include "../src/include/generation.hpp"
+#include "../src/include/ir.hpp"
+#include "../src/include/jit.hpp"
+#include "../src/include/asm_writer.hpp"
+#include "../src/include/elf_writer.hpp"
+#include "../src/include/x86_encoder.hpp"
 #include "../src/include/parser.hpp"
+#include "../src/include/mapped_file.hpp"
+#include "../src/include/parallel_tokenizer.hpp"
 
 
 // git push -u origin main
 
-std::vector<Token> gen_token(std::string contents) {
-    Tokenizer tokenizer(std::move(contents));
-    std::vector<Token> tokens = tokenizer.tokenize();
-    tokens.push_back({.type = TokenType::semi });
+// The returned tokens point into contents, so it has to outlive them
+TokenBuffer gen_token(std::string_view contents, Diagnostics& diagnostics) {
+    TokenBuffer tokens = tokenize_parallel(contents, ThreadPool::shared(), &diagnostics);
+    tokens.push(TokenType::semi, contents.size());
     return tokens;
 }
 
-QString Backend::tokens_str(const QString &inputText) {
+// Result handed to QML:
+// { ok, text, diagnostics: [{ line, column, length, severity, message }] }
+// Lines and columns are 1-based, columns count characters like the TextArea does
+QVariantMap make_result(const QString& text, const Diagnostics& diagnostics, std::string_view src) {
+    QVariantList list;
+    const std::vector<std::pair<size_t, size_t>> positions = diagnostics.line_columns(src);
+    for (size_t i = 0; i < diagnostics.all().size(); ++i) {
+        const Diagnostic& diag = diagnostics.all()[i];
+        const auto [line, byte_column] = positions[i];
+        const size_t line_start = diag.span.offset - (byte_column - 1);
+        const qsizetype column = QString::fromUtf8(src.data() + line_start, static_cast<qsizetype>(byte_column - 1)).size() + 1;
+
+        QVariantMap entry;
+        entry["line"] = static_cast<qlonglong>(line);
+        entry["column"] = static_cast<qlonglong>(column);
+        entry["length"] = static_cast<qlonglong>(diag.span.length);
+        entry["severity"] = QString(diag.severity == Severity::error ? "error" : "warning");
+        entry["message"] = QString::fromStdString(diag.message);
+        list.push_back(entry);
+    }
+
+    QVariantMap result;
+    result["ok"] = !diagnostics.has_errors();
+    result["text"] = text;
+    result["diagnostics"] = list;
+    return result;
+}
+
+// Runs one stage, anything it throws (e.g. out of memory) becomes a diagnostic
+// instead of taking the application down
+template <typename Stage>
+QVariantMap run_stage(std::string_view src, Diagnostics& diagnostics, Stage&& stage) {
+    QString text;
+    try {
+        text = stage();
+    } catch (const std::exception& e) {
+        diagnostics.error({ 0, 0 }, std::string("Internal error: ") + e.what());
+    }
+    return make_result(text, diagnostics, src);
+}
+
+Q_INVOKABLE QVariantMap Backend::tokens_str(const QString &inputText) {
     std::string contents = inputText.toStdString();
-    std::vector<Token> tokens = gen_token(contents);
-    QString qtokens;
-    QTextStream stream(&qtokens);
+    Diagnostics diagnostics;
+    return run_stage(contents, diagnostics, [&] {
+        TokenBuffer tokens = gen_token(contents, diagnostics);
+        QString qtokens;
+        QTextStream stream(&qtokens);
+
+        for (size_t i = 0; i < tokens.size(); ++i) {
+            const Token token = tokens[i];
+            if (token.has_value()) {
+                stream << QString::fromUtf8(token.value.data(), static_cast<qsizetype>(token.value.size())) << ":" << QString::fromStdString(to_string(token.type)) << " ";
+            } else {
+                stream << QString::fromStdString(to_string(token.type)) << " ";
+            }
+
+            if (token.type == TokenType::semi) {
+                stream << "\n";
+            }
+        }
+        return qtokens;
+    });
+}
+
+// Past this many distinct subtrees the table starts over instead of growing forever
+constexpr size_t k_max_tree_nodes = 1 << 20;
+
+// Parsing never stops at the first error, the program holds every statement that parsed
+NodeProg gen_parse(Parser& parser) {
+    return parser.parse_prog().value();
+}
+
+// Below this size the source is streamed into one parser
+constexpr size_t k_parallel_parse_size = 1024 * 1024;
+
+// Parses into m_arena, which is reset first. A big source is lexed and
+// parsed on the thread pool, a small one is streamed without a token buffer.
+NodeProg Backend::parse_source(std::string_view src, Diagnostics& diagnostics) {
+    if (ThreadPool::shared().size() > 1 && src.size() >= k_parallel_parse_size) {
+        m_arena.reset();
+        return m_parser.parse(gen_token(src, diagnostics), diagnostics, m_arena);
+    }
+    return stream_source(src, diagnostics);
+}
 
-    for (Token token : tokens) {
-        if (token.value.has_value()) {
-            stream << QString::fromStdString(token.value.value()) << ":" << QString::fromStdString(to_string(token.type)) << " ";
+// Parses into m_arena, which is reset first, pulling the tokens one at a time:
+// memory stays bounded by the AST whatever the size of the source
+NodeProg Backend::stream_source(std::string_view src, Diagnostics& diagnostics) {
+    m_arena.reset();
+    Tokenizer tokenizer(src, &diagnostics);
+    Parser parser(tokenizer, diagnostics, m_arena);
+    return gen_parse(parser);
+}
+
+Q_INVOKABLE QVariantMap Backend::parse_str(const QString &inputText) {
+    // Shared, the cached statements point into the text they were parsed from
+    const auto contents = std::make_shared<const std::string>(inputText.toStdString());
+    Diagnostics diagnostics;
+    QVariantList changed;
+    QVariantMap result = run_stage(*contents, diagnostics, [&] {
+        if (m_trees.size() > k_max_tree_nodes) {
+            m_trees.clear();
+            m_statements.clear();
+            m_last_tree = k_no_tree;
+        }
+
+        // Only the statements edited since the last parse are parsed and
+        // printed again. With an error, the whole program is parsed as usual
+        // so every diagnostic is reported.
+        TreeId tree = k_no_tree;
+        std::string text;
+        if (std::optional<IncrementalParser::Result> parsed = m_statements.parse(contents, m_trees)) {
+            tree = parsed->tree;
+            text = std::move(parsed->text);
         } else {
-            stream << QString::fromStdString(to_string(token.type)) << " ";
+            NodeProg prog = parse_source(*contents, diagnostics);
+
+            // The tree is only walked here, parsing itself builds no display tree
+            const FlatAst ast = FlatAst::lower(prog);
+            const AstView view(ast);
+            tree = m_trees.intern(view, view.root());
+            text = m_trees.print(tree);
         }
 
-        if (token.type == TokenType::semi) {
-            stream << "\n";
+        // Interned, the diff only walks what differs
+        if (m_last_tree != k_no_tree) {
+            for (const uint32_t line : m_trees.diff(m_last_tree, tree)) {
+                changed.push_back(static_cast<qlonglong>(line) + 1);
+            }
         }
+        m_last_tree = tree;
+        return QString::fromStdString(text);
+    });
+    // Lines of the tree that differ from the previous parse (none after the first one)
+    result["changed"] = changed;
+    return result;
+}
+
+// Generated and optimized IR, nothing when the generator reports an error
+std::optional<IrProgram> gen_ir(const NodeProg& prog, Diagnostics& diagnostics, PassManager& passes) {
+    FlatAst ast = FlatAst::lower(prog);
+    ConstantFolder(ast, diagnostics).run();
+    Generator generator(ast, diagnostics);
+    IrProgram ir = generator.gen_ir();
+    if (diagnostics.has_errors()) {
+        return std::nullopt;
     }
-    return qtokens;
+    passes.run(ir);
+    return ir;
 }
 
-std::optional<NodeProg> gen_parse(Parser& parser) {
-    std::optional<NodeProg> prog = parser.parse_prog();
+// Appends the NASM listing of the IR to out
+void gen_asm(const IrProgram& ir, AsmWriter& out) {
+    emit_nasm(ir, out);
+}
 
-    if (!prog.has_value()) {
-        std::cerr << "Invalid program" << std::endl;
-        exit(EXIT_FAILURE);
+// Appends the optimized assembly to out, nothing when the generator reports an error
+void gen_asm(const NodeProg& prog, Diagnostics& diagnostics, PassManager& passes, AsmWriter& out) {
+    if (std::optional<IrProgram> ir = gen_ir(prog, diagnostics, passes)) {
+        gen_asm(*ir, out);
     }
+}
+
+// Static executable of the IR, encoded without nasm and ld
+std::vector<uint8_t> gen_elf(const IrProgram& ir) {
+    MachineCode code = X86Encoder(ir).encode();
+    return ElfWriter::write(code);
+}
 
-    return prog;
+// Writes the bytes to path as they are, without a stream in between
+bool write_output(const char* path, std::string_view bytes, mode_t mode, Diagnostics& diagnostics) {
+    const int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+    if (fd < 0) {
+        diagnostics.error({ 0, 0 }, std::string("Could not open ") + path + " for writing");
+        return false;
+    }
+    const bool written = ::fchmod(fd, mode) == 0 && AsmWriter::write_all(fd, bytes);
+    ::close(fd);
+    if (!written) {
+        diagnostics.error({ 0, 0 }, std::string("Could not write ") + path);
+    }
+    return written;
 }
 
+bool write_output(const char* path, const std::vector<uint8_t>& bytes, mode_t mode, Diagnostics& diagnostics) {
+    return write_output(path, std::string_view(reinterpret_cast<const char*>(bytes.data()), bytes.size()), mode, diagnostics);
+}
 
-Q_INVOKABLE QString Backend::parse_str(const QString &inputText) {
+Q_INVOKABLE QVariantMap Backend::assemble_str(const QString &inputText) {
     std::string contents = inputText.toStdString();
-    std::vector<Token> tokens = gen_token(contents);
-
-    Parser parser(std::move(tokens));
-    std::optional<NodeProg> prog = gen_parse(parser);
+    Diagnostics diagnostics;
+    QVariantMap result = run_stage(contents, diagnostics, [&] {
+        NodeProg prog = parse_source(contents, diagnostics);
+        if (diagnostics.has_errors()) {
+            return QString();
+        }
+        AsmWriter assembly;
+        gen_asm(prog, diagnostics, m_passes, assembly);
+        if (diagnostics.has_errors()) {
+            return QString();
+        }
+        return QString::fromUtf8(assembly.bytes().data(), static_cast<qsizetype>(assembly.bytes().size()));
+    });
+    // Rewrites done by each IR pass
+    QVariantMap passes;
+    for (const PassManager::Hits& hits : m_passes.hits()) {
+        passes[QString::fromUtf8(hits.pass.data(), static_cast<qsizetype>(hits.pass.size()))] = static_cast<qlonglong>(hits.count);
+    }
+    result["passes"] = passes;
+    return result;
+}
 
-    return parser.tree.print_tree();
+Q_INVOKABLE bool Backend::set_pass_enabled(const QString &name, bool enabled) {
+    return m_passes.set_enabled(name.toStdString(), enabled);
 }
 
-std::string gen_asm(const std::optional<NodeProg> prog) {
-    Generator generator(prog.value());
-    return generator.gen_prog();
+// Compiles a source file straight from its mapping and writes out.asm, like
+// the command line compiler. The text is not copied and the tokens are
+// streamed into the parser, whatever the size of the file.
+Q_INVOKABLE QVariantMap Backend::compile_file(const QString &path) {
+    std::optional<MappedFile> file = MappedFile::open(path.toStdString());
+    Diagnostics diagnostics;
+    if (!file.has_value()) {
+        diagnostics.error({ 0, 0 }, "Could not open " + path.toStdString());
+        return make_result({}, diagnostics, {});
+    }
+
+    const std::string_view src = file->view();
+    return run_stage(src, diagnostics, [&] {
+        NodeProg prog = stream_source(src, diagnostics);
+        if (diagnostics.has_errors()) {
+            return QString();
+        }
+        AsmWriter assembly;
+        gen_asm(prog, diagnostics, m_passes, assembly);
+        if (diagnostics.has_errors()) {
+            return QString();
+        }
+
+        if (!write_output("out.asm", assembly.bytes(), 0644, diagnostics)) {
+            return QString();
+        }
+        return QString("Wrote out.asm");
+    });
 }
 
-Q_INVOKABLE QString Backend::assemble_str(const QString &inputText) {
+// Writes the executable out straight from the IR, nasm and ld are not needed
+Q_INVOKABLE QVariantMap Backend::build_executable(const QString &inputText) {
     std::string contents = inputText.toStdString();
-    std::vector<Token> tokens = gen_token(contents);
+    Diagnostics diagnostics;
+    return run_stage(contents, diagnostics, [&] {
+        NodeProg prog = parse_source(contents, diagnostics);
+        if (diagnostics.has_errors()) {
+            return QString();
+        }
+        std::optional<IrProgram> ir = gen_ir(prog, diagnostics, m_passes);
+        if (!ir.has_value()) {
+            return QString();
+        }
+        const std::vector<uint8_t> executable = gen_elf(*ir);
+        if (!write_output("out", executable, 0755, diagnostics)) {
+            return QString();
+        }
+        return QString("Wrote out (%1 bytes)").arg(executable.size());
+    });
+}
+
+// A program run in the app that has not exited by then is stopped
+constexpr std::chrono::milliseconds k_jit_timeout { 2000 };
 
-    Parser parser(std::move(tokens));
-    std::optional<NodeProg> prog = gen_parse(parser);
-    return QString::fromStdString(gen_asm(prog));
+// Runs the program in-process, the text is what it printed followed by its
+// exit code, a fault (division by zero, timeout) is reported as a warning
+Q_INVOKABLE QVariantMap Backend::run_str(const QString &inputText) {
+    std::string contents = inputText.toStdString();
+    Diagnostics diagnostics;
+    int exit_code = 0;
+    QVariantMap result = run_stage(contents, diagnostics, [&] {
+        NodeProg prog = parse_source(contents, diagnostics);
+        if (diagnostics.has_errors()) {
+            return QString();
+        }
+        std::optional<IrProgram> ir = gen_ir(prog, diagnostics, m_passes);
+        if (!ir.has_value()) {
+            return QString();
+        }
+        const auto start = std::chrono::steady_clock::now();
+        const JitResult run = Jit::run(*ir, k_jit_timeout);
+        const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        if (run.fault.has_value()) {
+            diagnostics.warning({ 0, 0 }, *run.fault);
+        }
+        exit_code = run.exit_code;
+        QString text = QString::fromUtf8(run.output.data(), static_cast<qsizetype>(run.output.size()));
+        if (!text.isEmpty() && !text.endsWith('\n')) {
+            text += '\n';
+        }
+        if (run.fault.has_value()) {
+            return text + QString("[stopped after %1 us]").arg(elapsed.count());
+        }
+        return text + QString("[exit code %1, %2 us]").arg(exit_code).arg(elapsed.count());
+    });
+    result["exit_code"] = exit_code;
+    return result;
 }
 
 Q_INVOKABLE QString Backend::checkFile(const QString &inputText) {
@@ -123,3 +394,13 @@ Q_INVOKABLE QString Backend::deleteFile(const QString &inputText) {
         return inputText;
     }
 }
+
+Q_INVOKABLE void Backend::attachHighlighter(QQuickTextDocument *document) {
+    if (document == nullptr) {
+        return;
+    }
+    QTextDocument *doc = document->textDocument();
+    if (doc->findChild<Highlighter *>() == nullptr) {
+        new Highlighter(doc); // owned by the document
+    }
+}
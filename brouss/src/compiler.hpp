@@ -3,6 +3,15 @@
 
 #include <QObject>
 #include <QDebug>
+#include <QVariantMap>
+
+#include "include/arena.hpp"
+#include "include/incremental_parser.hpp"
+#include "include/ir.hpp"
+#include "include/parallel_parser.hpp"
+#include "include/tree_table.hpp"
+
+class QQuickTextDocument;
 
 class Backend : public QObject
 {
@@ -11,11 +20,33 @@ public:
     explicit Backend(QObject *parent = nullptr) : QObject(parent) {}
 
     // Q_INVOKABLE makes this function callable from QML
-    Q_INVOKABLE QString tokens_str(const QString &inputText);
-    Q_INVOKABLE QString parse_str(const QString &inputText);
-    Q_INVOKABLE QString assemble_str(const QString &inputText);
+    // The compile stages return { ok, text, diagnostics }, errors never end the process
+    Q_INVOKABLE QVariantMap tokens_str(const QString &inputText);
+    Q_INVOKABLE QVariantMap parse_str(const QString &inputText);
+    Q_INVOKABLE QVariantMap assemble_str(const QString &inputText);
+    Q_INVOKABLE QVariantMap compile_file(const QString &path);
+    Q_INVOKABLE QVariantMap build_executable(const QString &inputText);
+    Q_INVOKABLE QVariantMap run_str(const QString &inputText);
+    // Turns an IR pass of m_passes on or off for the next compilations, false for an unknown name
+    Q_INVOKABLE bool set_pass_enabled(const QString &name, bool enabled);
     Q_INVOKABLE QString checkFile(const QString &inputText);
     Q_INVOKABLE QString deleteFile(const QString &inputText);
+    Q_INVOKABLE void attachHighlighter(QQuickTextDocument *document);
+
+private:
+    NodeProg parse_source(std::string_view src, Diagnostics& diagnostics);
+    NodeProg stream_source(std::string_view src, Diagnostics& diagnostics);
+
+    // AST memory, reset by every compilation instead of being allocated again
+    ArenaAllocator m_arena;
+    ParallelParser m_parser;
+    // Trees of the successive parses, kept to show what an edit changed
+    TreeTable m_trees;
+    TreeId m_last_tree = k_no_tree;
+    // Statements of the last parses, only the edited ones are parsed again
+    IncrementalParser m_statements;
+    // Optimization of the generated IR, keeps the hit counts of the last run
+    PassManager m_passes = PassManager::standard();
 };
 
 #endif // COMPILER_H
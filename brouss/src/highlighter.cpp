@@ -0,0 +1,146 @@
+#include "highlighter.hpp"
+
+#include <QColor>
+#include <QTextBlock>
+#include <QTextCursor>
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+
+// Number of UTF-8 bytes, starting at from, that hold `units` UTF-16 code units
+static size_t utf8_length(std::string_view text, size_t from, int units) {
+    size_t i = from;
+    while (units > 0 && i < text.size()) {
+        const auto lead = static_cast<unsigned char>(text[i]);
+        const size_t len = lead < 0x80 ? 1 : lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : 4;
+        units -= len == 4 ? 2 : 1; // outside the BMP a character is a surrogate pair
+        i += len;
+    }
+    return std::min(i, text.size()) - from;
+}
+
+Highlighter::Highlighter(QTextDocument *document)
+    : QSyntaxHighlighter(static_cast<QObject *>(document))
+{
+    m_keywordFormat.setForeground(QColor(0x1f, 0x4e, 0xb4));
+    m_keywordFormat.setFontWeight(QFont::Bold);
+    m_typeFormat.setForeground(QColor(0x8b, 0x2f, 0x9c));
+    m_numberFormat.setForeground(QColor(0x0b, 0x7a, 0x75));
+    m_stringFormat.setForeground(QColor(0x2e, 0x7d, 0x32));
+    m_commentFormat.setForeground(Qt::gray);
+    m_commentFormat.setFontItalic(true);
+    m_invalidFormat.setUnderlineColor(Qt::red);
+    m_invalidFormat.setUnderlineStyle(QTextCharFormat::WaveUnderline);
+
+    resetLexer();
+    // Connected before setDocument, so the lexer is updated before the
+    // highlighter reformats the changed blocks
+    connect(document, &QTextDocument::contentsChange, this, &Highlighter::onContentsChange);
+    setDocument(document);
+}
+
+void Highlighter::resetLexer()
+{
+    const QTextDocument *doc = qobject_cast<QTextDocument *>(parent());
+    m_lexer.reset(doc->toPlainText().toStdString());
+    m_length = doc->characterCount() - 1;
+}
+
+void Highlighter::onContentsChange(int position, int charsRemoved, int charsAdded)
+{
+    QTextDocument *doc = qobject_cast<QTextDocument *>(parent());
+    const int length = doc->characterCount() - 1; // without the final paragraph separator
+
+    // Qt reports some changes (e.g. setText) with counts that include the
+    // final separator, those are simply lexed again from scratch
+    const QTextBlock block = doc->findBlock(position);
+    if (m_length - charsRemoved + charsAdded != length || !block.isValid()
+        || static_cast<size_t>(block.blockNumber()) >= m_lexer.line_count()) {
+        resetLexer();
+        return;
+    }
+
+    // The text before position is unchanged, so its byte offset can be taken
+    // from the new block and the length of the removed text from the old one
+    const QString prefix = block.text().left(position - block.position());
+    const size_t bytePos = m_lexer.line_start(static_cast<size_t>(block.blockNumber())) + static_cast<size_t>(prefix.toUtf8().size());
+    const size_t bytesRemoved = utf8_length(m_lexer.text(), bytePos, charsRemoved);
+
+    QTextCursor cursor(doc);
+    cursor.setPosition(position);
+    cursor.setPosition(position + charsAdded, QTextCursor::KeepAnchor);
+    QString inserted = cursor.selectedText();
+    inserted.replace(QChar::ParagraphSeparator, QLatin1Char('\n'));
+    inserted.replace(QChar::LineSeparator, QLatin1Char('\n'));
+
+    m_lexer.apply_edit(bytePos, bytesRemoved, inserted.toStdString());
+    m_length = length;
+}
+
+void Highlighter::highlightBlock(const QString &text)
+{
+    const int line = currentBlock().blockNumber();
+    if (line < 0 || static_cast<size_t>(line) >= m_lexer.line_count()) {
+        return;
+    }
+
+    const std::string_view lineText = m_lexer.line_text(static_cast<size_t>(line));
+    const bool ascii = static_cast<size_t>(text.size()) == lineText.size() - (lineText.ends_with('\n') ? 1 : 0);
+    auto column = [&](size_t byte) {
+        return ascii ? static_cast<int>(byte) : static_cast<int>(QString::fromUtf8(lineText.data(), static_cast<qsizetype>(byte)).size());
+    };
+
+    size_t end = 0; // end of the last real token, a comment can only start after it
+    for (const LineToken &token : m_lexer.line_tokens(static_cast<size_t>(line))) {
+        if (token.type == TokenType::semi && token.length == 1 && lineText[token.offset] == '\n') {
+            continue;
+        }
+        end = token.offset + token.length;
+        if (const QTextCharFormat *format = formatFor(token.type)) {
+            const int start = column(token.offset);
+            setFormat(start, column(token.offset + token.length) - start, *format);
+        }
+    }
+
+    // Comments are skipped by the lexer, whatever follows the last token is the comment
+    const size_t comment = lineText.find("//", end);
+    if (comment != std::string_view::npos) {
+        const int start = column(comment);
+        setFormat(start, static_cast<int>(text.size()) - start, m_commentFormat);
+    }
+}
+
+const QTextCharFormat *Highlighter::formatFor(TokenType type) const
+{
+    switch (type) {
+    case TokenType::exit:
+    case TokenType::return_:
+    case TokenType::print:
+    case TokenType::if_:
+    case TokenType::elif:
+    case TokenType::else_:
+    case TokenType::while_:
+        return &m_keywordFormat;
+    case TokenType::int_type:
+    case TokenType::float_type:
+    case TokenType::bool_type:
+    case TokenType::char_type:
+    case TokenType::string_type:
+    case TokenType::list_type:
+        return &m_typeFormat;
+    case TokenType::int_lit:
+    case TokenType::float_lit:
+    case TokenType::bool_true_lit:
+    case TokenType::bool_false_lit:
+        return &m_numberFormat;
+    case TokenType::quote_d:
+    case TokenType::quote_s:
+    case TokenType::string_lit:
+        return &m_stringFormat;
+    case TokenType::invalid:
+        return &m_invalidFormat;
+    default:
+        return nullptr;
+    }
+}
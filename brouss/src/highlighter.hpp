@@ -0,0 +1,38 @@
+#ifndef HIGHLIGHTER_H
+#define HIGHLIGHTER_H
+
+#include <QSyntaxHighlighter>
+#include <QTextCharFormat>
+#include <QTextDocument>
+
+#include "include/incremental_lexer.hpp"
+
+// Syntax highlighting for the editor. Every edit of the document is forwarded
+// to an IncrementalLexer, so only the lines it touches are lexed again, and
+// highlightBlock just reads the tokens of its line.
+class Highlighter : public QSyntaxHighlighter
+{
+    Q_OBJECT
+public:
+    explicit Highlighter(QTextDocument *document);
+
+protected:
+    void highlightBlock(const QString &text) override;
+
+private:
+    void onContentsChange(int position, int charsRemoved, int charsAdded);
+    void resetLexer();
+    [[nodiscard]] const QTextCharFormat *formatFor(TokenType type) const;
+
+    IncrementalLexer m_lexer;
+    int m_length = 0; // length of the document (in QChar) the lexer is in sync with
+
+    QTextCharFormat m_keywordFormat;
+    QTextCharFormat m_typeFormat;
+    QTextCharFormat m_numberFormat;
+    QTextCharFormat m_stringFormat;
+    QTextCharFormat m_commentFormat;
+    QTextCharFormat m_invalidFormat;
+};
+
+#endif // HIGHLIGHTER_H
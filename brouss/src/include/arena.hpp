@@ -1,15 +1,25 @@
 #pragma once
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <memory>
+#include <new>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
+// Bump allocator for the AST. Memory is taken from a chain of blocks, each one
+// twice as big as the previous, so it never runs out. reset() rewinds without
+// giving the memory back: an arena kept alive across compilations stops
+// allocating once it has grown to the size of the biggest program.
+// Objects are never destroyed one by one: emplace only takes trivially
+// destructible types, the others go through emplace_tracked.
 class ArenaAllocator {
 public:
-    explicit ArenaAllocator(const size_t max_num_bytes)
-        : m_size { max_num_bytes }
-        , m_buffer { new std::byte[max_num_bytes] }
-        , m_offset { m_buffer }
+    explicit ArenaAllocator(const size_t first_block_size = 64 * 1024)
+        : m_next_block_size { std::max<size_t>(first_block_size, 64) }
     {
     }
 
@@ -17,52 +27,222 @@ public:
     ArenaAllocator& operator=(const ArenaAllocator&) = delete;
 
     ArenaAllocator(ArenaAllocator&& other) noexcept
-        : m_size { std::exchange(other.m_size, 0) }
-        , m_buffer { std::exchange(other.m_buffer, nullptr) }
+        : m_blocks { std::move(other.m_blocks) }
         , m_offset { std::exchange(other.m_offset, nullptr) }
+        , m_end { std::exchange(other.m_end, nullptr) }
+        , m_next_block_size { other.m_next_block_size }
+        , m_destructors { std::exchange(other.m_destructors, nullptr) }
+        , m_allocation_count { std::exchange(other.m_allocation_count, 0) }
     {
+        other.m_blocks.clear();
     }
 
     ArenaAllocator& operator=(ArenaAllocator&& other) noexcept
     {
-        std::swap(m_size, other.m_size);
-        std::swap(m_buffer, other.m_buffer);
+        std::swap(m_blocks, other.m_blocks);
         std::swap(m_offset, other.m_offset);
+        std::swap(m_end, other.m_end);
+        std::swap(m_next_block_size, other.m_next_block_size);
+        std::swap(m_destructors, other.m_destructors);
+        std::swap(m_allocation_count, other.m_allocation_count);
         return *this;
     }
 
+    [[nodiscard]] void* allocate(const size_t size, const size_t alignment)
+    {
+        m_allocation_count++;
+        if (void* pointer = bump(size, alignment)) {
+            return pointer;
+        }
+        next_block(size, alignment);
+        return bump(size, alignment);
+    }
+
     template <typename T>
     [[nodiscard]] T* alloc()
     {
-        size_t remaining_num_bytes = m_size - static_cast<size_t>(m_offset - m_buffer);
-        auto pointer = static_cast<void*>(m_offset);
-        const auto aligned_address = std::align(alignof(T), sizeof(T), pointer, remaining_num_bytes);
-        if (aligned_address == nullptr) {
-            throw std::bad_alloc {};
-        }
-        m_offset = static_cast<std::byte*>(aligned_address) + sizeof(T);
-        return static_cast<T*>(aligned_address);
+        return static_cast<T*>(allocate(sizeof(T), alignof(T)));
     }
 
     template <typename T, typename... Args>
     [[nodiscard]] T* emplace(Args&&... args)
     {
+        static_assert(std::is_trivially_destructible_v<T>, "the arena does not destroy T, use emplace_tracked");
         const auto allocated_memory = alloc<T>();
         return new (allocated_memory) T { std::forward<Args>(args)... };
     }
 
+    // Same as emplace, but the destructor of the object is run by reset() and
+    // by the arena's destructor (in reverse order of construction)
+    template <typename T, typename... Args>
+    [[nodiscard]] T* emplace_tracked(Args&&... args)
+    {
+        const auto allocated_memory = alloc<T>();
+        T* object = new (allocated_memory) T { std::forward<Args>(args)... };
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            m_destructors = emplace<Destructor>(Destructor {
+                .object = object,
+                .destroy = [](void* pointer) { static_cast<T*>(pointer)->~T(); },
+                .next = m_destructors,
+            });
+        }
+        return object;
+    }
+
+    // Forgets every object at once, the blocks are kept for the next use.
+    // Several blocks are merged into one of their total size, so the next
+    // program of the same size fits in a single block.
+    void reset()
+    {
+        run_destructors();
+        m_allocation_count = 0;
+        if (m_blocks.size() > 1) {
+            size_t total = 0;
+            for (const Block& block : m_blocks) {
+                total += block.size;
+            }
+            m_blocks.clear();
+            m_blocks.push_back(Block::make(total));
+            m_next_block_size = total * 2;
+        }
+        if (m_blocks.empty()) {
+            m_offset = m_end = nullptr;
+        } else {
+            m_offset = m_blocks.front().data.get();
+            m_end = m_offset + m_blocks.front().size;
+        }
+    }
+
+    // Bytes reserved from the system
+    [[nodiscard]] size_t capacity() const
+    {
+        size_t total = 0;
+        for (const Block& block : m_blocks) {
+            total += block.size;
+        }
+        return total;
+    }
+
+    // Objects (and ArenaVector buffers) allocated since the last reset
+    [[nodiscard]] size_t allocation_count() const
+    {
+        return m_allocation_count;
+    }
+
     ~ArenaAllocator()
     {
-        // No destructors are called for the stored objects. Thus, memory
-        // leaks are possible (e.g. when storing std::vector objects or
-        // other non-trivially destructable objects in the allocator).
-        // Although this could be changed, it would come with additional
-        // runtime overhead and therefore is not implemented.
-        delete[] m_buffer;
+        run_destructors();
+    }
+
+private:
+    struct Block {
+        std::unique_ptr<std::byte[]> data;
+        size_t size;
+
+        static Block make(const size_t size)
+        {
+            return { std::unique_ptr<std::byte[]>(new std::byte[size]), size };
+        }
+    };
+
+    // Registered by emplace_tracked, stored in the arena itself
+    struct Destructor {
+        void* object;
+        void (*destroy)(void*);
+        Destructor* next;
+    };
+
+    void run_destructors()
+    {
+        while (m_destructors != nullptr) {
+            Destructor* destructor = std::exchange(m_destructors, m_destructors->next);
+            destructor->destroy(destructor->object);
+        }
+    }
+
+    void* bump(const size_t size, const size_t alignment)
+    {
+        if (m_offset == nullptr) {
+            return nullptr;
+        }
+        void* pointer = m_offset;
+        size_t remaining_num_bytes = static_cast<size_t>(m_end - m_offset);
+        const auto aligned_address = std::align(alignment, size, pointer, remaining_num_bytes);
+        if (aligned_address == nullptr) {
+            return nullptr;
+        }
+        m_offset = static_cast<std::byte*>(aligned_address) + size;
+        return aligned_address;
+    }
+
+    // Chains a new block big enough for the request, geometrically sized
+    void next_block(const size_t size, const size_t alignment)
+    {
+        const size_t block_size = std::max(m_next_block_size, size + alignment);
+        m_next_block_size = block_size * 2;
+        m_blocks.push_back(Block::make(block_size));
+        m_offset = m_blocks.back().data.get();
+        m_end = m_offset + block_size;
+    }
+
+    std::vector<Block> m_blocks;
+    std::byte* m_offset = nullptr;
+    std::byte* m_end = nullptr;
+    size_t m_next_block_size;
+    Destructor* m_destructors = nullptr; // most recent first
+    size_t m_allocation_count = 0;
+};
+
+// Growable array whose storage lives in an arena, for the child lists of the
+// AST. It has no destructor (nothing to free), so the nodes holding it stay
+// trivially destructible. Growing copies into a new buffer twice as big, the
+// old one is given back when the arena is reset.
+template <typename T>
+class ArenaVector {
+    static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>);
+
+public:
+    void push_back(ArenaAllocator& arena, const T& value)
+    {
+        if (m_size == m_capacity) {
+            const uint32_t capacity = m_capacity == 0 ? 4 : m_capacity * 2;
+            auto data = static_cast<T*>(arena.allocate(sizeof(T) * capacity, alignof(T)));
+            if (m_size > 0) {
+                std::memcpy(data, m_data, sizeof(T) * m_size);
+            }
+            m_data = data;
+            m_capacity = capacity;
+        }
+        m_data[m_size++] = value;
+    }
+
+    [[nodiscard]] size_t size() const
+    {
+        return m_size;
+    }
+
+    [[nodiscard]] bool empty() const
+    {
+        return m_size == 0;
+    }
+
+    [[nodiscard]] const T& operator[](const size_t index) const
+    {
+        return m_data[index];
+    }
+
+    [[nodiscard]] const T* begin() const
+    {
+        return m_data;
+    }
+
+    [[nodiscard]] const T* end() const
+    {
+        return m_data + m_size;
     }
 
 private:
-    size_t m_size;
-    std::byte* m_buffer;
-    std::byte* m_offset;
+    T* m_data = nullptr;
+    uint32_t m_size = 0;
+    uint32_t m_capacity = 0;
 };
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <unistd.h>
+
+// Output buffer of the assembly text: one contiguous block of bytes, grown by
+// doubling, with integers written in place by std::to_chars (no stream, no
+// temporary strings). The text is read in place with bytes(), handed over
+// without a copy by take(), or written straight to a file descriptor.
+class AsmWriter {
+public:
+  explicit AsmWriter(size_t capacity = 4096)
+    : m_buffer(std::max(capacity, k_min_capacity), '\0') {
+  }
+
+  void put(std::string_view text) {
+    reserve(text.size());
+    std::memcpy(m_buffer.data() + m_size, text.data(), text.size());
+    m_size += text.size();
+  }
+
+  void put(char c) {
+    reserve(1);
+    m_buffer[m_size++] = c;
+  }
+
+  void put_int(int64_t value) {
+    reserve(k_int_chars);
+    char* begin = m_buffer.data() + m_size;
+    m_size += static_cast<size_t>(std::to_chars(begin, begin + k_int_chars, value).ptr - begin);
+  }
+
+  // 0x and 8 upper case digits
+  void put_hex32(uint32_t value) {
+    static constexpr std::string_view k_digits = "0123456789ABCDEF";
+    reserve(10);
+    m_buffer[m_size++] = '0';
+    m_buffer[m_size++] = 'x';
+    for (int shift = 28; shift >= 0; shift -= 4) {
+      m_buffer[m_size++] = k_digits[(value >> shift) & 0xF];
+    }
+  }
+
+  [[nodiscard]] std::string_view bytes() const {
+    return { m_buffer.data(), m_size };
+  }
+
+  // Hands the text over, the writer is empty afterwards
+  [[nodiscard]] std::string take() {
+    m_buffer.resize(m_size);
+    m_size = 0;
+    return std::exchange(m_buffer, std::string(k_min_capacity, '\0'));
+  }
+
+  // Writes the whole text to fd (owned by the caller), false on a write error
+  [[nodiscard]] bool write_to(int fd) const {
+    return write_all(fd, bytes());
+  }
+
+  // Writes all of bytes to fd, retrying short and interrupted writes
+  [[nodiscard]] static bool write_all(int fd, std::string_view bytes) {
+    while (!bytes.empty()) {
+      const ssize_t written = ::write(fd, bytes.data(), bytes.size());
+      if (written < 0 && errno == EINTR) {
+        continue;
+      }
+      if (written <= 0) {
+        return false;
+      }
+      bytes.remove_prefix(static_cast<size_t>(written));
+    }
+    return true;
+  }
+
+private:
+  static constexpr size_t k_min_capacity = 64;
+  static constexpr size_t k_int_chars = 20; // -9223372036854775808
+
+  void reserve(size_t count) {
+    if (m_buffer.size() - m_size < count) {
+      m_buffer.resize(std::max(m_buffer.size() * 2, m_size + count));
+    }
+  }
+
+  std::string m_buffer; // its size is the capacity, m_size bytes are used
+  size_t m_size = 0;
+};
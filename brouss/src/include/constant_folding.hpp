@@ -0,0 +1,452 @@
+#pragma once
+
+#include "diagnostics.hpp"
+#include "flat_ast.hpp"
+#include "symbols.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Constant folding and propagation, run on the FlatAst before the generator.
+// Operators over int literals become the literal of their value, computed like
+// the generated code does: wrapping 64-bit add, sub and imul, unsigned div. A
+// division by zero is left for the program to fault on, an identity never
+// drops an operand holding a division.
+// The value of an int variable is known from a declaration or an assignment of
+// a constant up to the next assignment of anything else. A while loop forgets
+// the variables assigned in its body, an if keeps the values that every branch
+// leaves the same. Conditions that fold to a constant remove the branches that
+// cannot run, a branch that always runs becomes a plain scope. The generator
+// never sees a removed branch, so its names are checked here and reported with
+// the generator's messages.
+class ConstantFolder {
+public:
+  ConstantFolder(FlatAst& ast, Diagnostics& diagnostics)
+    : m_ast(ast), m_diagnostics(diagnostics), m_symbols(ast.ident_count()) {
+  }
+
+  void run() {
+    fold_stmts(m_ast.root());
+  }
+
+  // Operators and identifiers replaced by a literal or an operand
+  [[nodiscard]] size_t folded_count() const {
+    return m_folded;
+  }
+
+private:
+  using Value = std::optional<int64_t>;
+
+  // Found with the same lookup as the generator: the innermost declaration of the identifier
+  struct Var {
+    StmtKind decl;
+    Value value; // int variables only
+  };
+
+  // An if or elif and its scope, or an else when expr is k_no_node
+  struct Branch {
+    uint32_t expr;
+    uint32_t scope;
+    uint32_t pred; // k_no_node for the if itself
+  };
+
+  void fold_stmts(FlatScope scope) {
+    for (uint32_t i = scope.first; i < scope.first + scope.count; ++i) {
+      fold_stmt(i);
+    }
+  }
+
+  void fold_scope(uint32_t index) {
+    const size_t vars = m_vars.size();
+    m_symbols.begin_scope();
+    fold_stmts(m_ast.scope(index));
+    m_symbols.end_scope();
+    m_vars.resize(vars);
+  }
+
+  void fold_stmt(uint32_t index) {
+    FlatStmt& stmt = m_ast.stmt(index);
+    switch (stmt.kind) {
+    case StmtKind::exit:
+    case StmtKind::print:
+      fold_expr(stmt.expr);
+      break;
+
+    case StmtKind::int_decl:
+    case StmtKind::float_decl:
+    case StmtKind::string_decl: {
+      // Visible in its own initializer, like in the generator, but not known there
+      m_vars.push_back({ .decl = stmt.kind, .value = {} });
+      const size_t var = m_vars.size() - 1;
+      m_symbols.declare(ident(stmt.ident), static_cast<uint32_t>(var));
+      const Value value = fold_expr(stmt.expr);
+      if (stmt.kind == StmtKind::int_decl) {
+        m_vars[var].value = value;
+      }
+      break;
+    }
+
+    case StmtKind::assign: {
+      const Value value = fold_expr(stmt.expr);
+      if (Var* var = find_var(ident(stmt.ident))) {
+        var->value = var->decl == StmtKind::int_decl ? value : Value {};
+      }
+      break;
+    }
+
+    case StmtKind::scope:
+      fold_scope(stmt.scope);
+      break;
+
+    case StmtKind::if_:
+      fold_if(stmt);
+      break;
+
+    case StmtKind::while_: {
+      forget_assigned(stmt.scope);
+      const Value condition = fold_expr(stmt.expr);
+      if (condition == 0) {
+        check_removed_scope(stmt.scope);
+        make_scope(stmt, m_ast.push_scope({ 0, 0 }));
+        break;
+      }
+      // The state at the condition holds for every iteration and after the loop
+      const std::vector<Var> entry = m_vars;
+      fold_scope(stmt.scope);
+      m_vars = entry;
+      break;
+    }
+    }
+  }
+
+  void fold_if(FlatStmt& stmt) {
+    std::vector<Branch> live;
+    bool always_taken = false;
+    live.push_back({ .expr = stmt.expr, .scope = stmt.scope, .pred = k_no_node });
+    for (uint32_t pred = stmt.pred; pred != k_no_node; pred = m_ast.pred(pred).next) {
+      live.push_back({ .expr = m_ast.pred(pred).expr, .scope = m_ast.pred(pred).scope, .pred = pred });
+    }
+
+    // The conditions are evaluated in the state before the if, the ones after
+    // a branch that is always taken are never evaluated
+    std::erase_if(live, [&](const Branch& branch) {
+      if (always_taken) {
+        if (branch.expr != k_no_node) {
+          check_removed_expr(branch.expr);
+        }
+        check_removed_scope(branch.scope);
+        return true;
+      }
+      const Value condition = branch.expr == k_no_node ? Value { 1 } : fold_expr(branch.expr);
+      always_taken = condition.has_value() && *condition != 0;
+      if (condition == 0) {
+        check_removed_scope(branch.scope);
+      }
+      return condition == 0;
+    });
+
+    if (live.empty()) {
+      make_scope(stmt, m_ast.push_scope({ 0, 0 }));
+      return;
+    }
+    if (live.size() == 1 && always_taken) {
+      make_scope(stmt, live.front().scope);
+      fold_scope(stmt.scope);
+      return;
+    }
+
+    stmt.expr = live.front().expr;
+    stmt.scope = live.front().scope;
+    stmt.pred = live.size() > 1 ? live[1].pred : k_no_node;
+    for (size_t i = 1; i < live.size(); ++i) {
+      FlatPred& pred = m_ast.pred(live[i].pred);
+      pred.next = i + 1 < live.size() ? live[i + 1].pred : k_no_node;
+      if (always_taken && i + 1 == live.size()) {
+        pred.expr = k_no_node; // an elif that is always true is an else
+      }
+    }
+
+    // Without an else the if can run no branch, which leaves the state as it was
+    const std::vector<Var> entry = m_vars;
+    std::optional<std::vector<Var>> merged;
+    if (!always_taken) {
+      merged = entry;
+    }
+    for (const Branch& branch : live) {
+      m_vars = entry;
+      fold_scope(branch.scope);
+      if (!merged.has_value()) {
+        merged = m_vars;
+        continue;
+      }
+      for (size_t i = 0; i < merged->size(); ++i) {
+        if ((*merged)[i].value != m_vars[i].value) {
+          (*merged)[i].value.reset();
+        }
+      }
+    }
+    m_vars = std::move(*merged);
+  }
+
+  Value fold_expr(uint32_t index) {
+    const FlatExpr expr = m_ast.expr(index);
+    switch (expr.kind) {
+    case ExprKind::int_lit:
+      return m_ast.leaf(expr.lhs, TokenType::int_lit).literal.int_value;
+
+    case ExprKind::float_lit:
+    case ExprKind::string_lit:
+      return {};
+
+    case ExprKind::ident: {
+      const Var* var = find_var(ident(expr.lhs));
+      if (var == nullptr || !var->value.has_value()) {
+        return {};
+      }
+      make_int(index, *var->value);
+      return var->value;
+    }
+
+    case ExprKind::add:
+    case ExprKind::sub:
+    case ExprKind::mul:
+    case ExprKind::div:
+      break;
+    }
+
+    const Value lhs = fold_expr(expr.lhs);
+    const Value rhs = fold_expr(expr.rhs);
+    if (lhs.has_value() && rhs.has_value()) {
+      const auto a = static_cast<uint64_t>(*lhs);
+      const auto b = static_cast<uint64_t>(*rhs);
+      uint64_t value = 0;
+      switch (expr.kind) {
+      case ExprKind::add:
+        value = a + b;
+        break;
+      case ExprKind::sub:
+        value = a - b;
+        break;
+      case ExprKind::mul:
+        value = a * b;
+        break;
+      default:
+        if (b == 0) {
+          return {};
+        }
+        value = a / b;
+        break;
+      }
+      make_int(index, static_cast<int64_t>(value));
+      return static_cast<int64_t>(value);
+    }
+
+    // Identities, only over numbers: the operand dropped could be an undeclared
+    // identifier to report, and a string is not a number
+    if (!is_number(expr.lhs) || !is_number(expr.rhs)) {
+      return {};
+    }
+    switch (expr.kind) {
+    case ExprKind::add:
+      if (rhs == 0 || lhs == 0) {
+        replace(index, rhs == 0 ? expr.lhs : expr.rhs);
+      }
+      break;
+    case ExprKind::sub:
+    case ExprKind::div:
+      if (rhs == (expr.kind == ExprKind::sub ? 0 : 1)) {
+        replace(index, expr.lhs);
+      }
+      break;
+    case ExprKind::mul:
+      if ((rhs == 0 && !has_division(expr.lhs)) || (lhs == 0 && !has_division(expr.rhs))) {
+        make_int(index, 0);
+        return 0;
+      }
+      if (rhs == 1 || lhs == 1) {
+        replace(index, rhs == 1 ? expr.lhs : expr.rhs);
+      }
+      break;
+    default:
+      break;
+    }
+    return {};
+  }
+
+  [[nodiscard]] bool is_number(uint32_t index) const {
+    const FlatExpr& expr = m_ast.expr(index);
+    switch (expr.kind) {
+    case ExprKind::int_lit:
+    case ExprKind::float_lit:
+      return true;
+    case ExprKind::string_lit:
+      return false;
+    case ExprKind::ident: {
+      const Var* var = find_var(ident(expr.lhs));
+      return var != nullptr && var->decl != StmtKind::string_decl;
+    }
+    default:
+      return is_number(expr.lhs) && is_number(expr.rhs);
+    }
+  }
+
+  [[nodiscard]] bool has_division(uint32_t index) const {
+    const FlatExpr& expr = m_ast.expr(index);
+    switch (expr.kind) {
+    case ExprKind::div:
+      return true;
+    case ExprKind::add:
+    case ExprKind::sub:
+    case ExprKind::mul:
+      return has_division(expr.lhs) || has_division(expr.rhs);
+    default:
+      return false;
+    }
+  }
+
+  // The checks of the generator over a branch about to be removed: names used
+  // without a declaration and declarations of a name already visible
+  void check_removed_scope(uint32_t index) {
+    const size_t vars = m_vars.size();
+    m_symbols.begin_scope();
+    const FlatScope stmts = m_ast.scope(index);
+    for (uint32_t i = stmts.first; i < stmts.first + stmts.count; ++i) {
+      check_removed_stmt(m_ast.stmt(i));
+    }
+    m_symbols.end_scope();
+    m_vars.resize(vars);
+  }
+
+  void check_removed_stmt(const FlatStmt& stmt) {
+    switch (stmt.kind) {
+    case StmtKind::exit:
+    case StmtKind::print:
+      check_removed_expr(stmt.expr);
+      break;
+    case StmtKind::int_decl:
+    case StmtKind::float_decl:
+    case StmtKind::string_decl:
+      if (find_var(ident(stmt.ident)) != nullptr) {
+        report(stmt.ident, "Redeclared identifier: ");
+      }
+      m_vars.push_back({ .decl = stmt.kind, .value = {} });
+      m_symbols.declare(ident(stmt.ident), static_cast<uint32_t>(m_vars.size() - 1));
+      check_removed_expr(stmt.expr);
+      break;
+    case StmtKind::assign:
+      if (find_var(ident(stmt.ident)) == nullptr) {
+        report(stmt.ident, "Undeclared identifier in assignment: ");
+        break;
+      }
+      check_removed_expr(stmt.expr);
+      break;
+    case StmtKind::scope:
+      check_removed_scope(stmt.scope);
+      break;
+    case StmtKind::if_:
+      check_removed_expr(stmt.expr);
+      check_removed_scope(stmt.scope);
+      for (uint32_t pred = stmt.pred; pred != k_no_node; pred = m_ast.pred(pred).next) {
+        if (m_ast.pred(pred).expr != k_no_node) {
+          check_removed_expr(m_ast.pred(pred).expr);
+        }
+        check_removed_scope(m_ast.pred(pred).scope);
+      }
+      break;
+    case StmtKind::while_:
+      check_removed_expr(stmt.expr);
+      check_removed_scope(stmt.scope);
+      break;
+    }
+  }
+
+  void check_removed_expr(uint32_t index) {
+    const FlatExpr& expr = m_ast.expr(index);
+    switch (expr.kind) {
+    case ExprKind::ident:
+      if (find_var(ident(expr.lhs)) == nullptr) {
+        report(expr.lhs, "Undeclared identifier: ");
+      }
+      break;
+    case ExprKind::add:
+    case ExprKind::sub:
+    case ExprKind::mul:
+    case ExprKind::div:
+      check_removed_expr(expr.lhs);
+      check_removed_expr(expr.rhs);
+      break;
+    default:
+      break;
+    }
+  }
+
+  void report(uint32_t leaf, const std::string& message) {
+    const Token ident = m_ast.leaf(leaf, TokenType::ident);
+    m_diagnostics.error(ident.span, message + std::string(ident.value));
+  }
+
+  // Every variable assigned in the scope, nested scopes included, is unknown
+  void forget_assigned(uint32_t scope) {
+    const FlatScope stmts = m_ast.scope(scope);
+    for (uint32_t i = stmts.first; i < stmts.first + stmts.count; ++i) {
+      const FlatStmt& stmt = m_ast.stmt(i);
+      switch (stmt.kind) {
+      case StmtKind::assign:
+        if (Var* var = find_var(ident(stmt.ident))) {
+          var->value.reset();
+        }
+        break;
+      case StmtKind::if_:
+        for (uint32_t pred = stmt.pred; pred != k_no_node; pred = m_ast.pred(pred).next) {
+          forget_assigned(m_ast.pred(pred).scope);
+        }
+        forget_assigned(stmt.scope);
+        break;
+      case StmtKind::scope:
+      case StmtKind::while_:
+        forget_assigned(stmt.scope);
+        break;
+      default:
+        break;
+      }
+    }
+  }
+
+  void make_int(uint32_t index, int64_t value) {
+    m_ast.expr(index) = { .kind = ExprKind::int_lit, .lhs = m_ast.push_int_leaf(value), .rhs = k_no_node };
+    m_folded++;
+  }
+
+  void replace(uint32_t index, uint32_t operand) {
+    m_ast.expr(index) = m_ast.expr(operand);
+    m_folded++;
+  }
+
+  static void make_scope(FlatStmt& stmt, uint32_t scope) {
+    stmt = { .kind = StmtKind::scope, .ident = k_no_node, .expr = k_no_node, .scope = scope, .pred = k_no_node };
+  }
+
+  [[nodiscard]] uint32_t ident(uint32_t leaf) const {
+    return m_ast.ident(leaf);
+  }
+
+  [[nodiscard]] Var* find_var(uint32_t ident) {
+    const uint32_t index = m_symbols.find(ident);
+    return index == SymbolTable::k_none ? nullptr : &m_vars[index];
+  }
+
+  [[nodiscard]] const Var* find_var(uint32_t ident) const {
+    const uint32_t index = m_symbols.find(ident);
+    return index == SymbolTable::k_none ? nullptr : &m_vars[index];
+  }
+
+  FlatAst& m_ast;
+  Diagnostics& m_diagnostics;
+  std::vector<Var> m_vars; // declarations in scope, in order
+  SymbolTable m_symbols;   // identifier -> m_vars
+  size_t m_folded = 0;
+};
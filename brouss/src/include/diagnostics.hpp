@@ -0,0 +1,98 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Position of a token in the source (byte offset and length)
+struct Span {
+    uint32_t offset;
+    uint32_t length;
+};
+
+enum class Severity {
+    error,
+    warning,
+};
+
+struct Diagnostic {
+    Severity severity;
+    Span span;
+    std::string message;
+};
+
+// Collects the errors of every stage (lexer, parser, generator) instead of
+// stopping at the first one, so a single run reports all of them
+class Diagnostics {
+public:
+    inline void error(Span span, std::string message) {
+        m_list.push_back({ .severity = Severity::error, .span = span, .message = std::move(message) });
+        m_error_count++;
+    }
+
+    inline void warning(Span span, std::string message) {
+        m_list.push_back({ .severity = Severity::warning, .span = span, .message = std::move(message) });
+    }
+
+    [[nodiscard]] inline bool has_errors() const {
+        return m_error_count > 0;
+    }
+
+    [[nodiscard]] inline const std::vector<Diagnostic>& all() const {
+        return m_list;
+    }
+
+    // Adds the diagnostics of a part of the source that starts at base
+    inline void append(const Diagnostics& part, size_t base) {
+        for (Diagnostic diag : part.m_list) {
+            diag.span.offset += static_cast<uint32_t>(base);
+            m_list.push_back(std::move(diag));
+        }
+        m_error_count += part.m_error_count;
+    }
+
+    inline void clear() {
+        m_list.clear();
+        m_error_count = 0;
+    }
+
+    // 1-based line and (byte) column of each diagnostic, in the order of all().
+    // The offsets are visited in ascending order, so the source is scanned once
+    // up to the last of them whatever the number of diagnostics.
+    [[nodiscard]] std::vector<std::pair<size_t, size_t>> line_columns(std::string_view src) const {
+        std::vector<uint32_t> order(m_list.size());
+        for (uint32_t i = 0; i < order.size(); ++i) {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return m_list[a].span.offset < m_list[b].span.offset; });
+
+        std::vector<std::pair<size_t, size_t>> positions(m_list.size());
+        size_t line = 1;
+        size_t line_start = 0;
+        size_t scanned = 0;
+        for (const uint32_t i : order) {
+            const size_t offset = std::min<size_t>(m_list[i].span.offset, src.size());
+            while (scanned < offset) {
+                const void* newline = std::memchr(src.data() + scanned, '\n', offset - scanned);
+                if (newline == nullptr) {
+                    scanned = offset;
+                    break;
+                }
+                scanned = static_cast<size_t>(static_cast<const char*>(newline) - src.data()) + 1;
+                line++;
+                line_start = scanned;
+            }
+            positions[i] = { line, offset - line_start + 1 };
+        }
+        return positions;
+    }
+
+private:
+    std::vector<Diagnostic> m_list;
+    size_t m_error_count = 0;
+};
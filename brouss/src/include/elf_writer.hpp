@@ -0,0 +1,138 @@
+#pragma once
+
+#include "x86_encoder.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+// Static ELF64 executable of some MachineCode, in place of nasm -felf64 and ld.
+// The first PT_LOAD maps the headers and .text read/execute from 0x400000,
+// the second maps .data read/write from the next page boundary of the file,
+// so both segments keep vaddr = file offset (mod page). The section headers
+// (.text, .data, .shstrtab) are only there for objdump and gdb.
+class ElfWriter {
+public:
+  static constexpr uint64_t k_base = 0x400000;
+
+  // Bytes of the file, its size is known up front so they are allocated once.
+  // Fills the rip-relative references to the data in code.text.
+  [[nodiscard]] static std::vector<uint8_t> write(MachineCode& code) {
+    const bool has_data = !code.data.empty();
+    const uint64_t phnum = has_data ? 2 : 1;
+    const uint64_t text_offset = k_ehdr_size + phnum * k_phdr_size;
+    const uint64_t text_end = text_offset + code.text.size();
+    const uint64_t data_offset = align(text_end, k_page);
+    const uint64_t data_end = data_offset + code.data.size();
+    const uint64_t shstrtab_offset = data_end;
+    const uint64_t shdr_offset = align(shstrtab_offset + k_shstrtab.size(), 8);
+
+    for (const DataRef& ref : code.data_refs) {
+      const int64_t rel = static_cast<int64_t>(data_offset + ref.offset) - static_cast<int64_t>(text_offset + ref.at + 4);
+      for (size_t i = 0; i < 4; ++i) {
+        code.text[ref.at + i] = static_cast<uint8_t>(static_cast<uint64_t>(rel) >> (8 * i));
+      }
+    }
+
+    std::vector<uint8_t> out;
+    out.reserve(shdr_offset + 4 * k_shdr_size);
+
+    // Elf64_Ehdr
+    for (const uint8_t byte : k_ident) {
+      out.push_back(byte);
+    }
+    le(out, 0, 8);
+    le(out, 2, 2); // ET_EXEC
+    le(out, 62, 2); // EM_X86_64
+    le(out, 1, 4);
+    le(out, k_base + text_offset, 8); // e_entry
+    le(out, k_ehdr_size, 8); // e_phoff
+    le(out, shdr_offset, 8);
+    le(out, 0, 4);
+    le(out, k_ehdr_size, 2);
+    le(out, k_phdr_size, 2);
+    le(out, phnum, 2);
+    le(out, k_shdr_size, 2);
+    le(out, 4, 2); // e_shnum
+    le(out, 3, 2); // e_shstrndx
+
+    program_header(out, 5, 0, text_end); // R | X
+    if (has_data) {
+      program_header(out, 6, data_offset, code.data.size()); // R | W
+    }
+
+    put(out, code.text);
+    pad(out, text_end, data_offset);
+    put(out, code.data);
+    out.insert(out.end(), k_shstrtab.begin(), k_shstrtab.end());
+    pad(out, shstrtab_offset + k_shstrtab.size(), shdr_offset);
+
+    section_header(out, {});
+    section_header(out, { .name = 1, .type = 1, .flags = 6, .offset = text_offset, .size = code.text.size(), .align = 16 });
+    section_header(out, { .name = 7, .type = 1, .flags = 3, .offset = data_offset, .size = code.data.size(), .align = 8 });
+    section_header(out, { .name = 13, .type = 3, .flags = 0, .offset = shstrtab_offset, .size = k_shstrtab.size(), .align = 1 });
+    return out;
+  }
+
+private:
+  static constexpr uint64_t k_page = 0x1000;
+  static constexpr uint64_t k_ehdr_size = 64;
+  static constexpr uint64_t k_phdr_size = 56;
+  static constexpr uint64_t k_shdr_size = 64;
+  static constexpr std::array<uint8_t, 8> k_ident { 0x7F, 'E', 'L', 'F', 2, 1, 1, 0 }; // 64-bit, little endian, SysV
+  static constexpr std::string_view k_shstrtab { "\0.text\0.data\0.shstrtab\0", 24 };
+
+  struct Section {
+    uint32_t name; // offset in k_shstrtab
+    uint32_t type; // 1 PROGBITS, 3 STRTAB
+    uint64_t flags; // 1 WRITE, 2 ALLOC, 4 EXECINSTR
+    uint64_t offset;
+    uint64_t size;
+    uint64_t align;
+  };
+
+  static void program_header(std::vector<uint8_t>& out, uint32_t flags, uint64_t offset, uint64_t size) {
+    le(out, 1, 4); // PT_LOAD
+    le(out, flags, 4);
+    le(out, offset, 8);
+    le(out, k_base + offset, 8); // p_vaddr
+    le(out, k_base + offset, 8); // p_paddr
+    le(out, size, 8); // p_filesz
+    le(out, size, 8); // p_memsz
+    le(out, k_page, 8);
+  }
+
+  static void section_header(std::vector<uint8_t>& out, const Section& section) {
+    le(out, section.name, 4);
+    le(out, section.type, 4);
+    le(out, section.flags, 8);
+    le(out, section.flags & 2 ? k_base + section.offset : 0, 8); // sh_addr
+    le(out, section.offset, 8);
+    le(out, section.size, 8);
+    le(out, 0, 4); // sh_link
+    le(out, 0, 4); // sh_info
+    le(out, section.align, 8);
+    le(out, 0, 8); // sh_entsize
+  }
+
+  static void le(std::vector<uint8_t>& out, uint64_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; ++i) {
+      out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+  }
+
+  static void put(std::vector<uint8_t>& out, std::span<const uint8_t> bytes) {
+    out.insert(out.end(), bytes.begin(), bytes.end());
+  }
+
+  static void pad(std::vector<uint8_t>& out, uint64_t from, uint64_t to) {
+    out.insert(out.end(), to - from, 0);
+  }
+
+  [[nodiscard]] static uint64_t align(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+  }
+};
@@ -0,0 +1,323 @@
+#pragma once
+
+#include "parser.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// (AST) Flat form of the program, lowered from the parser's NodeProg.
+// Every kind of node lives in its own contiguous pool and nodes refer to each
+// other with 32-bit indices: an expression is one FlatExpr (no NodeExpr ->
+// NodeTerm -> NodeTermNumber chain) and the statements of a scope are a range
+// of the statement pool. Parentheses only group, they are not kept.
+// Identifiers are interned while lowering: the leaf of an identifier holds a
+// dense id, the same for every use of the name, for the symbol tables.
+// It is a copy for codegen and printing, made in addition to the pointer AST,
+// which stays in the parser's arena: peak memory is the sum of both.
+
+inline constexpr uint32_t k_no_node = UINT32_MAX;
+
+enum class ExprKind : uint8_t {
+    int_lit,
+    float_lit,
+    ident,
+    string_lit,
+    add,
+    sub,
+    mul,
+    div,
+};
+
+// Token of a literal or an identifier, its type is given by the node using it
+struct FlatLeaf {
+    const char* text;
+    uint32_t length;
+    uint32_t offset;
+    Literal literal;
+};
+
+// Literals and identifiers: lhs is the index of their token in the leaf pool.
+// Operators: lhs and rhs are the indices of the operands in the expression pool.
+struct FlatExpr {
+    ExprKind kind;
+    uint32_t lhs;
+    uint32_t rhs;
+};
+
+enum class StmtKind : uint8_t {
+    exit,
+    print,
+    int_decl,
+    float_decl,
+    string_decl,
+    assign,
+    scope,
+    if_,
+    while_,
+};
+
+// Fields that a kind does not use are k_no_node
+struct FlatStmt {
+    StmtKind kind;
+    uint32_t ident; // leaf (declarations and assign)
+    uint32_t expr;
+    uint32_t scope;
+    uint32_t pred; // first elif / else of an if
+};
+
+// The statements of a scope are contiguous in the statement pool
+struct FlatScope {
+    uint32_t first;
+    uint32_t count;
+};
+
+// elif, or else when expr is k_no_node; next is the following elif / else
+struct FlatPred {
+    uint32_t expr;
+    uint32_t scope;
+    uint32_t next;
+};
+
+class FlatAst {
+public:
+    [[nodiscard]] static FlatAst lower(const NodeProg& prog) {
+        FlatAst ast;
+        ast.m_root = ast.lower_stmts(prog.stmts);
+        ast.m_exprs.shrink_to_fit();
+        ast.m_leaves.shrink_to_fit();
+        ast.m_stmts.shrink_to_fit();
+        ast.m_scopes.shrink_to_fit();
+        ast.m_preds.shrink_to_fit();
+        return ast;
+    }
+
+    [[nodiscard]] FlatScope root() const {
+        return m_root;
+    }
+
+    [[nodiscard]] const FlatExpr& expr(uint32_t index) const {
+        return m_exprs[index];
+    }
+
+    [[nodiscard]] size_t expr_count() const {
+        return m_exprs.size();
+    }
+
+    [[nodiscard]] Token leaf(uint32_t index, TokenType type) const {
+        const FlatLeaf& leaf = m_leaves[index];
+        return {
+            .type = type,
+            .value = std::string_view(leaf.text, leaf.length),
+            .span = { leaf.offset, leaf.length },
+            .literal = leaf.literal,
+        };
+    }
+
+    // Interned id of an identifier leaf, below ident_count()
+    [[nodiscard]] uint32_t ident(uint32_t leaf) const {
+        return m_leaves[leaf].literal.ident;
+    }
+
+    [[nodiscard]] size_t ident_count() const {
+        return m_ident_ids.size();
+    }
+
+    [[nodiscard]] const FlatStmt& stmt(uint32_t index) const {
+        return m_stmts[index];
+    }
+
+    [[nodiscard]] const FlatScope& scope(uint32_t index) const {
+        return m_scopes[index];
+    }
+
+    [[nodiscard]] const FlatPred& pred(uint32_t index) const {
+        return m_preds[index];
+    }
+
+    // Rewriting, for the passes that run between the parser and the generator
+    [[nodiscard]] FlatExpr& expr(uint32_t index) {
+        return m_exprs[index];
+    }
+
+    [[nodiscard]] FlatStmt& stmt(uint32_t index) {
+        return m_stmts[index];
+    }
+
+    [[nodiscard]] FlatPred& pred(uint32_t index) {
+        return m_preds[index];
+    }
+
+    // Leaf of an int literal computed by a pass, its text is owned by the ast
+    uint32_t push_int_leaf(int64_t value) {
+        const std::string& text = m_texts.emplace_back(std::to_string(value));
+        m_leaves.push_back({ .text = text.data(), .length = static_cast<uint32_t>(text.size()), .offset = 0, .literal = { .int_value = value } });
+        return static_cast<uint32_t>(m_leaves.size() - 1);
+    }
+
+    uint32_t push_scope(FlatScope scope) {
+        m_scopes.push_back(scope);
+        return static_cast<uint32_t>(m_scopes.size() - 1);
+    }
+
+    // Bytes held by the pools, on top of the arena of the NodeProg
+    [[nodiscard]] size_t memory_bytes() const {
+        return m_exprs.capacity() * sizeof(FlatExpr) + m_leaves.capacity() * sizeof(FlatLeaf)
+            + m_stmts.capacity() * sizeof(FlatStmt) + m_scopes.capacity() * sizeof(FlatScope)
+            + m_preds.capacity() * sizeof(FlatPred);
+    }
+
+private:
+    // The statements of a list are placed first so they stay contiguous, the
+    // nested scopes come after them
+    template <typename Stmts>
+    FlatScope lower_stmts(const Stmts& stmts) {
+        const FlatScope range { static_cast<uint32_t>(m_stmts.size()), static_cast<uint32_t>(stmts.size()) };
+        m_stmts.resize(m_stmts.size() + stmts.size());
+        for (size_t i = 0; i < stmts.size(); ++i) {
+            const FlatStmt stmt = lower_stmt(stmts[i]);
+            m_stmts[range.first + i] = stmt;
+        }
+        return range;
+    }
+
+    uint32_t lower_scope(const NodeScope* scope) {
+        const FlatScope range = lower_stmts(scope->stmts);
+        m_scopes.push_back(range);
+        return static_cast<uint32_t>(m_scopes.size() - 1);
+    }
+
+    FlatStmt lower_stmt(const NodeStatement* stmt) {
+        FlatStmt flat { .kind = StmtKind::exit, .ident = k_no_node, .expr = k_no_node, .scope = k_no_node, .pred = k_no_node };
+        struct StmtVisitor {
+            FlatAst& ast;
+            FlatStmt& flat;
+
+            void operator()(const NodeStatementExit* exit) const {
+                flat.kind = StmtKind::exit;
+                flat.expr = ast.lower_expr(exit->expr);
+            }
+            void operator()(const NodeStatementPrint* print) const {
+                flat.kind = StmtKind::print;
+                flat.expr = ast.lower_expr(print->expr);
+            }
+            void operator()(const NodeStatementInt* decl) const {
+                declare(StmtKind::int_decl, decl->ident, decl->expr);
+            }
+            void operator()(const NodeStatementFloat* decl) const {
+                declare(StmtKind::float_decl, decl->ident, decl->expr);
+            }
+            void operator()(const NodeStatementString* decl) const {
+                declare(StmtKind::string_decl, decl->ident, decl->expr);
+            }
+            void operator()(const NodeStatementAssign* assign) const {
+                declare(StmtKind::assign, assign->ident, assign->expr);
+            }
+            void operator()(const NodeScope* scope) const {
+                flat.kind = StmtKind::scope;
+                flat.scope = ast.lower_scope(scope);
+            }
+            void operator()(const NodeStmtIf* stmt_if) const {
+                flat.kind = StmtKind::if_;
+                flat.expr = ast.lower_expr(stmt_if->expr);
+                flat.scope = ast.lower_scope(stmt_if->scope);
+                flat.pred = stmt_if->pred.has_value() ? ast.lower_pred(stmt_if->pred.value()) : k_no_node;
+            }
+            void operator()(const NodeStmtWhile* stmt_while) const {
+                flat.kind = StmtKind::while_;
+                flat.expr = ast.lower_expr(stmt_while->expr);
+                flat.scope = ast.lower_scope(stmt_while->scope);
+            }
+
+            void declare(StmtKind kind, const Token& ident, const NodeExpr* expr) const {
+                flat.kind = kind;
+                flat.ident = ast.push_ident(ident);
+                flat.expr = ast.lower_expr(expr);
+            }
+        };
+        std::visit(StmtVisitor { .ast = *this, .flat = flat }, stmt->var);
+        return flat;
+    }
+
+    uint32_t lower_pred(const NodeIfPred* pred) {
+        const auto index = static_cast<uint32_t>(m_preds.size());
+        m_preds.push_back({ .expr = k_no_node, .scope = k_no_node, .next = k_no_node });
+        FlatPred flat = m_preds[index];
+        if (std::holds_alternative<NodePredElif*>(pred->var)) {
+            const NodePredElif* elif = std::get<NodePredElif*>(pred->var);
+            flat.expr = lower_expr(elif->expr);
+            flat.scope = lower_scope(elif->scope);
+            flat.next = elif->pred.has_value() ? lower_pred(elif->pred.value()) : k_no_node;
+        } else {
+            flat.scope = lower_scope(std::get<NodePredElse*>(pred->var)->scope);
+        }
+        m_preds[index] = flat;
+        return index;
+    }
+
+    uint32_t lower_expr(const NodeExpr* expr) {
+        if (std::holds_alternative<NodeBinExpr*>(expr->var)) {
+            struct BinVisitor {
+                FlatAst& ast;
+                uint32_t operator()(const NodeBinExprAdd* add) const { return ast.push_bin(ExprKind::add, add->lhs, add->rhs); }
+                uint32_t operator()(const NodeBinExprMinus* sub) const { return ast.push_bin(ExprKind::sub, sub->lhs, sub->rhs); }
+                uint32_t operator()(const NodeBinExprMulti* mul) const { return ast.push_bin(ExprKind::mul, mul->lhs, mul->rhs); }
+                uint32_t operator()(const NodeBinExprDiv* div) const { return ast.push_bin(ExprKind::div, div->lhs, div->rhs); }
+            };
+            return std::visit(BinVisitor { .ast = *this }, std::get<NodeBinExpr*>(expr->var)->var);
+        }
+
+        struct TermVisitor {
+            FlatAst& ast;
+            uint32_t operator()(const NodeTermNumber* number) const {
+                const ExprKind kind = number->number.type == TokenType::float_lit ? ExprKind::float_lit : ExprKind::int_lit;
+                return ast.push_expr({ .kind = kind, .lhs = ast.push_leaf(number->number), .rhs = k_no_node });
+            }
+            uint32_t operator()(const NodeTermIdent* ident) const {
+                return ast.push_expr({ .kind = ExprKind::ident, .lhs = ast.push_ident(ident->ident), .rhs = k_no_node });
+            }
+            uint32_t operator()(const NodeTermString* string) const {
+                return ast.push_expr({ .kind = ExprKind::string_lit, .lhs = ast.push_leaf(string->string), .rhs = k_no_node });
+            }
+            uint32_t operator()(const NodeTermParen* paren) const {
+                return ast.lower_expr(paren->expr);
+            }
+        };
+        return std::visit(TermVisitor { .ast = *this }, std::get<NodeTerm*>(expr->var)->var);
+    }
+
+    uint32_t push_bin(ExprKind kind, const NodeExpr* lhs, const NodeExpr* rhs) {
+        const uint32_t left = lower_expr(lhs);
+        const uint32_t right = lower_expr(rhs);
+        return push_expr({ .kind = kind, .lhs = left, .rhs = right });
+    }
+
+    uint32_t push_expr(FlatExpr expr) {
+        m_exprs.push_back(expr);
+        return static_cast<uint32_t>(m_exprs.size() - 1);
+    }
+
+    uint32_t push_leaf(const Token& token) {
+        m_leaves.push_back({ .text = token.value.data(), .length = token.span.length, .offset = token.span.offset, .literal = token.literal });
+        return static_cast<uint32_t>(m_leaves.size() - 1);
+    }
+
+    uint32_t push_ident(Token token) {
+        const auto [it, inserted] = m_ident_ids.try_emplace(token.value, static_cast<uint32_t>(m_ident_ids.size()));
+        token.literal.ident = it->second;
+        return push_leaf(token);
+    }
+
+    std::vector<FlatExpr> m_exprs;
+    std::vector<FlatLeaf> m_leaves;
+    std::vector<FlatStmt> m_stmts;
+    std::vector<FlatScope> m_scopes;
+    std::vector<FlatPred> m_preds;
+    std::deque<std::string> m_texts; // of the leaves added by the passes, never moved
+    std::unordered_map<std::string_view, uint32_t> m_ident_ids; // name -> interned id
+    FlatScope m_root { 0, 0 };
+};
@@ -1,398 +1,540 @@
 # pragma once
 
-#include "parser.hpp"
+#include "flat_ast.hpp"
+#include "ir.hpp"
+#include "register_allocator.hpp"
+#include "symbols.hpp"
 #include <algorithm>
+#include <array>
 #include <cassert>
+#include <cctype>
 #include <cstddef>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
-#include <sstream>
+#include <span>
 #include <string>
+#include <string_view>
 #include <variant>
 #include <vector>
-#include <iomanip>
+#include <optional>
 
-// File to generate the asmebly code
+// File to generate the asmebly code, as IR that emit_nasm prints
 
 class Generator {
 public:
-  inline Generator(NodeProg prog) 
-    : m_prog(std::move(prog)) {
+  // Walks the flat form of the program, which must outlive the generator.
+  // registers: how many callee-saved registers the int variables may take
+  inline Generator(const FlatAst& ast, Diagnostics& diagnostics, size_t registers = RegisterAllocator::k_registers.size())
+    : m_ast(ast), m_diagnostics(diagnostics), m_registers(ast, registers), m_need(ast.expr_count(), 0), m_symbols(ast.ident_count()) {
 
   }
 
-  void gen_term(const NodeTerm* term) {
-    struct TermVisitor {
-      Generator& gen;
+  void gen_expr(uint32_t index) {
+    const FlatExpr& expr = m_ast.expr(index);
+    switch (expr.kind) {
+    case ExprKind::int_lit:
+      m_ir.emit(Op::mov, { Operand::of(Reg::rax), Operand::imm(m_ast.leaf(expr.lhs, TokenType::int_lit).literal.int_value) });
+      push(Operand::of(Reg::rax));
+      break;
 
-      void operator()(const NodeTermNumber* term_number) const {
-        if (term_number->number.type == TokenType::int_lit) {
-            gen.m_output << "    mov rax, " << term_number->number.value.value() << "\n";
-            gen.push("rax");
-        } else if (term_number->number.type == TokenType::float_lit) {
-            float my_float = std::stof(term_number->number.value.value());
-            uint32_t hex_rep;
-            std::memcpy(&hex_rep, &my_float, sizeof(float));
+    case ExprKind::float_lit: {
+      uint32_t hex_rep;
+      const float value = m_ast.leaf(expr.lhs, TokenType::float_lit).literal.float_value;
+      std::memcpy(&hex_rep, &value, sizeof(float));
 
-            gen.m_output << "    mov eax, " << "0x" << std::hex << std::uppercase << std::setw(8) << std::setfill('0') << hex_rep << "\n"; // Load the bits into an integer register
-            gen.m_output << "    movd xmm0, eax\n"; //Move the raw bits into xmm0
+      m_ir.emit(Op::mov, { Operand::dword(Reg::rax), Operand::bits(hex_rep) }); // Load the bits into an integer register
+      m_ir.emit(Op::movd, { Operand::of(Reg::xmm0), Operand::dword(Reg::rax) }); //Move the raw bits into xmm0
 
-            gen.push("rax");
-        }
-      }
+      push(Operand::of(Reg::rax));
+      break;
+    }
 
-      void operator()(const NodeTermIdent* term_ident) const {
-        auto it = std::find_if(gen.m_vars.cbegin(), gen.m_vars.cend(), [&](const Var& var) {
-        return var.name == term_ident->ident.value.value();
-      });
-        if (it == gen.m_vars.cend()) {
-          std::cerr << "Undeclared identifier: " << term_ident->ident.value.value() << "\n";
-          exit(EXIT_FAILURE);
-        }
-        // Strings occupy two slots: len at stack_loc, ptr at stack_loc+1
-        if (it->type == VarType::String) {
-          std::stringstream off_len;
-          off_len << "QWORD [rsp + " << (gen.m_stack_size - it->stack_loc - 1) * 8 << "]";
-          gen.push(off_len.str());
-          std::stringstream off_ptr;
-          off_ptr << "QWORD [rsp + " << (gen.m_stack_size - (it->stack_loc + 1) - 1) * 8 << "]";
-          gen.push(off_ptr.str());
-        } else {
-          std::stringstream offset;
-          offset << "QWORD [rsp + " << (gen.m_stack_size - it->stack_loc - 1) * 8 << "]";
-          gen.push(offset.str());
-        }
+    case ExprKind::ident: {
+      const Var* it = find_var(m_ast.ident(expr.lhs));
+      if (it == nullptr) {
+        error(m_ast.leaf(expr.lhs, TokenType::ident), "Undeclared identifier: ");
+        m_ir.emit(Op::mov, { Operand::of(Reg::rax), Operand::imm(0) }); // keeps the stack layout, the output is discarded anyway
+        push(Operand::of(Reg::rax));
+        break;
       }
-
-      void operator()(const NodeTermParen* term_paren) {
-        gen.gen_expr(term_paren->expr);
+      // Strings occupy two slots: len at slot, ptr at slot+1
+      if (it->reg != Reg::none) {
+        push(Operand::of(it->reg));
+      } else if (it->type == VarType::String) {
+        push(Operand::frame(it->slot));
+        push(Operand::frame(it->slot + 1));
+      } else {
+        push(stack_slot(*it));
       }
+      break;
+    }
 
-      void operator()(const NodeTermString* term_string) {
-        const std::string label = gen.create_str_label();
-        // Emit data for this string literal
-        gen.m_data_output << "    " << label << "_len dq " << term_string->string.value.value().length() << "\n";
-        gen.m_data_output << "    " << label << " db \"" << term_string->string.value.value() << "\"\n";
-        // Push length then pointer so print can pop rsi, rdx
-        gen.m_output << "    mov rax, " << term_string->string.value.value().length() << "\n";
-        gen.push("rax");
-        gen.m_output << "    lea rax, [rel " << label << "]\n";
-        gen.push("rax");
-      }
-    };
+    case ExprKind::string_lit: {
+      const std::string_view value = m_ast.leaf(expr.lhs, TokenType::string_lit).value;
+      // Emit data for this string literal
+      const uint32_t label = m_ir.add_string(value);
+      // Push length then pointer so print can pop rsi, rdx
+      m_ir.emit(Op::mov, { Operand::of(Reg::rax), Operand::imm(static_cast<int64_t>(value.length())) });
+      push(Operand::of(Reg::rax));
+      m_ir.emit(Op::lea, { Operand::of(Reg::rax), Operand::str(label) });
+      push(Operand::of(Reg::rax));
+      break;
+    }
 
-    TermVisitor visitor({.gen = *this});
-    std::visit(visitor, term->var);
+    case ExprKind::add:
+    case ExprKind::sub:
+    case ExprKind::mul:
+    case ExprKind::div:
+      gen_expr(expr.rhs);
+      gen_expr(expr.lhs); // pushed on the top of the stack
+      pop(Reg::rax);
+      pop(Reg::rcx); // a scratch register, rbx may hold a variable
+      switch (expr.kind) {
+      case ExprKind::add: m_ir.emit(Op::add, { Operand::of(Reg::rax), Operand::of(Reg::rcx) }); break;
+      case ExprKind::sub: m_ir.emit(Op::sub, { Operand::of(Reg::rax), Operand::of(Reg::rcx) }); break;
+      case ExprKind::mul: m_ir.emit(Op::mul, { Operand::of(Reg::rcx) }); break;
+      default:
+        m_ir.emit(Op::xor_, { Operand::dword(Reg::rdx), Operand::dword(Reg::rdx) });
+        m_ir.emit(Op::div, { Operand::of(Reg::rcx) });
+        break;
+      }
+      push(Operand::of(Reg::rax));
+      break;
+    }
   }
 
-  void gen_bin_expr(const NodeBinExpr* bin_expr) {
-    struct BinExprVisitor {
-      Generator& gen;
-      void operator()(const NodeBinExprAdd* add) const {
-        gen.gen_expr(add->rhs);
-        gen.gen_expr(add->lhs); // pushed on the top of the stack
-        gen.pop("rax");
-        gen.pop("rbx");
-        gen.m_output << "    add rax, rbx\n";
-        gen.push("rax");
-      }
+  // Number expressions are evaluated in registers, in the order given by
+  // their Sethi-Ullman numbers: the operand that needs more registers goes
+  // first, so an expression needing n registers never spills below n. Deeper
+  // ones than the scratch registers allow go through the stack. Strings
+  // (and anything mixing them in) keep the stack form of gen_expr.
+  void gen_expr_into(uint32_t index, Reg target) {
+    if (is_leaf(index)) {
+      load(index, target);
+      return;
+    }
+    gen_expr_reg(index, k_scratch);
+    m_ir.emit(Op::mov, { Operand::of(target), Operand::of(k_scratch[0]) });
+  }
 
-      void operator()(const NodeBinExprMulti* mult) const {
-        gen.gen_expr(mult->rhs);
-        gen.gen_expr(mult->lhs); // pushed on the top of the stack
-        gen.pop("rax");
-        gen.pop("rbx");
-        gen.m_output << "    mul rbx\n";
-        gen.push("rax");
-      }
+  // Result in regs[0], every register of regs may be used
+  void gen_expr_reg(uint32_t index, std::span<const Reg> regs) {
+    const FlatExpr& expr = m_ast.expr(index);
+    if (is_leaf(index)) {
+      load(index, regs[0]);
+      return;
+    }
 
-      void operator()(const NodeBinExprMinus* minus) const {
-        gen.gen_expr(minus->rhs);
-        gen.gen_expr(minus->lhs); // pushed on the top of the stack
-        gen.pop("rax");
-        gen.pop("rbx");
-        gen.m_output << "    sub rax, rbx\n";
-        gen.push("rax");
-      }
+    if (operand(expr.rhs, expr.kind).has_value()) {
+      gen_expr_reg(expr.lhs, regs);
+      apply(expr.kind, regs[0], operand(expr.rhs, expr.kind).value());
+      return;
+    }
 
-      void operator()(const NodeBinExprDiv* div) const {
-        gen.gen_expr(div->rhs);
-        gen.gen_expr(div->lhs); // pushed on the top of the stack
-        gen.pop("rax");
-        gen.pop("rbx");
-        gen.m_output << "    div rbx\n";
-        gen.push("rax");
-      }
-    };
+    if (need(index) > regs.size()) {
+      // Not enough registers: the right side waits on the stack
+      gen_expr_reg(expr.rhs, regs);
+      push(Operand::of(regs[0]));
+      gen_expr_reg(expr.lhs, regs);
+      pop(regs[1]);
+      apply(expr.kind, regs[0], Operand::of(regs[1]));
+      return;
+    }
 
-    BinExprVisitor visitor = {.gen = *this};
-    std::visit(visitor, bin_expr->var);
+    if (need(expr.lhs) >= need(expr.rhs)) {
+      gen_expr_reg(expr.lhs, regs);
+      gen_expr_reg(expr.rhs, regs.subspan(1));
+    } else {
+      // The right side first, in regs[1], then the left one without it
+      std::array<Reg, k_scratch.size()> swapped {};
+      std::copy(regs.begin(), regs.end(), swapped.begin());
+      std::swap(swapped[0], swapped[1]);
+      gen_expr_reg(expr.rhs, std::span(swapped).first(regs.size()));
+      std::copy(regs.begin() + 2, regs.end(), swapped.begin() + 1);
+      swapped[0] = regs[0];
+      gen_expr_reg(expr.lhs, std::span(swapped).first(regs.size() - 1));
+    }
+    apply(expr.kind, regs[0], Operand::of(regs[1]));
   }
 
-  void gen_expr(const NodeExpr* expr) {
-    struct ExprVisitor {
-      Generator& gen;
-
-      void operator()(const NodeTerm* term) const { // can only push 64 bit
-        gen.gen_term(term);
-      }
-
-      void operator()(const NodeBinExpr* bin_expr) const {
-        gen.gen_bin_expr(bin_expr);
-      }
-    };
+  void gen_if_pred(uint32_t index, uint32_t end_label) {
+    const FlatPred& pred = m_ast.pred(index);
+    if (pred.expr == k_no_node) {
+      m_ir.note(Note::else_);
+      gen_scope(pred.scope);
+      return;
+    }
 
-    ExprVisitor visitor{.gen = *this};
-    std::visit(visitor, expr->var) ;
+    m_ir.note(Note::elif);
+    const uint32_t label = m_ir.new_label();
+    gen_condition(pred.expr, label);
+    gen_scope(pred.scope);
+    m_ir.emit(Op::jmp, { Operand::label(end_label) });
+    m_ir.place(label); // the last elif falls through to the end too
+    if (pred.next != k_no_node) {
+      gen_if_pred(pred.next, end_label);
+    }
   }
 
-  void gen_if_pred(const NodeIfPred* pred, const std::string& end_label) {
-    struct PredVisitor {
-      Generator& gen;
-      const std::string& end_label;
-
-      void operator()(const NodePredElif* elif) const
-      {
-          gen.m_output << "    ;; elif\n";
-          gen.gen_expr(elif->expr);
-          gen.pop("rax");
-          const std::string label = gen.create_label();
-          gen.m_output << "    test rax, rax\n";
-          gen.m_output << "    jz " << label << "\n";
-          gen.gen_scope(elif->scope);
-          gen.m_output << "    jmp " << end_label << "\n";
-          if (elif->pred.has_value()) {
-              gen.m_output << label << ":\n";
-              gen.gen_if_pred(elif->pred.value(), end_label);
-          }
+  void gen_stmt(uint32_t index) {
+    const FlatStmt& stmt = m_ast.stmt(index);
+    switch (stmt.kind) {
+    case StmtKind::exit:
+      if (is_string(stmt.expr)) {
+        gen_expr(stmt.expr);
+        pop(Reg::rdi);
+      } else {
+        gen_expr_into(stmt.expr, Reg::rdi);
       }
-
-      void operator()(const NodePredElse* else_) const
-      {
-          gen.m_output << "    ;; else\n";
-          gen.gen_scope(else_->scope);
+      m_ir.emit(Op::mov, { Operand::of(Reg::rax), Operand::imm(60) });
+      m_ir.emit(Op::syscall);
+      break;
+
+    case StmtKind::print:
+      // Evaluate expression: for strings we expect [len, ptr] pushed (ptr on top)
+      gen_expr(stmt.expr);
+      pop(Reg::rsi); // ptr
+      pop(Reg::rdx); // len
+      m_ir.emit(Op::mov, { Operand::of(Reg::rax), Operand::imm(1) }); // sys_write
+      m_ir.emit(Op::mov, { Operand::of(Reg::rdi), Operand::imm(1) }); // fd = stdout
+      m_ir.emit(Op::syscall);
+      break;
+
+    case StmtKind::int_decl:
+    case StmtKind::float_decl:
+    case StmtKind::string_decl: {
+      const uint32_t id = m_ast.ident(stmt.ident);
+      if (find_var(id) != nullptr) {
+        error(m_ast.leaf(stmt.ident, TokenType::ident), "Redeclared identifier: ");
       }
-
-    };
-
-    PredVisitor visitor { .gen = *this, .end_label = end_label };
-    std::visit(visitor, pred->var);
-  }
-
-  void gen_stmt(const NodeStatement* stmt) {
-    struct StmtVisitor {
-      Generator& gen;
-      void operator()(const NodeStatementExit* stmt_exit) const {
-        gen.gen_expr(stmt_exit->expr); 
-        gen.m_output << "    mov rax, 60\n";
-        gen.pop("rdi");
-        gen.m_output << "    syscall\n";
+      const VarType type = stmt.kind == StmtKind::int_decl ? VarType::Int
+          : stmt.kind == StmtKind::float_decl              ? VarType::Float
+                                                           : VarType::String;
+      const bool string = is_string(stmt.expr);
+      const Reg reg = string ? Reg::none : m_registers.reg(index);
+      const size_t slot = m_frame_used;
+      if (reg == Reg::none) {
+        take_slots(type == VarType::String || string ? 2 : 1);
       }
-
-      void operator()(const NodeStatementString* stmt_string) {
-        auto it = std::find_if(gen.m_vars.cbegin(), gen.m_vars.cend(), [&](const Var& var) {
-          return var.name == stmt_string->ident.value.value();
-        });
-        if (it != gen.m_vars.cend()) {
-          std::cerr << "Redeclared identifier: " << stmt_string->ident.value.value() << "\n";
-          exit(EXIT_FAILURE);
-        }
-        gen.m_vars.push_back({ .name = stmt_string->ident.value.value(), .stack_loc = gen.m_stack_size, .type = VarType::String });
-        gen.gen_expr(stmt_string->expr);
+      m_vars.push_back({ .slot = slot, .type = type, .reg = reg });
+      m_symbols.declare(id, static_cast<uint32_t>(m_vars.size() - 1));
+      if (reg != Reg::none) {
+        gen_expr_into(stmt.expr, reg);
+      } else if (string) {
+        gen_expr(stmt.expr);
+        pop(Reg::rax); // ptr
+        pop(Reg::rcx); // len
+        m_ir.emit(Op::mov, { Operand::frame(slot), Operand::of(Reg::rcx) });
+        m_ir.emit(Op::mov, { Operand::frame(slot + 1), Operand::of(Reg::rax) });
+      } else {
+        gen_expr_reg(stmt.expr, k_scratch);
+        m_ir.emit(Op::mov, { Operand::frame(slot), Operand::of(k_scratch[0]) });
       }
+      break;
+    }
 
-      void operator()(const NodeStatementPrint* stmt_print) const {
-        // Evaluate expression: for strings we expect [len, ptr] pushed (ptr on top)
-        gen.gen_expr(stmt_print->expr);
-        gen.pop("rsi"); // ptr
-        gen.pop("rdx"); // len
-        gen.m_output << "    mov rax, 1\n"; // sys_write
-        gen.m_output << "    mov rdi, 1\n"; // fd = stdout
-        gen.m_output << "    syscall\n";
+    case StmtKind::scope:
+      gen_scope(stmt.scope);
+      break;
+
+    case StmtKind::if_: {
+      m_ir.note(Note::if_);
+      const uint32_t label = m_ir.new_label();
+      gen_condition(stmt.expr, label);
+      gen_scope(stmt.scope);
+
+      if (stmt.pred != k_no_node) {
+          const uint32_t end_label = m_ir.new_label();
+          m_ir.emit(Op::jmp, { Operand::label(end_label) });
+          m_ir.place(label);
+          gen_if_pred(stmt.pred, end_label);
+          m_ir.place(end_label);
       }
-
-      void operator()(const NodeStatementInt* stmt_int) {
-        auto it = std::find_if(gen.m_vars.cbegin(), gen.m_vars.cend(), [&](const Var& var) {
-        return var.name == stmt_int->ident.value.value();
-      });
-        if (it != gen.m_vars.cend()) {
-          std::cerr << "Redeclared identifier: " << stmt_int->ident.value.value() << "\n";
-          exit(EXIT_FAILURE);
-        }
-        
-        gen.m_vars.push_back({ .name = stmt_int->ident.value.value(), .stack_loc = gen.m_stack_size, .type = VarType::Int });
-        gen.gen_expr(stmt_int->expr);
+      else {
+          m_ir.place(label);
       }
+      m_ir.note(Note::end_if);
+      break;
+    }
 
-      void operator()(const NodeStatementFloat* stmt_float) {
-        auto it = std::find_if(gen.m_vars.cbegin(), gen.m_vars.cend(), [&](const Var& var) {
-          std::cout << var.name << " " << stmt_float->ident.value.value() << "\n";
-        return var.name == stmt_float->ident.value.value();
-      });
-        if (it != gen.m_vars.cend()) {
-          std::cerr << "Redeclared identifier: " << stmt_float->ident.value.value() << "\n";
-          exit(EXIT_FAILURE);
-        }
-        
-        gen.m_vars.push_back({ .name = stmt_float->ident.value.value(), .stack_loc = gen.m_stack_size, .type = VarType::Float });
-        gen.gen_expr(stmt_float->expr);
-      }
+    case StmtKind::while_: {
+      m_ir.note(Note::while_);
+      const uint32_t start_label = m_ir.new_label();
+      const uint32_t end_label = m_ir.new_label();
+      m_ir.place(start_label);
+      gen_condition(stmt.expr, end_label);
+      gen_scope(stmt.scope);
+      m_ir.emit(Op::jmp, { Operand::label(start_label) });
+      m_ir.place(end_label);
+      m_ir.note(Note::end_while);
+      break;
+    }
 
-      void operator()(const NodeScope* scope) const {
-        gen.gen_scope(scope);
+    case StmtKind::assign: {
+      const Var* it = find_var(m_ast.ident(stmt.ident));
+      if (it == nullptr) {
+        error(m_ast.leaf(stmt.ident, TokenType::ident), "Undeclared identifier in assignment: ");
+        break;
       }
-
-      void operator()(const NodeStmtIf* stmt_if) const {
-        gen.m_output << "    ;; if\n";
-        gen.gen_expr(stmt_if->expr);
-        gen.pop("rax");
-        const std::string label = gen.create_label();
-        gen.m_output << "    test rax, rax\n";
-        gen.m_output << "    jz " << label << "\n";
-        gen.gen_scope(stmt_if->scope);
-        
-        if (stmt_if->pred.has_value()) {
-            const std::string end_label = gen.create_label();
-            gen.m_output << "    jmp " << end_label << "\n";
-            gen.m_output << label << ":\n";
-            gen.gen_if_pred(stmt_if->pred.value(), end_label);
-            gen.m_output << end_label << ":\n";
-        }
-        else {
-            gen.m_output << label << ":\n";
-        }
-        gen.m_output << "    ;; /if\n";
+      if (it->reg != Reg::none && !is_string(stmt.expr)) {
+        gen_expr_into(stmt.expr, it->reg);
+        break;
       }
-
-      void operator()(const NodeStmtWhile* stmt_while) const {
-        gen.m_output << "    ;; while\n";
-        const std::string start_label = gen.create_label();
-        const std::string end_label = gen.create_label();
-        gen.m_output << start_label << ":\n";
-        gen.gen_expr(stmt_while->expr);
-        gen.pop("rax");
-        gen.m_output << "    test rax, rax\n";
-        gen.m_output << "    jz " << end_label << "\n";
-        gen.gen_scope(stmt_while->scope);
-        gen.m_output << "    jmp " << start_label << "\n";
-        gen.m_output << end_label << ":\n";
-        gen.m_output << "    ;; /while\n";
+      if (it->type != VarType::String && !is_string(stmt.expr)) {
+        gen_expr_reg(stmt.expr, k_scratch);
+        m_ir.emit(Op::mov, { stack_slot(*it), Operand::of(k_scratch[0]) });
+        break;
       }
-
-      void operator()(const NodeStatementAssign* assign) {
-        auto it = std::find_if(gen.m_vars.cbegin(), gen.m_vars.cend(), [&](const Var& var) {
-          return var.name == assign->ident.value.value();
-        });
-        if (it == gen.m_vars.cend()) {
-          std::cerr << "Undeclared identifier in assignment: " << assign->ident.value.value() << "\n";
-          exit(EXIT_FAILURE);
-        }
-        gen.gen_expr(assign->expr);
-        if (it->type == VarType::String) {
-          // Expr for strings pushes [len, ptr] (ptr on top)
-          gen.pop("rax"); // ptr
-          gen.pop("rbx"); // len
-          std::stringstream off_len;
-          off_len << "QWORD [rsp + " << (gen.m_stack_size - it->stack_loc - 1) * 8 << "]";
-          std::stringstream off_ptr;
-          off_ptr << "QWORD [rsp + " << (gen.m_stack_size - (it->stack_loc + 1) - 1) * 8 << "]";
-          gen.m_output << "    mov " << off_len.str() << ", rbx\n";
-          gen.m_output << "    mov " << off_ptr.str() << ", rax\n";
-        } else {
-          gen.pop("rax");
-          std::stringstream off;
-          off << "QWORD [rsp + " << (gen.m_stack_size - it->stack_loc - 1) * 8 << "]";
-          gen.m_output << "    mov " << off.str() << ", rax\n";
-        }
+      gen_expr(stmt.expr);
+      if (it->reg != Reg::none) {
+        pop(it->reg);
+      } else if (it->type == VarType::String) {
+        // Expr for strings pushes [len, ptr] (ptr on top)
+        pop(Reg::rax); // ptr
+        pop(Reg::rcx); // len
+        m_ir.emit(Op::mov, { Operand::frame(it->slot), Operand::of(Reg::rcx) });
+        m_ir.emit(Op::mov, { Operand::frame(it->slot + 1), Operand::of(Reg::rax) });
+      } else {
+        pop(Reg::rax);
+        m_ir.emit(Op::mov, { stack_slot(*it), Operand::of(Reg::rax) });
       }
-    };
-
-    StmtVisitor visitor{ .gen = *this };
-    std::visit(visitor, stmt->var);
-  } 
+      break;
+    }
+    }
+  }
 
-  void gen_scope(const NodeScope* scope) {
+  void gen_scope(uint32_t index) {
+    const FlatScope& scope = m_ast.scope(index);
     begin_scope();
-    for (const NodeStatement* stmt : scope->stmts) {
-      gen_stmt(stmt);
+    for (uint32_t i = scope.first; i < scope.first + scope.count; ++i) {
+      gen_stmt(i);
     }
     end_scope();
   }
 
-  [[nodiscard]] std::string gen_prog() {
-    // First generate all statements to collect text and data
-    for (const NodeStatement* stmt : m_prog.stmts) {
-      gen_stmt(stmt);
+  // The generator is spent afterwards
+  // The variables that are not in registers live in one frame under rbp,
+  // allocated by the prologue, so their addresses do not depend on the
+  // temporaries pushed meanwhile and no scope moves rsp.
+  [[nodiscard]] IrProgram gen_ir() {
+    m_ir.emit(Op::mov, { Operand::of(Reg::rbp), Operand::of(Reg::rsp) });
+    m_ir.emit(Op::sub, { Operand::of(Reg::rsp), Operand::imm(0) }); // the size is known at the end
+    const FlatScope root = m_ast.root();
+    for (uint32_t i = root.first; i < root.first + root.count; ++i) {
+      gen_stmt(i);
     }
 
-    m_output << "    mov rax, 60\n";
-    m_output << "    mov rdi, 0\n";
-    m_output << "    syscall\n";
-
-    // Now assemble final output with data first, then text
-    std::stringstream final;
-    if (m_data_output.tellp() > 0) {
-      final << "section .data\n" << m_data_output.str();
+    if (m_frame_size == 0) {
+      m_ir.insn(0).op = Op::nop;
+      m_ir.insn(1).op = Op::nop;
+    } else {
+      m_ir.operand(m_ir.insn(1), 1) = Operand::imm(static_cast<int64_t>(m_frame_size * 8));
     }
-    final << "global _start\nsection .text\n_start:\n";
-    final << m_output.str();
-    return final.str();
+
+    m_ir.emit(Op::mov, { Operand::of(Reg::rax), Operand::imm(60) });
+    m_ir.emit(Op::mov, { Operand::of(Reg::rdi), Operand::imm(0) });
+    m_ir.emit(Op::syscall);
+    return std::move(m_ir);
+  }
+
+  // Int variables that live on the stack for want of a register
+  [[nodiscard]] size_t spilled_count() const {
+    return m_registers.spilled_count();
   }
 
 private:
   enum class VarType { Int, Float, String };
 
   struct Var {
-    std::string name;
-    size_t stack_loc;
+    size_t slot; // first frame slot, when not in a register
     VarType type;
+    Reg reg; // Reg::none when the variable is in its frame slot
   };
 
-  void pop(const std::string& reg) {
-    m_output << "    pop " << reg << "\n";
-    m_stack_size--;
+  // What a scope restores when it ends
+  struct Scope {
+    size_t vars;
+    size_t frame_used;
+  };
+
+  // Temporaries of the expressions. rax and rdx are left for div, the
+  // variables are in the callee-saved registers.
+  static constexpr std::array<Reg, 7> k_scratch { Reg::rcx, Reg::rsi, Reg::rdi, Reg::r8, Reg::r9, Reg::r10, Reg::r11 };
+
+  [[nodiscard]] bool is_leaf(uint32_t index) const {
+    const ExprKind kind = m_ast.expr(index).kind;
+    return kind == ExprKind::int_lit || kind == ExprKind::float_lit || kind == ExprKind::ident || kind == ExprKind::string_lit;
   }
-  void push(const std::string& reg) {
-    m_output << "    push " << reg << "\n";
-    m_stack_size++;
+
+  // Innermost declaration in scope, nullptr when there is none
+  [[nodiscard]] const Var* find_var(uint32_t ident) const {
+    const uint32_t index = m_symbols.find(ident);
+    return index == SymbolTable::k_none ? nullptr : &m_vars[index];
   }
 
-  std::string create_label() {
-      std::stringstream ss;
-      ss << "label" << m_label_count++;
-      return ss.str();
+  [[nodiscard]] static Operand stack_slot(const Var& var) {
+    return Operand::frame(var.slot);
   }
 
-  void begin_scope() {
-    m_scopes.push_back(m_vars.size());
+  // Slots of the variables declared in the current scope. The frame is as
+  // large as the deepest scopes need, disjoint scopes share their slots.
+  void take_slots(size_t count) {
+    m_frame_used += count;
+    m_frame_size = std::max(m_frame_size, m_frame_used);
   }
 
-  void end_scope() { //pop var until last begin scope
-    size_t start = m_scopes.back();
-    size_t slot = 0;
-    for (size_t i = start; i < m_vars.size(); ++i) {
-      slot += (m_vars[i].type == VarType::String) ? 2 : 1;
+  // Expressions that have to go through the stack form: string literals and
+  // variables, which are two values, and anything computed from them
+  [[nodiscard]] bool is_string(uint32_t index) const {
+    const FlatExpr& expr = m_ast.expr(index);
+    switch (expr.kind) {
+    case ExprKind::string_lit:
+      return true;
+    case ExprKind::ident: {
+      const Var* var = find_var(m_ast.ident(expr.lhs));
+      return var != nullptr && var->type == VarType::String;
     }
-    m_output << "    add rsp, " << slot * 8 << "\n";
-    m_stack_size -= slot;
-    while (m_vars.size() > start) {
-      m_vars.pop_back();
+    case ExprKind::int_lit:
+    case ExprKind::float_lit:
+      return false;
+    default:
+      return is_string(expr.lhs) || is_string(expr.rhs);
     }
-    m_scopes.pop_back();
   }
-  const NodeProg m_prog;
-  std::stringstream m_output;
-  std::stringstream m_data_output;
-  std::size_t m_stack_size = 0;
-  std::vector<Var> m_vars {};
-  std::vector<size_t> m_scopes {};
-  int m_label_count = 0;
-  int m_str_count = 0;
-
-  std::string create_str_label() {
-      std::stringstream ss;
-      ss << "str" << m_str_count++;
-      return ss.str();
+
+  // Registers needed to evaluate an expression (Sethi-Ullman number). A right
+  // operand that can be used in place (see operand) needs none.
+  size_t need(uint32_t index) {
+    if (m_need[index] != 0) {
+      return m_need[index];
+    }
+    const FlatExpr& expr = m_ast.expr(index);
+    size_t result = 1;
+    if (!is_leaf(index)) {
+      const size_t lhs = need(expr.lhs);
+      const size_t rhs = operand(expr.rhs, expr.kind).has_value() ? 0 : need(expr.rhs);
+      result = lhs == rhs ? lhs + 1 : std::max(lhs, rhs);
+    }
+    m_need[index] = result;
+    return result;
+  }
+
+  // Right operand usable directly by the instruction: a register or stack
+  // variable, or an immediate that fits in 32 bits (not for div)
+  [[nodiscard]] std::optional<Operand> operand(uint32_t index, ExprKind op) const {
+    const FlatExpr& expr = m_ast.expr(index);
+    if (expr.kind == ExprKind::int_lit && op != ExprKind::div) {
+      const int64_t value = m_ast.leaf(expr.lhs, TokenType::int_lit).literal.int_value;
+      if (value >= INT32_MIN && value <= INT32_MAX) {
+        return Operand::imm(value);
+      }
+    } else if (expr.kind == ExprKind::ident) {
+      const Var* var = find_var(m_ast.ident(expr.lhs));
+      if (var != nullptr && var->type != VarType::String) {
+        return var->reg == Reg::none ? stack_slot(*var) : Operand::of(var->reg);
+      }
+    }
+    return {};
+  }
+
+  void load(uint32_t index, Reg reg) {
+    const FlatExpr& expr = m_ast.expr(index);
+    switch (expr.kind) {
+    case ExprKind::int_lit:
+      m_ir.emit(Op::mov, { Operand::of(reg), Operand::imm(m_ast.leaf(expr.lhs, TokenType::int_lit).literal.int_value) });
+      break;
+
+    case ExprKind::float_lit: {
+      uint32_t hex_rep;
+      const float value = m_ast.leaf(expr.lhs, TokenType::float_lit).literal.float_value;
+      std::memcpy(&hex_rep, &value, sizeof(float));
+      m_ir.emit(Op::mov, { Operand::dword(reg), Operand::bits(hex_rep) }); // the raw bits, zero extended
+      break;
+    }
+
+    case ExprKind::ident: {
+      const Var* var = find_var(m_ast.ident(expr.lhs));
+      if (var == nullptr) {
+        error(m_ast.leaf(expr.lhs, TokenType::ident), "Undeclared identifier: ");
+        m_ir.emit(Op::mov, { Operand::of(reg), Operand::imm(0) }); // the output is discarded anyway
+      } else if (var->reg != reg) {
+        m_ir.emit(Op::mov, { Operand::of(reg), var->reg == Reg::none ? stack_slot(*var) : Operand::of(var->reg) });
+      }
+      break;
+    }
+
+    default:
+      break;
+    }
+  }
+
+  // dst = dst op src
+  void apply(ExprKind op, Reg dst, const Operand& src) {
+    switch (op) {
+    case ExprKind::add: m_ir.emit(Op::add, { Operand::of(dst), src }); break;
+    case ExprKind::sub: m_ir.emit(Op::sub, { Operand::of(dst), src }); break;
+    case ExprKind::mul:
+      // The low half of the product is the same signed or not
+      if (src.kind == OperandKind::imm) {
+        m_ir.emit(Op::imul, { Operand::of(dst), Operand::of(dst), src });
+      } else {
+        m_ir.emit(Op::imul, { Operand::of(dst), src });
+      }
+      break;
+    default:
+      m_ir.emit(Op::mov, { Operand::of(Reg::rax), Operand::of(dst) });
+      m_ir.emit(Op::xor_, { Operand::dword(Reg::rdx), Operand::dword(Reg::rdx) });
+      m_ir.emit(Op::div, { src });
+      m_ir.emit(Op::mov, { Operand::of(dst), Operand::of(Reg::rax) });
+      break;
+    }
+  }
+
+  // Jumps to false_label when the expression is zero
+  void gen_condition(uint32_t index, uint32_t false_label) {
+    if (is_string(index)) {
+      gen_expr(index);
+      pop(Reg::rax);
+      m_ir.emit(Op::test, { Operand::of(Reg::rax), Operand::of(Reg::rax) });
+    } else {
+      gen_expr_reg(index, k_scratch);
+      m_ir.emit(Op::test, { Operand::of(k_scratch[0]), Operand::of(k_scratch[0]) });
+    }
+    m_ir.emit(Op::jz, { Operand::label(false_label) });
+  }
+
+  void error(const Token& ident, const std::string& message) {
+    m_diagnostics.error(ident.span, message + std::string(ident.value));
+  }
+
+  // Temporaries only, the variables are in the frame
+  void pop(Reg reg) {
+    m_ir.emit(Op::pop, { Operand::of(reg) });
+  }
+  void push(const Operand& value) {
+    m_ir.emit(Op::push, { value });
+  }
+
+  void begin_scope() {
+    m_scopes.push_back({ .vars = m_vars.size(), .frame_used = m_frame_used });
+    m_symbols.begin_scope();
+  }
+
+  void end_scope() { // frees the slots of the scope, no code: the frame stays
+    m_vars.resize(m_scopes.back().vars);
+    m_frame_used = m_scopes.back().frame_used;
+    m_symbols.end_scope();
+    m_scopes.pop_back();
   }
+  const FlatAst& m_ast;
+  Diagnostics& m_diagnostics;
+  RegisterAllocator m_registers;
+  std::vector<size_t> m_need; // memo of need(), 0 until computed
+  IrProgram m_ir;
+  std::vector<Var> m_vars {}; // declarations in scope, in order
+  std::vector<Scope> m_scopes {};
+  std::size_t m_frame_used = 0; // slots of the variables in scope
+  std::size_t m_frame_size = 0; // slots allocated by the prologue
+  SymbolTable m_symbols; // identifier -> m_vars
 };
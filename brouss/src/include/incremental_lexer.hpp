@@ -0,0 +1,171 @@
+#pragma once
+
+#include "tokenization.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// (LEXER) Keeps the tokens of a text that is being edited up to date.
+// '\n' is always a token and a string literal cannot span lines, so the lexer
+// state is the same at the start of every line: an edit only needs the lines
+// it touches to be lexed again, the result is spliced into the token buffer.
+
+// Token of one line, the offset is relative to the start of its line
+struct LineToken {
+    TokenType type;
+    uint32_t offset;
+    uint32_t length;
+};
+
+class IncrementalLexer {
+public:
+    // Lines lexed again by an edit, numbered after the edit
+    struct LineRange {
+        size_t first;
+        size_t count;
+    };
+
+    explicit IncrementalLexer(std::string text = {}) {
+        reset(std::move(text));
+    }
+
+    // Lexes the whole text from scratch
+    void reset(std::string text) {
+        m_text = std::move(text);
+        m_tokens.clear();
+        m_line_start.clear();
+        m_line_first_token.clear();
+
+        std::vector<size_t> line_firsts;
+        lex_lines(0, m_text.size(), true, m_line_start, line_firsts, m_tokens);
+        m_line_first_token.assign(line_firsts.begin(), line_firsts.end());
+        m_line_first_token.push_back(m_tokens.size());
+    }
+
+    // Replaces `removed` bytes at pos with inserted and lexes the touched lines again
+    LineRange apply_edit(size_t pos, size_t removed, std::string_view inserted) {
+        pos = std::min(pos, m_text.size());
+        removed = std::min(removed, m_text.size() - pos);
+
+        const size_t first = line_of(pos);
+        const size_t last = line_of(pos + removed); // inclusive, it is merged with the first one
+        const size_t old_tok_begin = m_line_first_token[first];
+        const size_t old_tok_end = m_line_first_token[last + 1];
+        const bool to_last_line = last + 1 == line_count();
+
+        m_text.replace(pos, removed, inserted);
+
+        // End of the (new) line holding the end of the inserted text, newline included
+        const size_t begin = m_line_start[first];
+        const size_t newline = m_text.find('\n', pos + inserted.size());
+        const size_t end = newline == std::string::npos ? m_text.size() : newline + 1;
+
+        std::vector<size_t> starts;
+        std::vector<size_t> firsts;
+        std::vector<LineToken> tokens;
+        lex_lines(begin, end, to_last_line, starts, firsts, tokens);
+        for (size_t& f : firsts) {
+            f += old_tok_begin;
+        }
+
+        const auto byte_delta = static_cast<std::ptrdiff_t>(inserted.size()) - static_cast<std::ptrdiff_t>(removed);
+        const auto tok_delta = static_cast<std::ptrdiff_t>(tokens.size()) - static_cast<std::ptrdiff_t>(old_tok_end - old_tok_begin);
+
+        splice(m_line_start, first, last + 1, starts);
+        splice(m_line_first_token, first, last + 1, firsts);
+        for (size_t i = first + starts.size(); i < m_line_start.size(); ++i) {
+            m_line_start[i] += byte_delta;
+        }
+        for (size_t i = first + firsts.size(); i < m_line_first_token.size(); ++i) {
+            m_line_first_token[i] += tok_delta;
+        }
+        splice(m_tokens, old_tok_begin, old_tok_end, tokens);
+
+        return { first, starts.size() };
+    }
+
+    [[nodiscard]] const std::string& text() const {
+        return m_text;
+    }
+
+    [[nodiscard]] size_t line_count() const {
+        return m_line_start.size();
+    }
+
+    [[nodiscard]] size_t line_start(size_t line) const {
+        return m_line_start[line];
+    }
+
+    [[nodiscard]] std::string_view line_text(size_t line) const {
+        const size_t end = line + 1 < m_line_start.size() ? m_line_start[line + 1] : m_text.size();
+        return std::string_view(m_text).substr(m_line_start[line], end - m_line_start[line]);
+    }
+
+    [[nodiscard]] std::span<const LineToken> line_tokens(size_t line) const {
+        return std::span<const LineToken>(m_tokens).subspan(m_line_first_token[line],
+                                                            m_line_first_token[line + 1] - m_line_first_token[line]);
+    }
+
+    [[nodiscard]] std::span<const LineToken> tokens() const {
+        return m_tokens;
+    }
+
+private:
+    [[nodiscard]] size_t line_of(size_t pos) const {
+        return static_cast<size_t>(std::upper_bound(m_line_start.begin(), m_line_start.end(), pos) - m_line_start.begin()) - 1;
+    }
+
+    // Lexes the complete lines in [begin, end), recording where each one starts
+    // and the index (relative to `tokens`) of its first token.
+    // to_last_line: the range holds the last line of the text.
+    void lex_lines(size_t begin, size_t end, bool to_last_line, std::vector<size_t>& starts, std::vector<size_t>& firsts,
+                   std::vector<LineToken>& tokens) const {
+        size_t line_begin = begin;
+        while (true) {
+            const size_t newline = m_text.find('\n', line_begin);
+            const size_t line_end = (newline == std::string::npos || newline >= end) ? end : newline + 1;
+            lex_line(line_begin, line_end, starts, firsts, tokens);
+            if (line_end == end) {
+                // A text ending with '\n' still has an (empty) last line
+                if (to_last_line && line_end > line_begin && m_text[line_end - 1] == '\n') {
+                    lex_line(end, end, starts, firsts, tokens);
+                }
+                break;
+            }
+            line_begin = line_end;
+        }
+    }
+
+    void lex_line(size_t begin, size_t end, std::vector<size_t>& starts, std::vector<size_t>& firsts,
+                  std::vector<LineToken>& tokens) const {
+        starts.push_back(begin);
+        firsts.push_back(tokens.size());
+        Tokenizer tokenizer(std::string_view(m_text).substr(begin, end - begin));
+        const TokenBuffer line = tokenizer.tokenize();
+        for (size_t i = 0; i < line.size(); ++i) {
+            const Span span = line.span(i);
+            tokens.push_back({ .type = line.type(i), .offset = span.offset, .length = span.length });
+        }
+    }
+
+    template <typename T>
+    static void splice(std::vector<T>& vec, size_t from, size_t to, const std::vector<T>& with) {
+        const size_t common = std::min(to - from, with.size());
+        std::copy_n(with.begin(), common, vec.begin() + static_cast<std::ptrdiff_t>(from));
+        if (with.size() > common) {
+            vec.insert(vec.begin() + static_cast<std::ptrdiff_t>(from + common), with.begin() + static_cast<std::ptrdiff_t>(common), with.end());
+        } else {
+            vec.erase(vec.begin() + static_cast<std::ptrdiff_t>(from + common), vec.begin() + static_cast<std::ptrdiff_t>(to));
+        }
+    }
+
+    std::string m_text;
+    std::vector<LineToken> m_tokens;
+    std::vector<size_t> m_line_start;
+    std::vector<size_t> m_line_first_token; // one per line plus the end
+};
@@ -0,0 +1,217 @@
+#pragma once
+
+#include "arena.hpp"
+#include "diagnostics.hpp"
+#include "flat_ast.hpp"
+#include "parallel_parser.hpp"
+#include "parallel_tokenizer.hpp"
+#include "parser.hpp"
+#include "tree_table.hpp"
+#include "tree_view.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// (PARSER) Re-parsing of a program that is being edited.
+// The program is cut between its top-level statements (for_each_statement_cut)
+// and every piece is looked up in the pieces of the previous parses. The key
+// is the text from the first to the last token of the piece: the same text
+// always lexes to the same tokens. Only the pieces not found are parsed, the
+// others give back their nodes, their interned trees and their printed lines.
+// Cached nodes point into the source they were parsed from. A parse that adds
+// pieces is a generation owning its source and its arena, released once none
+// of its pieces is left in the program.
+class IncrementalParser {
+public:
+    struct Result {
+        NodeProg prog;    // valid until the next parse
+        TreeId tree;      // the program in the table
+        std::string text; // same as AstView::print
+        size_t parsed;    // pieces that were not in the cache
+    };
+
+    // Nothing is returned when the program has an error, the caller parses it
+    // the usual way to report the diagnostics; the cache is left as it was.
+    // The trees are interned in `trees`, clear() has to be called whenever
+    // that table is cleared.
+    std::optional<Result> parse(const std::shared_ptr<const std::string>& src, TreeTable& trees) {
+        Diagnostics diagnostics;
+        TokenBuffer tokens = tokenize_parallel(*src, ThreadPool::shared(), &diagnostics);
+        tokens.push(TokenType::semi, src->size()); // the end line of the last statement
+        if (diagnostics.has_errors()) {
+            return {};
+        }
+
+        if (m_generations.size() >= k_max_generations) {
+            clear(); // a few pieces would keep too many old sources alive
+        }
+        m_generations.push_back(std::make_unique<Generation>(src, take_arena()));
+        Generation& generation = *m_generations.back();
+        m_stamp++;
+
+        std::vector<Piece*> pieces;
+        std::vector<Piece*> added;
+        bool failed = false;
+        const auto add_piece = [&](size_t begin, size_t end) {
+            while (begin < end && tokens.type(begin) == TokenType::semi) {
+                begin++; // blank lines
+            }
+            if (begin == end || failed) {
+                return;
+            }
+            const Span first = tokens.span(begin);
+            const Span last = tokens.span(end - 1);
+            const std::string_view text = std::string_view(*src).substr(first.offset, last.offset + last.length - first.offset);
+
+            auto it = m_pieces.find(text);
+            if (it == m_pieces.end()) {
+                Parser parser(tokens, begin, end, diagnostics, generation.arena);
+                NodeProg prog = parser.parse_prog().value();
+                if (diagnostics.has_errors()) {
+                    failed = true;
+                    return;
+                }
+                it = m_pieces.emplace(text, Piece { .generation = &generation, .prog = prog }).first;
+                generation.live++;
+                added.push_back(&it->second);
+            }
+            it->second.stamp = m_stamp;
+            pieces.push_back(&it->second);
+        };
+
+        size_t begin = 0;
+        for_each_statement_cut(tokens, [&](size_t cut) {
+            add_piece(begin, cut);
+            begin = cut;
+            return !failed;
+        });
+        add_piece(begin, tokens.size());
+
+        if (failed) {
+            std::erase_if(m_pieces, [&](const auto& entry) { return entry.second.generation == &generation; });
+            generation.live = 0;
+            release_generations(false);
+            return {};
+        }
+
+        intern_added(added, generation.arena, trees);
+
+        Result result { .prog = {}, .tree = k_no_tree, .text = {}, .parsed = added.size() };
+        m_prog_arena.reset();
+        std::vector<TreeId> children;
+        size_t text_size = 0;
+        for (const Piece* piece : pieces) {
+            for (NodeStatement* stmt : piece->prog.stmts) {
+                result.prog.stmts.push_back(m_prog_arena, stmt);
+            }
+            children.insert(children.end(), piece->trees.begin(), piece->trees.end());
+            text_size += piece->text.size();
+        }
+        result.tree = trees.intern(Token {}, children); // the root, labeled like AstView's
+
+        result.text.reserve(text_size + 16);
+        result.text.append(to_string(trees.token(result.tree).type)).push_back('\n');
+        for (const Piece* piece : pieces) {
+            result.text.append(piece->text);
+        }
+
+        release_generations(true);
+        return result;
+    }
+
+    // Forgets every piece, the next parse starts from scratch
+    void clear() {
+        m_pieces.clear();
+        for (std::unique_ptr<Generation>& generation : m_generations) {
+            generation->live = 0;
+        }
+        release_generations(false);
+    }
+
+private:
+    static constexpr size_t k_max_generations = 32;
+
+    struct Generation {
+        Generation(std::shared_ptr<const std::string> source_, ArenaAllocator arena_)
+            : source(std::move(source_)), arena(std::move(arena_)) {
+        }
+
+        std::shared_ptr<const std::string> source; // the nodes and the keys point into it
+        ArenaAllocator arena;
+        size_t live = 0; // pieces still cached
+    };
+
+    struct Piece {
+        Generation* generation;
+        NodeProg prog;             // usually one statement, a block statement shares the piece before it
+        std::vector<TreeId> trees; // one per statement
+        std::string text;          // the lines of the statements in the printed tree
+        uint64_t stamp = 0;        // last parse that used it
+    };
+
+    // Interns the statements parsed by this parse, lowered together
+    static void intern_added(const std::vector<Piece*>& added, ArenaAllocator& arena, TreeTable& trees) {
+        NodeProg batch;
+        for (const Piece* piece : added) {
+            for (NodeStatement* stmt : piece->prog.stmts) {
+                batch.stmts.push_back(arena, stmt);
+            }
+        }
+        const FlatAst ast = FlatAst::lower(batch);
+        const AstView view(ast);
+
+        size_t piece = 0;
+        view.for_each_child(view.root(), [&](AstView::Node stmt) {
+            while (added[piece]->trees.size() == added[piece]->prog.stmts.size()) {
+                piece++;
+            }
+            const TreeId tree = trees.intern(view, stmt);
+            added[piece]->trees.push_back(tree);
+            trees.print(tree, 1, added[piece]->text);
+        });
+    }
+
+    ArenaAllocator take_arena() {
+        if (m_free_arenas.empty()) {
+            return ArenaAllocator {};
+        }
+        ArenaAllocator arena = std::move(m_free_arenas.back());
+        m_free_arenas.pop_back();
+        return arena;
+    }
+
+    // Drops the pieces that the last parse did not use (evict), then the
+    // generations without pieces, their arenas are kept for the next ones
+    void release_generations(bool evict) {
+        if (evict) {
+            std::erase_if(m_pieces, [&](const auto& entry) {
+                if (entry.second.stamp == m_stamp) {
+                    return false;
+                }
+                entry.second.generation->live--;
+                return true;
+            });
+        }
+        std::erase_if(m_generations, [&](std::unique_ptr<Generation>& generation) {
+            if (generation->live > 0) {
+                return false;
+            }
+            generation->arena.reset();
+            m_free_arenas.push_back(std::move(generation->arena));
+            return true;
+        });
+    }
+
+    std::unordered_map<std::string_view, Piece> m_pieces;
+    std::vector<std::unique_ptr<Generation>> m_generations;
+    std::vector<ArenaAllocator> m_free_arenas;
+    ArenaAllocator m_prog_arena; // statement list of the last result
+    uint64_t m_stamp = 0;
+};
@@ -0,0 +1,842 @@
+#pragma once
+
+#include "asm_writer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// (IR) Typed form of the generated code, between the AST and the NASM text.
+// An instruction is an opcode and a range of the operand pool, so one holds up
+// to three addresses (imul r, r, imm). Labels cut the instructions into basic
+// blocks, and a jump ends its block: the blocks and their successors are the
+// control flow of the if, elif and while statements. Passes rewrite the
+// program in place, emit_nasm prints it as the generator used to.
+
+enum class Reg : uint8_t {
+  rax, rbx, rcx, rdx, rsi, rdi, rbp, rsp,
+  r8, r9, r10, r11, r12, r13, r14, r15,
+  xmm0,
+  none,
+};
+
+enum class Op : uint8_t {
+  mov,
+  movd,
+  lea,
+  push,
+  pop,
+  add,
+  sub,
+  imul,
+  mul,
+  xor_,
+  div,
+  test,
+  jz,
+  jmp,
+  syscall,
+  note, // a comment of the listing, no code
+  nop,  // removed by a pass
+};
+
+// Comments marking the statements in the listing
+enum class Note : uint8_t {
+  if_,
+  end_if,
+  elif,
+  else_,
+  while_,
+  end_while,
+};
+
+enum class OperandKind : uint8_t {
+  reg,
+  dword, // low 32 bits of reg
+  imm,
+  bits,  // 32-bit immediate printed in hex (float bits)
+  stack, // QWORD [rsp + value]
+  frame, // QWORD [rbp - value]
+  str,   // address of the string literal `value`
+  label,
+  note,
+};
+
+struct Operand {
+  OperandKind kind;
+  Reg reg;
+  int64_t value;
+
+  static Operand of(Reg reg) {
+    return { OperandKind::reg, reg, 0 };
+  }
+  static Operand dword(Reg reg) {
+    return { OperandKind::dword, reg, 0 };
+  }
+  static Operand imm(int64_t value) {
+    return { OperandKind::imm, Reg::none, value };
+  }
+  static Operand bits(uint32_t value) {
+    return { OperandKind::bits, Reg::none, value };
+  }
+  static Operand stack(size_t offset) {
+    return { OperandKind::stack, Reg::rsp, static_cast<int64_t>(offset) };
+  }
+  // Slot `slot` of the frame, under rbp
+  static Operand frame(size_t slot) {
+    return { OperandKind::frame, Reg::rbp, static_cast<int64_t>((slot + 1) * 8) };
+  }
+  static Operand str(uint32_t index) {
+    return { OperandKind::str, Reg::none, index };
+  }
+  static Operand label(uint32_t index) {
+    return { OperandKind::label, Reg::none, index };
+  }
+
+  bool operator==(const Operand&) const = default;
+};
+
+struct Insn {
+  Op op;
+  uint8_t count;
+  uint32_t first; // in the operand pool
+};
+
+inline constexpr uint32_t k_no_label = UINT32_MAX;
+
+// Instructions [first, first + count). The entry block has no label.
+struct Block {
+  uint32_t label;
+  uint32_t first;
+  uint32_t count;
+};
+
+class IrProgram {
+public:
+  IrProgram() {
+    m_blocks.push_back({ .label = k_no_label, .first = 0, .count = 0 });
+  }
+
+  [[nodiscard]] uint32_t new_label() {
+    m_label_blocks.push_back(k_no_label);
+    return static_cast<uint32_t>(m_label_blocks.size() - 1);
+  }
+
+  // Data of a string literal, its index names it
+  [[nodiscard]] uint32_t add_string(std::string_view value) {
+    m_strings.emplace_back(value);
+    return static_cast<uint32_t>(m_strings.size() - 1);
+  }
+
+  // Starts the block of the label here
+  void place(uint32_t label) {
+    start_block(label);
+    m_label_blocks[label] = static_cast<uint32_t>(m_blocks.size() - 1);
+  }
+
+  void emit(Op op, std::initializer_list<Operand> operands = {}) {
+    if (m_block_ended) {
+      start_block(k_no_label); // falls through from the jump
+    }
+    m_insns.push_back({ .op = op, .count = static_cast<uint8_t>(operands.size()), .first = static_cast<uint32_t>(m_operands.size()) });
+    m_operands.insert(m_operands.end(), operands);
+    m_blocks.back().count++;
+    m_block_ended = op == Op::jz || op == Op::jmp;
+  }
+
+  // Replaces instruction `index`. Its operands go to the end of the pool when
+  // there are more of them than before, so `operands` must not point into it.
+  void rewrite(uint32_t index, Op op, std::span<const Operand> operands) {
+    Insn& insn = m_insns[index];
+    if (operands.size() > insn.count) {
+      insn.first = static_cast<uint32_t>(m_operands.size());
+      m_operands.resize(m_operands.size() + operands.size());
+    }
+    std::copy(operands.begin(), operands.end(), m_operands.begin() + insn.first);
+    insn.op = op;
+    insn.count = static_cast<uint8_t>(operands.size());
+  }
+
+  void rewrite(uint32_t index, Op op, std::initializer_list<Operand> operands) {
+    rewrite(index, op, std::span<const Operand>(operands.begin(), operands.size()));
+  }
+
+  void note(Note note) {
+    m_insns.push_back({ .op = Op::note, .count = 1, .first = static_cast<uint32_t>(m_operands.size()) });
+    m_operands.push_back({ OperandKind::note, Reg::none, static_cast<int64_t>(note) });
+    m_blocks.back().count++;
+  }
+
+  [[nodiscard]] const std::vector<Block>& blocks() const {
+    return m_blocks;
+  }
+  [[nodiscard]] const std::vector<std::string>& strings() const {
+    return m_strings;
+  }
+  [[nodiscard]] size_t insn_count() const {
+    return m_insns.size();
+  }
+  [[nodiscard]] size_t label_count() const {
+    return m_label_blocks.size();
+  }
+
+  [[nodiscard]] const Insn& insn(uint32_t index) const {
+    return m_insns[index];
+  }
+  [[nodiscard]] Insn& insn(uint32_t index) {
+    return m_insns[index];
+  }
+  [[nodiscard]] const Operand& operand(const Insn& insn, size_t i) const {
+    return m_operands[insn.first + i];
+  }
+  [[nodiscard]] Operand& operand(const Insn& insn, size_t i) {
+    return m_operands[insn.first + i];
+  }
+
+  [[nodiscard]] uint32_t block_of(uint32_t label) const {
+    return m_label_blocks[label];
+  }
+
+  // Last instruction of the block that is code, k_no_label when there is none
+  [[nodiscard]] uint32_t last_code(uint32_t block) const {
+    const Block& b = m_blocks[block];
+    for (uint32_t i = b.first + b.count; i > b.first; --i) {
+      if (m_insns[i - 1].op != Op::note && m_insns[i - 1].op != Op::nop) {
+        return i - 1;
+      }
+    }
+    return k_no_label;
+  }
+
+  // Blocks that can run right after `block`
+  [[nodiscard]] std::vector<uint32_t> successors(uint32_t block) const {
+    std::vector<uint32_t> result;
+    const uint32_t last = last_code(block);
+    const bool jumps = last != k_no_label && (m_insns[last].op == Op::jz || m_insns[last].op == Op::jmp);
+    if (jumps) {
+      result.push_back(block_of(static_cast<uint32_t>(operand(m_insns[last], 0).value)));
+    }
+    if ((!jumps || m_insns[last].op == Op::jz) && block + 1 < m_blocks.size()) {
+      result.push_back(block + 1);
+    }
+    return result;
+  }
+
+private:
+  void start_block(uint32_t label) {
+    const uint32_t first = static_cast<uint32_t>(m_insns.size());
+    m_blocks.push_back({ .label = label, .first = first, .count = 0 });
+    m_block_ended = false;
+  }
+
+  std::vector<Insn> m_insns;
+  std::vector<Operand> m_operands;
+  std::vector<Block> m_blocks;
+  std::vector<uint32_t> m_label_blocks; // label -> block, k_no_label until placed
+  std::vector<std::string> m_strings;
+  bool m_block_ended = false;
+};
+
+// Passes run in the order they were added, in rounds: a rewrite often opens
+// the way to another one, so the rounds go on until one rewrites nothing.
+// A pass can be turned off by name, to see the code without it.
+class PassManager {
+public:
+  // Returns the number of rewrites it did
+  using Pass = size_t (*)(IrProgram&);
+
+  struct Hits {
+    std::string_view pass;
+    size_t count;
+    bool enabled;
+  };
+
+  void add(std::string_view name, Pass pass) {
+    m_passes.push_back({ .name = name, .pass = pass, .hits = 0, .enabled = true });
+  }
+
+  // False when no pass has this name
+  bool set_enabled(std::string_view name, bool enabled) {
+    for (Entry& entry : m_passes) {
+      if (entry.name == name) {
+        entry.enabled = enabled;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Every pass on or off, before selecting some of them with set_enabled
+  void set_all_enabled(bool enabled) {
+    for (Entry& entry : m_passes) {
+      entry.enabled = enabled;
+    }
+  }
+
+  void run(IrProgram& program) {
+    for (Entry& entry : m_passes) {
+      entry.hits = 0;
+    }
+    for (size_t round = 0; round < k_max_rounds; ++round) {
+      size_t rewrites = 0;
+      for (Entry& entry : m_passes) {
+        if (!entry.enabled) {
+          continue;
+        }
+        const size_t count = entry.pass(program);
+        entry.hits += count;
+        rewrites += count;
+      }
+      if (rewrites == 0) {
+        break;
+      }
+    }
+  }
+
+  // Rewrites done by every pass during the last run, in the order they were
+  // added, 0 for the ones turned off
+  [[nodiscard]] std::vector<Hits> hits() const {
+    std::vector<Hits> result;
+    for (const Entry& entry : m_passes) {
+      result.push_back({ .pass = entry.name, .count = entry.hits, .enabled = entry.enabled });
+    }
+    return result;
+  }
+
+  // The passes the compiler runs
+  static PassManager standard();
+
+private:
+  static constexpr size_t k_max_rounds = 8;
+
+  struct Entry {
+    std::string_view name;
+    Pass pass;
+    size_t hits;
+    bool enabled;
+  };
+
+  std::vector<Entry> m_passes;
+};
+
+// add rsp, 0 and sub rsp, 0, which move nothing
+inline size_t drop_zero_stack_adjust(IrProgram& program) {
+  size_t rewrites = 0;
+  for (const Block& block : program.blocks()) {
+    for (uint32_t i = block.first; i < block.first + block.count; ++i) {
+      Insn& insn = program.insn(i);
+      if ((insn.op == Op::add || insn.op == Op::sub) && program.operand(insn, 0) == Operand::of(Reg::rsp)
+          && program.operand(insn, 1) == Operand::imm(0)) {
+        insn.op = Op::nop;
+        rewrites++;
+      }
+    }
+  }
+  return rewrites;
+}
+
+// jmp or jz to the next block with code, e.g. around an empty elif branch
+// Backwards, so that a dropped jump empties its block for the ones before it.
+inline size_t drop_jump_to_next(IrProgram& program) {
+  size_t rewrites = 0;
+  for (uint32_t block = static_cast<uint32_t>(program.blocks().size()); block-- > 0;) {
+    const uint32_t last = program.last_code(block);
+    if (last == k_no_label || (program.insn(last).op != Op::jmp && program.insn(last).op != Op::jz)) {
+      continue;
+    }
+    const uint32_t target = program.block_of(static_cast<uint32_t>(program.operand(program.insn(last), 0).value));
+    uint32_t next = block + 1;
+    while (next < target && program.last_code(next) == k_no_label) {
+      next++;
+    }
+    if (next == target) {
+      program.insn(last).op = Op::nop;
+      rewrites++;
+    }
+  }
+  return rewrites;
+}
+
+// Peephole passes. Each one looks at every window of consecutive instructions
+// of a block (notes and removed instructions skipped) and rewrites it in
+// place. The rewritten forms are all ones the X86Encoder takes. Rules that
+// drop the value of a register ask the liveness first: the paths from the
+// instruction are followed through the successor blocks until the register is
+// written (dead) or read (live). A path that is too long is taken as live.
+
+inline constexpr size_t k_liveness_budget = 256; // instructions looked at by dead_after
+
+// Register effect of an instruction, for the liveness
+enum class RegUse : uint8_t {
+  none,
+  read,
+  write, // written without being read
+};
+
+// A 64-bit general purpose register
+[[nodiscard]] inline bool is_qword(const Operand& operand) {
+  return operand.kind == OperandKind::reg && operand.reg < Reg::xmm0;
+}
+
+[[nodiscard]] inline bool is_memory(const Operand& operand) {
+  return operand.kind == OperandKind::stack || operand.kind == OperandKind::frame || operand.kind == OperandKind::str;
+}
+
+// An immediate that fits the sign-extended 32 bits of the instructions
+[[nodiscard]] inline bool is_imm32(const Operand& operand) {
+  return operand.kind == OperandKind::imm && operand.value >= INT32_MIN && operand.value <= INT32_MAX;
+}
+
+// Whether the operand is the register (any width) or an address based on it
+[[nodiscard]] inline bool mentions(const Operand& operand, Reg reg) {
+  switch (operand.kind) {
+  case OperandKind::reg:
+  case OperandKind::dword:
+  case OperandKind::stack:
+  case OperandKind::frame:
+    return operand.reg == reg;
+  default:
+    return false;
+  }
+}
+
+// Jumps have no effect, the liveness follows them through the blocks
+[[nodiscard]] inline RegUse reg_use(const IrProgram& program, const Insn& insn, Reg reg) {
+  const auto in = [&](size_t i) { return i < insn.count && mentions(program.operand(insn, i), reg); };
+  const auto address = [&](size_t i) { return i < insn.count && is_memory(program.operand(insn, i)) && mentions(program.operand(insn, i), reg); };
+  const auto dest = [&] { return insn.count > 0 && !is_memory(program.operand(insn, 0)) && mentions(program.operand(insn, 0), reg); };
+
+  switch (insn.op) {
+  case Op::imul:
+    if (insn.count == 2) {
+      return in(0) || in(1) ? RegUse::read : RegUse::none;
+    }
+    [[fallthrough]];
+  case Op::mov:
+  case Op::movd:
+  case Op::lea:
+    return in(1) || address(0) ? RegUse::read : dest() ? RegUse::write : RegUse::none;
+  case Op::pop:
+    return reg == Reg::rsp || address(0) ? RegUse::read : dest() ? RegUse::write : RegUse::none;
+  case Op::push:
+    return reg == Reg::rsp || in(0) ? RegUse::read : RegUse::none;
+  case Op::xor_:
+    if (program.operand(insn, 0) == program.operand(insn, 1)) {
+      return dest() ? RegUse::write : RegUse::none; // zeroing
+    }
+    [[fallthrough]];
+  case Op::add:
+  case Op::sub:
+  case Op::test:
+    return in(0) || in(1) ? RegUse::read : RegUse::none;
+  case Op::div:
+  case Op::mul:
+    if (reg == Reg::rax || (insn.op == Op::div && reg == Reg::rdx) || in(0)) {
+      return RegUse::read;
+    }
+    return reg == Reg::rdx ? RegUse::write : RegUse::none;
+  case Op::syscall: {
+    static constexpr std::array<Reg, 7> k_args { Reg::rax, Reg::rdi, Reg::rsi, Reg::rdx, Reg::r10, Reg::r8, Reg::r9 };
+    if (std::find(k_args.begin(), k_args.end(), reg) != k_args.end()) {
+      return RegUse::read;
+    }
+    return reg == Reg::rcx || reg == Reg::r11 ? RegUse::write : RegUse::none;
+  }
+  case Op::jz:
+  case Op::jmp:
+  case Op::note:
+  case Op::nop:
+    return RegUse::none;
+  }
+  return RegUse::read; // not known, so it may read anything
+}
+
+// No path from instruction `at` of `block` reads reg before writing it
+[[nodiscard]] inline bool dead_after(const IrProgram& program, uint32_t block, uint32_t at, Reg reg) {
+  struct Path {
+    uint32_t block;
+    uint32_t from;
+  };
+  std::vector<Path> pending { { block, at + 1 } };
+  std::vector<bool> seen(program.blocks().size(), false); // blocks already followed from their start
+  size_t budget = k_liveness_budget;
+  while (!pending.empty()) {
+    const Path path = pending.back();
+    pending.pop_back();
+    const Block& current = program.blocks()[path.block];
+    bool written = false;
+    for (uint32_t i = path.from; i < current.first + current.count && !written; ++i) {
+      const Insn& insn = program.insn(i);
+      if (insn.op == Op::note || insn.op == Op::nop) {
+        continue;
+      }
+      if (budget-- == 0) {
+        return false;
+      }
+      const RegUse effect = reg_use(program, insn, reg);
+      if (effect == RegUse::read) {
+        return false;
+      }
+      written = effect == RegUse::write;
+    }
+    if (written) {
+      continue;
+    }
+    for (const uint32_t next : program.successors(path.block)) {
+      if (!seen[next]) {
+        seen[next] = true;
+        pending.push_back({ next, program.blocks()[next].first });
+      }
+    }
+  }
+  return true;
+}
+
+// Calls rule(block, window) on the first N instructions from every instruction
+// of every block, and counts the windows it rewrote
+template <size_t N, typename Rule>
+size_t rewrite_windows(IrProgram& program, Rule&& rule) {
+  const auto is_code = [&](uint32_t i) { return program.insn(i).op != Op::note && program.insn(i).op != Op::nop; };
+  size_t rewrites = 0;
+  for (uint32_t block = 0; block < program.blocks().size(); ++block) {
+    const Block current = program.blocks()[block];
+    const uint32_t end = current.first + current.count;
+    for (uint32_t at = current.first; at < end; ++at) {
+      if (!is_code(at)) {
+        continue;
+      }
+      std::array<uint32_t, N> window {};
+      size_t count = 0;
+      for (uint32_t i = at; i < end && count < N; ++i) {
+        if (is_code(i)) {
+          window[count++] = i;
+        }
+      }
+      if (count == N && rule(block, window)) {
+        rewrites++;
+      }
+    }
+  }
+  return rewrites;
+}
+
+// add rsp, a / add rsp, b -> add rsp, a + b. The flags of an add rsp are never read.
+inline size_t merge_stack_adjust(IrProgram& program) {
+  const auto is_adjust = [&](const Insn& insn) {
+    return insn.op == Op::add && program.operand(insn, 0) == Operand::of(Reg::rsp) && is_imm32(program.operand(insn, 1));
+  };
+  return rewrite_windows<2>(program, [&](uint32_t, const std::array<uint32_t, 2>& window) {
+    const Insn& first = program.insn(window[0]);
+    const Insn& second = program.insn(window[1]);
+    if (!is_adjust(first) || !is_adjust(second)) {
+      return false;
+    }
+    const int64_t sum = program.operand(first, 1).value + program.operand(second, 1).value;
+    if (sum > INT32_MAX) {
+      return false;
+    }
+    program.operand(first, 1) = Operand::imm(sum);
+    program.insn(window[1]).op = Op::nop;
+    return true;
+  });
+}
+
+// push r / pop r
+inline size_t drop_push_pop(IrProgram& program) {
+  return rewrite_windows<2>(program, [&](uint32_t, const std::array<uint32_t, 2>& window) {
+    const Insn& push = program.insn(window[0]);
+    const Insn& pop = program.insn(window[1]);
+    if (push.op != Op::push || pop.op != Op::pop || program.operand(push, 0) != program.operand(pop, 0)) {
+      return false;
+    }
+    program.insn(window[0]).op = Op::nop;
+    program.insn(window[1]).op = Op::nop;
+    return true;
+  });
+}
+
+// push x / pop r -> mov r, x. x is read with the same rsp.
+inline size_t push_pop_to_move(IrProgram& program) {
+  return rewrite_windows<2>(program, [&](uint32_t, const std::array<uint32_t, 2>& window) {
+    const Insn& push = program.insn(window[0]);
+    const Insn& pop = program.insn(window[1]);
+    if (push.op != Op::push || pop.op != Op::pop || program.operand(push, 0) == program.operand(pop, 0)) {
+      return false;
+    }
+    program.rewrite(window[0], Op::mov, { program.operand(pop, 0), program.operand(push, 0) });
+    program.insn(window[1]).op = Op::nop;
+    return true;
+  });
+}
+
+// push x / op ... / pop r -> op ... / mov r, x, when op does not touch x or
+// the stack. Its rsp operands are 8 bytes closer to the top without the push.
+inline size_t fold_push_op_pop(IrProgram& program) {
+  static constexpr std::array<Op, 7> k_plain { Op::mov, Op::lea, Op::add, Op::sub, Op::imul, Op::xor_, Op::test };
+  return rewrite_windows<3>(program, [&](uint32_t, const std::array<uint32_t, 3>& window) {
+    const Insn& push = program.insn(window[0]);
+    const Insn& middle = program.insn(window[1]);
+    const Insn& pop = program.insn(window[2]);
+    if (push.op != Op::push || pop.op != Op::pop || middle.count == 0
+        || std::find(k_plain.begin(), k_plain.end(), middle.op) == k_plain.end()) {
+      return false;
+    }
+    const Operand value = program.operand(push, 0);
+    const Operand target = program.operand(pop, 0);
+    const Operand dest = program.operand(middle, 0);
+    if (middle.op != Op::test && (is_memory(dest) || (dest.kind != OperandKind::imm && mentions(value, dest.reg)))) {
+      return false;
+    }
+
+    std::array<Operand, 3> args {};
+    for (size_t i = 0; i < middle.count; ++i) {
+      args[i] = program.operand(middle, i);
+      if (!mentions(args[i], Reg::rsp)) {
+        continue;
+      }
+      if (args[i].kind != OperandKind::stack || args[i].value < 8) {
+        return false;
+      }
+      args[i].value -= 8;
+    }
+
+    const Op op = middle.op;
+    program.rewrite(window[0], op, std::span<const Operand>(args.data(), middle.count));
+    if (value == target) {
+      program.insn(window[1]).op = Op::nop;
+    } else {
+      program.rewrite(window[1], Op::mov, { target, value });
+    }
+    program.insn(window[2]).op = Op::nop;
+    return true;
+  });
+}
+
+// mov r, imm / push r -> push imm
+inline size_t push_immediate(IrProgram& program) {
+  return rewrite_windows<2>(program, [&](uint32_t block, const std::array<uint32_t, 2>& window) {
+    const Insn& mov = program.insn(window[0]);
+    const Insn& push = program.insn(window[1]);
+    const Operand reg = program.operand(mov, 0);
+    if (mov.op != Op::mov || push.op != Op::push || program.operand(push, 0) != reg || !is_qword(reg)
+        || !is_imm32(program.operand(mov, 1)) || !dead_after(program, block, window[1], reg.reg)) {
+      return false;
+    }
+    program.rewrite(window[0], Op::push, { program.operand(mov, 1) });
+    program.insn(window[1]).op = Op::nop;
+    return true;
+  });
+}
+
+// mov r, imm / op x, r -> op x, imm
+inline size_t use_immediate_operand(IrProgram& program) {
+  static constexpr std::array<Op, 4> k_ops { Op::mov, Op::add, Op::sub, Op::imul };
+  return rewrite_windows<2>(program, [&](uint32_t block, const std::array<uint32_t, 2>& window) {
+    const Insn& mov = program.insn(window[0]);
+    const Insn& op = program.insn(window[1]);
+    const Operand reg = program.operand(mov, 0);
+    if (mov.op != Op::mov || !is_qword(reg) || !is_imm32(program.operand(mov, 1))
+        || std::find(k_ops.begin(), k_ops.end(), op.op) == k_ops.end() || op.count != 2 || program.operand(op, 1) != reg) {
+      return false;
+    }
+    const Operand dest = program.operand(op, 0);
+    if (mentions(dest, reg.reg) || (op.op == Op::imul && !is_qword(dest)) || !dead_after(program, block, window[1], reg.reg)) {
+      return false;
+    }
+    const Operand value = program.operand(mov, 1);
+    if (op.op == Op::imul) {
+      program.rewrite(window[1], Op::imul, { dest, dest, value });
+    } else {
+      program.operand(op, 1) = value;
+    }
+    program.insn(window[0]).op = Op::nop;
+    return true;
+  });
+}
+
+// mov t, x / op t, y / mov x, t -> op x, y
+inline size_t fold_move_operate_move(IrProgram& program) {
+  static constexpr std::array<Op, 3> k_ops { Op::add, Op::sub, Op::imul };
+  return rewrite_windows<3>(program, [&](uint32_t block, const std::array<uint32_t, 3>& window) {
+    const Insn& load = program.insn(window[0]);
+    const Insn& op = program.insn(window[1]);
+    const Insn& store = program.insn(window[2]);
+    if (load.op != Op::mov || store.op != Op::mov || std::find(k_ops.begin(), k_ops.end(), op.op) == k_ops.end()) {
+      return false;
+    }
+    const Operand temp = program.operand(load, 0);
+    const Operand home = program.operand(load, 1);
+    if (!is_qword(temp) || program.operand(store, 1) != temp || program.operand(store, 0) != home || mentions(home, temp.reg)
+        || program.operand(op, 0) != temp) {
+      return false;
+    }
+
+    const Op code = op.op;
+    if (op.count == 3 && code == Op::imul && program.operand(op, 1) == temp && is_imm32(program.operand(op, 2)) && is_qword(home)) {
+      if (!dead_after(program, block, window[2], temp.reg)) {
+        return false;
+      }
+      program.rewrite(window[0], code, { home, home, program.operand(op, 2) });
+    } else {
+      const Operand other = op.count == 2 ? program.operand(op, 1) : temp;
+      if (op.count != 2 || mentions(other, temp.reg) || (code == Op::imul ? !is_qword(home) : is_memory(home) && is_memory(other))
+          || !dead_after(program, block, window[2], temp.reg)) {
+        return false;
+      }
+      program.rewrite(window[0], code, { home, other });
+    }
+    program.insn(window[1]).op = Op::nop;
+    program.insn(window[2]).op = Op::nop;
+    return true;
+  });
+}
+
+// mov r, x / mov x, r -> mov r, x
+inline size_t drop_redundant_move(IrProgram& program) {
+  return rewrite_windows<2>(program, [&](uint32_t, const std::array<uint32_t, 2>& window) {
+    const Insn& first = program.insn(window[0]);
+    const Insn& second = program.insn(window[1]);
+    if (first.op != Op::mov || second.op != Op::mov) {
+      return false;
+    }
+    const Operand reg = program.operand(first, 0);
+    const Operand other = program.operand(first, 1);
+    if (!is_qword(reg) || program.operand(second, 0) != other || program.operand(second, 1) != reg || mentions(other, reg.reg)) {
+      return false;
+    }
+    program.insn(window[1]).op = Op::nop;
+    return true;
+  });
+}
+
+// mov r, x where r is not read before it is written again, or mov r, r
+inline size_t drop_dead_move(IrProgram& program) {
+  return rewrite_windows<1>(program, [&](uint32_t block, const std::array<uint32_t, 1>& window) {
+    const Insn& insn = program.insn(window[0]);
+    if (insn.op != Op::mov && insn.op != Op::lea) {
+      return false;
+    }
+    const Operand dest = program.operand(insn, 0);
+    if ((dest.kind != OperandKind::reg && dest.kind != OperandKind::dword) || dest.reg >= Reg::xmm0 || dest.reg == Reg::rsp) {
+      return false;
+    }
+    if (!(is_qword(dest) && program.operand(insn, 1) == dest) && !dead_after(program, block, window[0], dest.reg)) {
+      return false;
+    }
+    program.insn(window[0]).op = Op::nop;
+    return true;
+  });
+}
+
+inline PassManager PassManager::standard() {
+  PassManager passes;
+  passes.add("drop_zero_stack_adjust", &drop_zero_stack_adjust);
+  passes.add("merge_stack_adjust", &merge_stack_adjust);
+  passes.add("drop_push_pop", &drop_push_pop);
+  passes.add("push_pop_to_move", &push_pop_to_move);
+  passes.add("fold_push_op_pop", &fold_push_op_pop);
+  passes.add("push_immediate", &push_immediate);
+  passes.add("use_immediate_operand", &use_immediate_operand);
+  passes.add("fold_move_operate_move", &fold_move_operate_move);
+  passes.add("drop_redundant_move", &drop_redundant_move);
+  passes.add("drop_dead_move", &drop_dead_move);
+  passes.add("drop_jump_to_next", &drop_jump_to_next);
+  return passes;
+}
+
+[[nodiscard]] inline std::string_view reg_name(Reg reg, bool dword = false) {
+  static constexpr std::array<std::array<std::string_view, 2>, 17> k_names { {
+    { "rax", "eax" }, { "rbx", "ebx" }, { "rcx", "ecx" }, { "rdx", "edx" }, { "rsi", "esi" }, { "rdi", "edi" },
+    { "rbp", "ebp" }, { "rsp", "esp" }, { "r8", "r8d" }, { "r9", "r9d" }, { "r10", "r10d" }, { "r11", "r11d" },
+    { "r12", "r12d" }, { "r13", "r13d" }, { "r14", "r14d" }, { "r15", "r15d" }, { "xmm0", "xmm0" },
+  } };
+  return k_names[static_cast<size_t>(reg)][dword ? 1 : 0];
+}
+
+// Same text as the generator wrote before the IR, byte for byte. The
+// mnemonics come indented from a table, numbers are formatted in place.
+inline void emit_nasm(const IrProgram& program, AsmWriter& out) {
+  static constexpr std::array<std::string_view, 17> k_ops {
+    "    mov", "    movd", "    lea", "    push", "    pop", "    add", "    sub", "    imul", "    mul",
+    "    xor", "    div", "    test", "    jz", "    jmp", "    syscall", "    ;;", "",
+  };
+  static constexpr std::array<std::string_view, 6> k_notes { "if", "/if", "elif", "else", "while", "/while" };
+
+  if (!program.strings().empty()) {
+    out.put("section .data\n");
+    for (size_t i = 0; i < program.strings().size(); ++i) {
+      const std::string& value = program.strings()[i];
+      out.put("    str");
+      out.put_int(static_cast<int64_t>(i));
+      out.put("_len dq ");
+      out.put_int(static_cast<int64_t>(value.size()));
+      out.put("\n    str");
+      out.put_int(static_cast<int64_t>(i));
+      out.put(" db \"");
+      out.put(value);
+      out.put("\"\n");
+    }
+  }
+  out.put("global _start\nsection .text\n_start:\n");
+
+  const auto print = [&](const Operand& operand) {
+    switch (operand.kind) {
+    case OperandKind::reg: out.put(reg_name(operand.reg)); break;
+    case OperandKind::dword: out.put(reg_name(operand.reg, true)); break;
+    case OperandKind::imm: out.put_int(operand.value); break;
+    case OperandKind::bits: out.put_hex32(static_cast<uint32_t>(operand.value)); break;
+    case OperandKind::stack:
+      out.put("QWORD [rsp + ");
+      out.put_int(operand.value);
+      out.put(']');
+      break;
+    case OperandKind::frame:
+      out.put("QWORD [rbp - ");
+      out.put_int(operand.value);
+      out.put(']');
+      break;
+    case OperandKind::str:
+      out.put("[rel str");
+      out.put_int(operand.value);
+      out.put(']');
+      break;
+    case OperandKind::label:
+      out.put("label");
+      out.put_int(operand.value);
+      break;
+    case OperandKind::note: out.put(k_notes[static_cast<size_t>(operand.value)]); break;
+    }
+  };
+
+  for (const Block& block : program.blocks()) {
+    if (block.label != k_no_label) {
+      out.put("label");
+      out.put_int(block.label);
+      out.put(":\n");
+    }
+    for (uint32_t i = block.first; i < block.first + block.count; ++i) {
+      const Insn& insn = program.insn(i);
+      if (insn.op == Op::nop) {
+        continue;
+      }
+      out.put(k_ops[static_cast<size_t>(insn.op)]);
+      for (size_t arg = 0; arg < insn.count; ++arg) {
+        out.put(arg == 0 ? " " : ", ");
+        print(program.operand(insn, arg));
+      }
+      out.put('\n');
+    }
+  }
+}
+
+[[nodiscard]] inline std::string emit_nasm(const IrProgram& program) {
+  AsmWriter out(program.insn_count() * 24 + 64);
+  emit_nasm(program, out);
+  return out.take();
+}
@@ -0,0 +1,386 @@
+#pragma once
+
+#include "ir.hpp"
+#include "x86_encoder.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <csetjmp>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+struct JitResult {
+  int exit_code = 0;
+  std::string output; // what the program wrote to stdout
+  std::optional<std::string> fault; // why it was stopped, when it did not exit
+};
+
+// Runs an IrProgram in-process, on the calling thread.
+// The program is encoded with each syscall turned into a call to a stub of
+// the same buffer, which hands exit and write to host_syscall instead of the
+// kernel: the app is never exited and the output is kept in memory. Layout:
+//   entry    saves the caller's callee-saved registers and rsp, switches to
+//            the program's own stack and falls into the program
+//   program  machine code of the IR
+//   leave    returns to the caller of entry with its registers
+//   syscall  saves every register but rax, calls host_syscall and goes to
+//            leave once the program is over
+//   data     the strings, then the two addresses the stubs load
+// The buffer is written, then made read/execute only. A fault (division by
+// zero, stack overflow) or the timeout jumps back out with siglongjmp and is
+// reported instead of taking the app down.
+class Jit {
+public:
+  // Throws std::runtime_error when the memory cannot be mapped
+  [[nodiscard]] static JitResult run(const IrProgram& program, std::chrono::milliseconds timeout) {
+    JitResult result;
+    Mapping stack(k_stack_size);
+    stack.protect(0, k_page, PROT_NONE); // guard page, an overflow faults instead of writing below
+
+    const Image image = link(X86Encoder(program, Syscalls::host).encode());
+    Mapping code(image.bytes.size());
+    Context context {
+      .host_rsp = 0,
+      .stack_top = reinterpret_cast<uint64_t>(stack.data() + stack.size()),
+      .result = &result,
+      .readable = { { { code.data(), code.data() + code.size() }, { stack.data() + k_page, stack.data() + stack.size() } } },
+      .in_host = 0,
+      .timed_out = 0,
+    };
+    Context* const context_address = &context;
+    const auto host = &host_syscall;
+    std::memcpy(code.data(), image.bytes.data(), image.bytes.size());
+    std::memcpy(code.data() + image.slots, &context_address, 8);
+    std::memcpy(code.data() + image.slots + 8, &host, 8);
+    code.protect(0, code.size(), PROT_READ | PROT_EXEC);
+
+    const int signal = enter(reinterpret_cast<void (*)()>(code.data()), context, timeout);
+    if (signal == SIGALRM || context.timed_out != 0) {
+      result.fault = "Stopped after " + std::to_string(timeout.count()) + " ms";
+    } else if (signal == SIGFPE) {
+      result.fault = "Division by zero";
+    } else if (signal == SIGSEGV || signal == SIGBUS) {
+      result.fault = "Invalid memory access (stack overflow?)";
+    } else if (signal != 0) {
+      result.fault = "Stopped by signal " + std::to_string(signal);
+    }
+    return result;
+  }
+
+private:
+  static constexpr size_t k_page = 4096;
+  static constexpr size_t k_stack_size = 8 << 20; // reserved, only the pages used are backed
+  static constexpr size_t k_max_output = 1 << 20; // later writes are dropped
+  static constexpr int64_t k_sys_write = 1;
+  static constexpr int64_t k_sys_exit = 60;
+
+  struct Range {
+    const uint8_t* begin;
+    const uint8_t* end;
+  };
+
+  // Read by the stubs at fixed offsets, see link
+  struct Context {
+    uint64_t host_rsp; // rsp of the caller of entry, after its registers are saved
+    uint64_t stack_top;
+    JitResult* result;
+    std::array<Range, 2> readable; // where the program's write may read from
+    volatile sig_atomic_t in_host; // in host_syscall, the timeout only raises timed_out
+    volatile sig_atomic_t timed_out;
+  };
+  static_assert(std::is_standard_layout_v<Context>);
+  static_assert(offsetof(Context, host_rsp) == 0 && offsetof(Context, stack_top) == 8);
+
+  // rax and rdx when host_syscall returns
+  struct HostReturn {
+    int64_t value;
+    int64_t leave; // non-zero when the program is over
+  };
+
+  struct Image {
+    std::vector<uint8_t> bytes;
+    size_t slots; // context address, then host_syscall address
+  };
+
+  // Anonymous read/write mapping
+  class Mapping {
+  public:
+    explicit Mapping(size_t size)
+      : m_size((size + k_page - 1) / k_page * k_page) {
+      void* data = ::mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      if (data == MAP_FAILED) {
+        throw std::runtime_error("Could not map " + std::to_string(m_size) + " bytes");
+      }
+      m_data = static_cast<uint8_t*>(data);
+    }
+
+    Mapping(const Mapping&) = delete;
+    Mapping& operator=(const Mapping&) = delete;
+
+    ~Mapping() {
+      ::munmap(m_data, m_size);
+    }
+
+    void protect(size_t offset, size_t size, int protection) {
+      if (::mprotect(m_data + offset, size, protection) != 0) {
+        throw std::runtime_error("Could not protect the JIT memory");
+      }
+    }
+
+    [[nodiscard]] uint8_t* data() const {
+      return m_data;
+    }
+    [[nodiscard]] size_t size() const {
+      return m_size;
+    }
+
+  private:
+    uint8_t* m_data = nullptr;
+    size_t m_size;
+  };
+
+  // Machine code of the stubs around the program, see the class comment
+  [[nodiscard]] static Image link(const MachineCode& code) {
+    Image image;
+    std::vector<uint8_t>& out = image.bytes;
+    std::vector<uint32_t> context_refs; // rip-relative disp32 to the context slot
+    std::vector<uint32_t> host_refs;
+    std::vector<uint32_t> leave_refs;
+    const auto put = [&](std::initializer_list<uint8_t> bytes) { out.insert(out.end(), bytes); };
+    const auto disp32 = [&](std::vector<uint32_t>& refs) {
+      refs.push_back(static_cast<uint32_t>(out.size()));
+      put({ 0, 0, 0, 0 });
+    };
+    const auto patch = [&](uint32_t at, size_t target) {
+      const int64_t rel = static_cast<int64_t>(target) - (static_cast<int64_t>(at) + 4);
+      for (size_t i = 0; i < 4; ++i) {
+        out[at + i] = static_cast<uint8_t>(static_cast<uint64_t>(rel) >> (8 * i));
+      }
+    };
+
+    // entry
+    put({ 0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57 }); // push rbx, rbp, r12-r15
+    put({ 0x48, 0x8B, 0x05 }); // mov rax, [rel context]
+    disp32(context_refs);
+    put({ 0x48, 0x89, 0x20 }); // mov [rax], rsp
+    put({ 0x48, 0x8B, 0x60, 0x08 }); // mov rsp, [rax + 8]
+
+    const size_t program = out.size();
+    out.insert(out.end(), code.text.begin(), code.text.end());
+
+    // leave
+    const size_t leave = out.size();
+    put({ 0x48, 0x8B, 0x05 }); // mov rax, [rel context]
+    disp32(context_refs);
+    put({ 0x48, 0x8B, 0x20 }); // mov rsp, [rax]
+    put({ 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B }); // pop r15-r12, rbp, rbx
+    put({ 0xC3 });
+
+    // syscall: rax number, rdi rsi rdx arguments -> host_syscall(context, number, a1, a2, a3)
+    const size_t syscall = out.size();
+    put({ 0x51, 0x52, 0x56, 0x57, 0x41, 0x50, 0x41, 0x51, 0x41, 0x52, 0x41, 0x53 }); // push rcx rdx rsi rdi r8-r11
+    put({ 0x55, 0x48, 0x89, 0xE5 }); // push rbp; mov rbp, rsp
+    put({ 0x48, 0x83, 0xE4, 0xF0 }); // and rsp, -16
+    put({ 0x49, 0x89, 0xD0 }); // mov r8, rdx
+    put({ 0x48, 0x89, 0xF1 }); // mov rcx, rsi
+    put({ 0x48, 0x89, 0xFA }); // mov rdx, rdi
+    put({ 0x48, 0x89, 0xC6 }); // mov rsi, rax
+    put({ 0x48, 0x8B, 0x3D }); // mov rdi, [rel context]
+    disp32(context_refs);
+    put({ 0xFF, 0x15 }); // call [rel host]
+    disp32(host_refs);
+    put({ 0x48, 0x85, 0xD2 }); // test rdx, rdx
+    put({ 0x0F, 0x85 }); // jnz leave
+    disp32(leave_refs);
+    put({ 0x48, 0x89, 0xEC, 0x5D }); // mov rsp, rbp; pop rbp
+    put({ 0x41, 0x5B, 0x41, 0x5A, 0x41, 0x59, 0x41, 0x58, 0x5F, 0x5E, 0x5A, 0x59 }); // pop r11-r8 rdi rsi rdx rcx
+    put({ 0xC3 });
+
+    out.resize((out.size() + 7) / 8 * 8);
+    const size_t data = out.size();
+    out.insert(out.end(), code.data.begin(), code.data.end());
+    out.resize((out.size() + 7) / 8 * 8);
+    image.slots = out.size();
+    out.resize(out.size() + 16);
+
+    for (const uint32_t at : context_refs) {
+      patch(at, image.slots);
+    }
+    for (const uint32_t at : host_refs) {
+      patch(at, image.slots + 8);
+    }
+    for (const uint32_t at : leave_refs) {
+      patch(at, leave);
+    }
+    for (const uint32_t at : code.host_calls) {
+      patch(static_cast<uint32_t>(program + at), syscall);
+    }
+    for (const DataRef& ref : code.data_refs) {
+      patch(static_cast<uint32_t>(program + ref.at), data + ref.offset);
+    }
+    return image;
+  }
+
+  // Called by the syscall stub, on the program's stack
+  static HostReturn host_syscall(Context* context, int64_t number, int64_t a1, int64_t a2, int64_t a3) {
+    context->in_host = 1;
+    HostReturn ret { .value = -38, .leave = 0 }; // -ENOSYS
+    if (number == k_sys_exit) {
+      context->result->exit_code = static_cast<int>(a1 & 0xFF); // like the status seen by the parent
+      ret = { .value = 0, .leave = 1 };
+    } else if (number == k_sys_write) {
+      const auto* begin = reinterpret_cast<const uint8_t*>(a2);
+      const bool readable = a3 >= 0 && std::any_of(context->readable.begin(), context->readable.end(), [&](const Range& range) {
+        return begin >= range.begin && begin <= range.end && a3 <= range.end - begin;
+      });
+      if (a1 != 1) {
+        ret.value = -9; // -EBADF, only stdout is open
+      } else if (!readable) {
+        ret.value = -14; // -EFAULT
+      } else {
+        std::string& output = context->result->output;
+        output.append(reinterpret_cast<const char*>(begin), std::min(static_cast<size_t>(a3), k_max_output - std::min(output.size(), k_max_output)));
+        ret.value = a3;
+      }
+    }
+    context->in_host = 0;
+    if (context->timed_out != 0) {
+      ret.leave = 1;
+    }
+    return ret;
+  }
+
+  static constexpr std::array<int, 5> k_signals { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGALRM };
+
+  // Where a fault or the timeout of the running program jumps to, null outside of enter
+  static inline thread_local sigjmp_buf* t_escape = nullptr;
+  static inline thread_local Context* t_context = nullptr;
+
+  // The handlers are process-wide: installed by the first thread in enter,
+  // restored by the last one, the ones they replaced get the signals that are
+  // not ours
+  static inline std::mutex s_handlers_mutex;
+  static inline size_t s_handlers_users = 0;
+  static inline std::array<struct sigaction, k_signals.size()> s_previous {};
+
+  // sival_ptr of the SIGALRM sent by the timeout of enter
+  static inline int s_timer_tag = 0;
+
+  static void on_signal(int signal, siginfo_t* info, void* ucontext) {
+    const bool timeout = signal == SIGALRM && info != nullptr && info->si_code == SI_TIMER && info->si_value.sival_ptr == &s_timer_tag;
+    if (timeout && t_context != nullptr && t_context->in_host != 0) {
+      t_context->timed_out = 1; // host_syscall ends the program once it is done
+      return;
+    }
+    if (t_escape != nullptr) {
+      siglongjmp(*t_escape, signal);
+    }
+    if (timeout) {
+      return; // fired as the program ended
+    }
+    chain(signal, info, ucontext);
+  }
+
+  // Hands a signal that is not ours to the handler it had before enter
+  static void chain(int signal, siginfo_t* info, void* ucontext) {
+    const auto index = static_cast<size_t>(std::find(k_signals.begin(), k_signals.end(), signal) - k_signals.begin());
+    const struct sigaction& previous = s_previous[index];
+    if ((previous.sa_flags & SA_SIGINFO) != 0) {
+      previous.sa_sigaction(signal, info, ucontext);
+    } else if (previous.sa_handler == SIG_DFL) {
+      // Raised again once this handler returns, with the default action
+      std::signal(signal, SIG_DFL);
+      ::raise(signal);
+    } else if (previous.sa_handler != SIG_IGN) {
+      previous.sa_handler(signal);
+    }
+  }
+
+  static void install_handlers() {
+    const std::lock_guard lock(s_handlers_mutex);
+    if (s_handlers_users++ > 0) {
+      return;
+    }
+    struct sigaction action {};
+    action.sa_sigaction = &on_signal;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    for (size_t i = 0; i < k_signals.size(); ++i) {
+      ::sigaction(k_signals[i], &action, &s_previous[i]);
+    }
+  }
+
+  static void restore_handlers() {
+    const std::lock_guard lock(s_handlers_mutex);
+    if (--s_handlers_users > 0) {
+      return;
+    }
+    for (size_t i = 0; i < k_signals.size(); ++i) {
+      ::sigaction(k_signals[i], &s_previous[i], nullptr);
+    }
+  }
+
+  // Runs the code until it exits, faults or times out, 0 or the signal
+  static int enter(void (*entry)(), Context& context, std::chrono::milliseconds timeout) {
+    // A stack overflow of the program leaves no stack for the handler
+    std::vector<uint8_t> signal_stack(SIGSTKSZ > 65536 ? SIGSTKSZ : 65536);
+    stack_t alternate {};
+    alternate.ss_sp = signal_stack.data();
+    alternate.ss_size = signal_stack.size();
+    stack_t previous_stack {};
+    ::sigaltstack(&alternate, &previous_stack);
+    install_handlers();
+
+    // One shot timer sending SIGALRM to this thread only
+    sigevent event {};
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGALRM;
+    event.sigev_value.sival_ptr = &s_timer_tag;
+#ifdef sigev_notify_thread_id
+    event.sigev_notify_thread_id = ::gettid();
+#else
+    event._sigev_un._tid = ::gettid(); // what older glibc has instead
+#endif
+    timer_t timer {};
+    const bool timed = ::timer_create(CLOCK_MONOTONIC, &event, &timer) == 0;
+    if (timed) {
+      const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+      itimerspec spec {};
+      spec.it_value.tv_sec = seconds.count();
+      spec.it_value.tv_nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout - seconds).count();
+      ::timer_settime(timer, 0, &spec, nullptr);
+    }
+
+    sigjmp_buf escape;
+    t_escape = &escape;
+    t_context = &context;
+    const int signal = sigsetjmp(escape, 1);
+    if (signal == 0) {
+      entry();
+    }
+    t_escape = nullptr;
+    t_context = nullptr;
+
+    if (timed) {
+      ::timer_delete(timer);
+    }
+    restore_handlers();
+    ::sigaltstack(&previous_stack, nullptr);
+    return signal;
+  }
+};
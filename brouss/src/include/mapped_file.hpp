@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only memory mapping of a source file, so the Tokenizer can lex it in place
+class MappedFile {
+public:
+    [[nodiscard]] static std::optional<MappedFile> open(const std::string& path)
+    {
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return {};
+        }
+
+        struct stat st {};
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            return {};
+        }
+
+        MappedFile file;
+        file.m_size = static_cast<size_t>(st.st_size);
+        if (file.m_size > 0) { // mmap refuses empty mappings
+            void* data = mmap(nullptr, file.m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                ::close(fd);
+                return {};
+            }
+            madvise(data, file.m_size, MADV_SEQUENTIAL); // the lexer reads it front to back once
+            file.m_data = static_cast<const char*>(data);
+        }
+        ::close(fd); // the mapping stays valid
+        return file;
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept
+        : m_data { std::exchange(other.m_data, nullptr) }
+        , m_size { std::exchange(other.m_size, 0) }
+    {
+    }
+
+    MappedFile& operator=(MappedFile&& other) noexcept
+    {
+        std::swap(m_data, other.m_data);
+        std::swap(m_size, other.m_size);
+        return *this;
+    }
+
+    ~MappedFile()
+    {
+        if (m_data != nullptr) {
+            munmap(const_cast<char*>(m_data), m_size);
+        }
+    }
+
+    [[nodiscard]] std::string_view view() const
+    {
+        return { m_data, m_size };
+    }
+
+private:
+    MappedFile() = default;
+
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+};
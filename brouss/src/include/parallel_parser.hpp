@@ -0,0 +1,153 @@
+#pragma once
+
+#include "arena.hpp"
+#include "diagnostics.hpp"
+#include "parser.hpp"
+#include "thread_pool.hpp"
+#include "tokenization.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <future>
+#include <vector>
+
+// Calls cut(index) for every token index where a top-level statement can
+// start: right after a semi outside of any brace or paren, on a statement
+// keyword. A semi followed by elif, else or the '{' of an if / while body is
+// not a cut. Stops early when cut returns false.
+template <typename Cut>
+void for_each_statement_cut(const TokenBuffer& tokens, Cut&& cut) {
+    int depth = 0;
+    for (size_t i = 0; i + 1 < tokens.size(); ++i) {
+        switch (tokens.type(i)) {
+        case TokenType::open_curly:
+        case TokenType::open_paren:
+            depth++;
+            break;
+        case TokenType::close_curly:
+        case TokenType::close_paren:
+            depth--;
+            break;
+        case TokenType::semi:
+            if (depth != 0) {
+                break;
+            }
+            switch (tokens.type(i + 1)) {
+            case TokenType::exit:
+            case TokenType::print:
+            case TokenType::int_type:
+            case TokenType::float_type:
+            case TokenType::string_type:
+            case TokenType::if_:
+            case TokenType::while_:
+            case TokenType::ident:
+                if (!cut(i + 1)) {
+                    return;
+                }
+                break;
+            default:
+                break;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+// (PARSER) Multi-threaded parsing of the top-level statements.
+// The tokens are cut between top-level statements into one range per worker.
+// Each range is parsed by its own Parser into its own arena and the
+// statements are concatenated in source order, which gives the NodeProg of
+// the serial parse.
+// Error recovery depends on what came before, so when a range reports an
+// error the whole program is parsed again serially and the diagnostics are
+// exactly the serial ones.
+class ParallelParser {
+public:
+    explicit ParallelParser(ThreadPool& pool = ThreadPool::shared())
+        : m_pool(pool) {
+    }
+
+    // The statements are allocated in `arena` and in the arenas of the
+    // workers, which are reset by the next parse: the result is valid until
+    // then (and as long as `arena` is not reset)
+    NodeProg parse(TokenBuffer tokens, Diagnostics& diagnostics, ArenaAllocator& arena, size_t min_chunk_tokens = 256 * 1024) {
+        tokens.push(TokenType::semi, tokens.source().size()); // the end line of the last statement
+
+        const size_t chunk_count = std::min(m_pool.size(), tokens.size() / std::max<size_t>(min_chunk_tokens, 1));
+        const std::vector<size_t> bounds = chunk_count > 1 && !diagnostics.has_errors()
+            ? split(tokens, chunk_count)
+            : std::vector<size_t> { 0, tokens.size() };
+        if (bounds.size() <= 2) {
+            return parse_serial(tokens, diagnostics, arena);
+        }
+
+        while (m_arenas.size() < bounds.size() - 1) {
+            m_arenas.emplace_back();
+        }
+
+        struct Chunk {
+            NodeProg prog;
+            Diagnostics diagnostics;
+        };
+
+        std::vector<std::future<Chunk>> futures;
+        futures.reserve(bounds.size() - 1);
+        for (size_t i = 0; i + 1 < bounds.size(); ++i) {
+            ArenaAllocator* chunk_arena = &m_arenas[i];
+            chunk_arena->reset();
+            futures.push_back(m_pool.submit([&tokens, begin = bounds[i], end = bounds[i + 1], chunk_arena] {
+                Chunk chunk;
+                Parser parser(tokens, begin, end, chunk.diagnostics, *chunk_arena);
+                chunk.prog = parser.parse_prog().value();
+                return chunk;
+            }));
+        }
+
+        // Every worker is waited for before anything is rethrown, they read `tokens`
+        for (std::future<Chunk>& future : futures) {
+            future.wait();
+        }
+
+        std::vector<Chunk> chunks;
+        chunks.reserve(futures.size());
+        for (std::future<Chunk>& future : futures) {
+            chunks.push_back(future.get());
+            if (chunks.back().diagnostics.has_errors()) {
+                return parse_serial(tokens, diagnostics, arena);
+            }
+        }
+
+        NodeProg prog;
+        for (const Chunk& chunk : chunks) {
+            for (NodeStatement* stmt : chunk.prog.stmts) {
+                prog.stmts.push_back(arena, stmt);
+            }
+        }
+        return prog;
+    }
+
+private:
+    static NodeProg parse_serial(const TokenBuffer& tokens, Diagnostics& diagnostics, ArenaAllocator& arena) {
+        Parser parser(tokens, 0, tokens.size(), diagnostics, arena);
+        return parser.parse_prog().value();
+    }
+
+    // Token indices where the ranges start, plus the end. The i-th cut is the
+    // first statement boundary at or past i / chunk_count of the tokens.
+    static std::vector<size_t> split(const TokenBuffer& tokens, size_t chunk_count) {
+        std::vector<size_t> bounds { 0 };
+        for_each_statement_cut(tokens, [&](size_t cut) {
+            if (cut >= tokens.size() / chunk_count * bounds.size()) {
+                bounds.push_back(cut);
+            }
+            return bounds.size() < chunk_count;
+        });
+        bounds.push_back(tokens.size());
+        return bounds;
+    }
+
+    ThreadPool& m_pool;
+    std::vector<ArenaAllocator> m_arenas; // one per range, kept across parses
+};
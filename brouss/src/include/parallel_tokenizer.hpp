@@ -0,0 +1,72 @@
+#pragma once
+
+#include "thread_pool.hpp"
+#include "tokenization.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <future>
+#include <string_view>
+#include <vector>
+
+// (LEXER) Multi-threaded tokenization.
+// Every '\n' is a semi and a string literal cannot span lines, so the lexer is
+// back in its start state right after any newline. The source is cut after a
+// newline into one chunk per worker, the chunks are lexed independently and
+// concatenated, which gives exactly the tokens of Tokenizer::tokenize.
+inline TokenBuffer tokenize_parallel(std::string_view src, ThreadPool& pool, Diagnostics* diagnostics = nullptr,
+                                     size_t min_chunk_size = 1024 * 1024)
+{
+    const size_t chunk_count = std::min(pool.size(), src.size() / std::max<size_t>(min_chunk_size, 1));
+    if (chunk_count <= 1) {
+        Tokenizer tokenizer(src, diagnostics);
+        return tokenizer.tokenize();
+    }
+
+    std::vector<size_t> bounds { 0 };
+    for (size_t i = 1; i < chunk_count; ++i) {
+        const size_t newline = src.find('\n', std::max(src.size() / chunk_count * i, bounds.back()));
+        if (newline == std::string_view::npos) {
+            break;
+        }
+        if (newline + 1 > bounds.back() && newline + 1 < src.size()) {
+            bounds.push_back(newline + 1);
+        }
+    }
+    bounds.push_back(src.size());
+
+    struct Chunk {
+        TokenBuffer tokens;
+        Diagnostics diagnostics;
+    };
+
+    std::vector<std::future<Chunk>> chunks;
+    chunks.reserve(bounds.size() - 1);
+    for (size_t i = 0; i + 1 < bounds.size(); ++i) {
+        const std::string_view slice = src.substr(bounds[i], bounds[i + 1] - bounds[i]);
+        chunks.push_back(pool.submit([slice] {
+            Chunk chunk;
+            Tokenizer tokenizer(slice, &chunk.diagnostics);
+            chunk.tokens = tokenizer.tokenize();
+            return chunk;
+        }));
+    }
+
+    TokenBuffer tokens(src);
+    std::vector<Chunk> done;
+    done.reserve(chunks.size());
+    size_t total = 0;
+    for (std::future<Chunk>& chunk : chunks) {
+        done.push_back(chunk.get());
+        total += done.back().tokens.size();
+    }
+
+    tokens.reserve(total);
+    for (size_t i = 0; i < done.size(); ++i) {
+        tokens.append(done[i].tokens, bounds[i]);
+        if (diagnostics != nullptr) {
+            diagnostics->append(done[i].diagnostics, bounds[i]);
+        }
+    }
+    return tokens;
+}
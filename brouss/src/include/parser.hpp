@@ -1,7 +1,8 @@
 #pragma once
 
 #include "arena.hpp"
-#include "../tree.hpp"
+#include "diagnostics.hpp"
+#include "tokenization.hpp"
 
 #include <cassert>
 #include <cstddef>
@@ -96,7 +97,7 @@ struct NodeStatementAssign {
 struct NodeStatement;
 
 struct NodeScope {
-    std::vector<NodeStatement*> stmts;
+    ArenaVector<NodeStatement*> stmts;
 };
 
 struct NodeIfPred;
@@ -138,7 +139,7 @@ struct NodeStatement {
 };
 
 struct NodeProg {
-    std::vector<NodeStatement*> stmts;
+    ArenaVector<NodeStatement*> stmts;
 };
 
 struct NodeExit {
@@ -180,14 +181,28 @@ struct NodeExit {
     case TokenType::slash: return "slash";
     case TokenType::elif: return "elif";
     case TokenType::else_: return "else";
+    case TokenType::invalid: return "invalid";
     default: return "unknown";
     }
 }
 
 class Parser {
 public:
-    inline explicit Parser(std::vector<Token> tokens)
-        : m_tokens(std::move(tokens)), m_index(0), m_allocator(1024 * 1024 * 4) { // 4Mb
+    // The nodes are allocated in the given arena, they live as long as it is not reset
+    inline explicit Parser(TokenBuffer tokens, Diagnostics& diagnostics, ArenaAllocator& allocator)
+        : m_tokens(std::move(tokens)), m_diagnostics(diagnostics), m_allocator(allocator) {
+
+    }
+
+    // Parses tokens [begin, end) of a buffer that outlives the parser
+    inline explicit Parser(const TokenBuffer& tokens, size_t begin, size_t end, Diagnostics& diagnostics, ArenaAllocator& allocator)
+        : m_tokens(tokens, begin, end), m_diagnostics(diagnostics), m_allocator(allocator) {
+
+    }
+
+    // Streaming mode: tokens are pulled from the tokenizer as the parser goes
+    inline explicit Parser(Tokenizer& tokenizer, Diagnostics& diagnostics, ArenaAllocator& allocator)
+        : m_tokens(tokenizer), m_diagnostics(diagnostics), m_allocator(allocator) {
 
     }
 
@@ -207,8 +222,7 @@ public:
         } else if (auto open_paren = try_consume(TokenType::open_paren)) {
             auto expr = parse_expr();
             if (!expr.has_value()) {
-                std::cerr << "Expected expression" << std::endl;
-                exit(EXIT_FAILURE);
+                error("Expected expression");
             }
 
             try_consume(TokenType::close_paren, "Expected ')'");
@@ -237,9 +251,9 @@ public:
         expr_lhs = m_allocator.emplace<NodeExpr>(term_lhs.value());
 
         while (true) {
-            std::optional<Token> curr_token = peek();
+            const Token* curr_token = peek();
             std::optional<int> prio;
-            if (curr_token.has_value()) {
+            if (curr_token != nullptr) {
                 prio = bin_prio(curr_token->type);
                 if (!prio.has_value() || prio < min_prio) {
                     break;
@@ -252,7 +266,7 @@ public:
             int next_min_prio = prio.value() + 1;
             std::optional<NodeExpr*> expr_rhs = parse_expr(next_min_prio);
             if (!expr_rhs.has_value()) {
-                std::cerr << "Unable to parse expression" << std::endl;
+                error("Unable to parse expression");
             }
 
             auto expr_lhs2 = m_allocator.emplace<NodeExpr>(expr_lhs->var);
@@ -286,16 +300,14 @@ public:
             if (auto expr = parse_expr()) {
                 elif->expr = expr.value();
             } else {
-                std::cerr << "Expected expression" << std::endl;
-                exit(EXIT_FAILURE);
+                error("Expected expression");
             }
             try_consume(TokenType::close_paren, "Expected ')'");
 
             if (auto scope = parse_scope()) {
                 elif->scope = scope.value();
             } else {
-                std::cerr << "Expected scope" << std::endl;
-                exit(EXIT_FAILURE);
+                error("Expected scope");
             }
 
             try_consume(TokenType::semi);
@@ -309,8 +321,7 @@ public:
             if (const auto scope = parse_scope()) {
                 else_->scope = scope.value();
             } else {
-                std::cerr << "Expected scope" << std::endl;
-                exit(EXIT_FAILURE);
+                error("Expected scope");
             }
 
             try_consume(TokenType::semi);
@@ -327,8 +338,19 @@ public:
 
         try_consume(TokenType::semi); // because \n is considered as ;
         auto scope = m_allocator.emplace<NodeScope>();
-        while (auto stmt = parse_statement()) {
-            scope->stmts.push_back(stmt.value());
+        while (true) {
+            try {
+                if (auto stmt = parse_statement()) {
+                    scope->stmts.push_back(m_allocator, stmt.value());
+                    continue;
+                }
+                if (peek() == nullptr || peek_is(TokenType::close_curly)) {
+                    break;
+                }
+                error("Invalid statement at token: " + to_string(peek()->type));
+            } catch (const ParseError&) {
+                synchronize(true);
+            }
         }
         Token token = try_consume(TokenType::close_curly, "Expected '}'");
         try_consume(TokenType::semi); // because \n is considered as ;
@@ -337,12 +359,11 @@ public:
 
     std::optional<NodeStatement*> parse_statement() {
         while (try_consume(TokenType::semi)) {} // consume empty lines
-        if (!peek().has_value()) {
+        if (peek() == nullptr) {
             return {};
         }
 
-        if (peek().has_value() && peek().value().type == TokenType::exit && peek(1).has_value()
-            && peek(1).value().type == TokenType::open_paren) {
+        if (peek_is(TokenType::exit) && peek_is(TokenType::open_paren, 1)) {
             // exit(..
             Token toke = consume();
             consume();
@@ -351,8 +372,7 @@ public:
             if (auto node_expr = parse_expr()) {
                 stmt_exit->expr = node_expr.value();
             } else {
-                std::cerr << "Invalid expression 1" << std::endl;
-                exit(EXIT_FAILURE);
+                error("Invalid expression 1");
             }
 
             try_consume(TokenType::close_paren, "Expected `)`");
@@ -361,8 +381,7 @@ public:
             auto stmt = m_allocator.emplace<NodeStatement>(stmt_exit);
 
             return stmt;
-        } else if (peek().has_value() && peek().value().type == TokenType::print && peek(1).has_value()
-                   && peek(1).value().type == TokenType::open_paren) {
+        } else if (peek_is(TokenType::print) && peek_is(TokenType::open_paren, 1)) {
             // print(..
             consume();
             consume();
@@ -371,8 +390,7 @@ public:
             if (auto node_expr = parse_expr()) {
                 stmt_exit->expr = node_expr.value();
             } else {
-                std::cerr << "Invalid expression 1" << std::endl;
-                exit(EXIT_FAILURE);
+                error("Invalid expression 1");
             }
 
             try_consume(TokenType::close_paren, "Expected `)`");
@@ -381,9 +399,9 @@ public:
             auto stmt = m_allocator.emplace<NodeStatement>(stmt_exit);
 
             return stmt;
-        } else if (peek().has_value() && peek().value().type == TokenType::int_type
-                   && peek(1).has_value() && peek(1).value().type == TokenType::ident
-                   && peek(2).has_value() && peek(2).value().type == TokenType::eq) {
+        } else if (peek_is(TokenType::int_type)
+                   && peek_is(TokenType::ident, 1)
+                   && peek_is(TokenType::eq, 2)) {
             // int x = 5
             consume(); //int
             auto stmt_int = m_allocator.emplace<NodeStatementInt>();
@@ -392,17 +410,16 @@ public:
             if (auto expr = parse_expr()) { // 5
                 stmt_int->expr = expr.value();
             } else {
-                std::cerr << "Invalid expression 2" << std::endl;
-                exit(EXIT_FAILURE);
+                error("Invalid expression 2");
             }
 
             try_consume(TokenType::semi, "Expected a end line or ; 3");
 
             auto stmt = m_allocator.emplace<NodeStatement>(stmt_int);
             return stmt;
-        } else if (peek().has_value() && peek().value().type == TokenType::float_type
-                   && peek(1).has_value() && peek(1).value().type == TokenType::ident
-                   && peek(2).has_value() && peek(2).value().type == TokenType::eq) {
+        } else if (peek_is(TokenType::float_type)
+                   && peek_is(TokenType::ident, 1)
+                   && peek_is(TokenType::eq, 2)) {
             // float x = 5.2
             consume(); //float
             auto stmt_float = m_allocator.emplace<NodeStatementFloat>();
@@ -411,17 +428,16 @@ public:
             if (auto expr = parse_expr()) { // 5.2
                 stmt_float->expr = expr.value();
             } else {
-                std::cerr << "Invalid expression 3" << std::endl;
-                exit(EXIT_FAILURE);
+                error("Invalid expression 3");
             }
 
             try_consume(TokenType::semi, "Expected a end line or ; 3");
 
             auto stmt = m_allocator.emplace<NodeStatement>(stmt_float);
             return stmt;
-        } else if (peek().has_value() && peek().value().type == TokenType::string_type
-                   && peek(1).has_value() && peek(1).value().type == TokenType::ident
-                   && peek(2).has_value() && peek(2).value().type == TokenType::eq) {
+        } else if (peek_is(TokenType::string_type)
+                   && peek_is(TokenType::ident, 1)
+                   && peek_is(TokenType::eq, 2)) {
             // string s = "..."
             consume(); // string
             auto stmt_string = m_allocator.emplace<NodeStatementString>();
@@ -430,19 +446,17 @@ public:
             if (auto expr = parse_expr()) {
                 stmt_string->expr = expr.value();
             } else {
-                std::cerr << "Invalid expression for string assignment" << std::endl;
-                exit(EXIT_FAILURE);
+                error("Invalid expression for string assignment");
             }
             try_consume(TokenType::semi, "Expected a end line or ; 4");
             auto stmt = m_allocator.emplace<NodeStatement>(stmt_string);
             return stmt;
-        } else if (peek().has_value() && peek().value().type == TokenType::open_curly) {
+        } else if (peek_is(TokenType::open_curly)) {
             if (auto scope = parse_scope()) {
                 auto stmt = m_allocator.emplace<NodeStatement>(scope.value());
                 return stmt;
             } else {
-                std::cerr << "Invalid scope" << std::endl;
-                exit(EXIT_FAILURE);
+                error("Invalid scope");
             }
         } else if (auto if_ = try_consume(TokenType::if_)) {
             try_consume(TokenType::open_paren, "Expected '('");
@@ -451,8 +465,7 @@ public:
             if (auto expr = parse_expr()) {
                 stmt_if->expr = expr.value();
             } else {
-                std::cerr << "Invalid expression 4" << std::endl;
-                exit(EXIT_FAILURE);
+                error("Invalid expression 4");
             }
 
             try_consume(TokenType::close_paren, "Expected ')'");
@@ -461,8 +474,7 @@ public:
             if (auto scope = parse_scope()) {
                 stmt_if->scope = scope.value();
             } else {
-                std::cerr << "Invalid scope" << std::endl;
-                exit(EXIT_FAILURE);
+                error("Invalid scope");
             }
             stmt_if->pred = parse_if_pred();
             auto stmt = m_allocator.emplace<NodeStatement>(stmt_if);
@@ -473,21 +485,18 @@ public:
             if (auto expr = parse_expr()) {
                 stmt_while->expr = expr.value();
             } else {
-                std::cerr << "Invalid expression in while" << std::endl;
-                exit(EXIT_FAILURE);
+                error("Invalid expression in while");
             }
             try_consume(TokenType::close_paren, "Expected ')'");
             try_consume(TokenType::semi);
             if (auto scope = parse_scope()) {
                 stmt_while->scope = scope.value();
             } else {
-                std::cerr << "Invalid scope in while" << std::endl;
-                exit(EXIT_FAILURE);
+                error("Invalid scope in while");
             }
             auto stmt = m_allocator.emplace<NodeStatement>(stmt_while);
             return stmt;
-        } else if (peek().has_value() && peek().value().type == TokenType::ident
-                   && peek(1).has_value() && peek(1).value().type == TokenType::eq) {
+        } else if (peek_is(TokenType::ident) && peek_is(TokenType::eq, 1)) {
             // x = expr
             auto assign = m_allocator.emplace<NodeStatementAssign>();
             assign->ident = consume();
@@ -495,8 +504,7 @@ public:
             if (auto expr = parse_expr()) {
                 assign->expr = expr.value();
             } else {
-                std::cerr << "Invalid expression in assignment" << std::endl;
-                exit(EXIT_FAILURE);
+                error("Invalid expression in assignment");
             }
             try_consume(TokenType::semi, "Expected a end line or ; for assignment");
             auto stmt = m_allocator.emplace<NodeStatement>(assign);
@@ -508,155 +516,96 @@ public:
 
     std::optional<NodeProg> parse_prog() {
         NodeProg prog;
-        while (peek().has_value()) {
-            if (auto stmt = parse_statement()) {
-                //std::cout << to_string(peek()->type) << '\n';
-                prog.stmts.push_back(stmt.value());
-
-                Tree visual_stmt = stmt_to_tree(stmt.value());
-                tree.children.push_back(visual_stmt);
-            } else {
-                if (!peek().has_value()) {
-                    break;
+        while (peek() != nullptr) {
+            try {
+                if (auto stmt = parse_statement()) {
+                    //std::cout << to_string(peek()->type) << '\n';
+                    prog.stmts.push_back(m_allocator, stmt.value());
+                } else {
+                    if (peek() == nullptr) {
+                        break;
+                    }
+                    error("Invalid statement at token: " + to_string(peek()->type));
                 }
-                // std::cout << to_string(peek()->type) << '\n';
-                std::cerr << "Invalid statement at token: " << std::to_string(static_cast<int>(peek().value().type))
-                          << "\nFor token " << to_string(peek()->type) << std::endl;
-                exit(EXIT_FAILURE);
+            } catch (const ParseError&) {
+                synchronize(false);
             }
         }
 
+        // Errors are in the diagnostics, the program holds every statement that parsed
         return prog;
     }
 
-public:
-    Tree tree = {{}, {}};
-
 private:
-    const std::vector<Token> m_tokens;
-    size_t m_index;
-    [[nodiscard]] inline std::optional<Token> peek(int offset = 0) const {
-        if (m_index + offset >= m_tokens.size()) {
-            return {};
-        } else {
-            return m_tokens.at(m_index + offset);
-        }
+    TokenStream m_tokens;
+    // Lookahead without copying, the pointer is valid until the token is consumed
+    [[nodiscard]] inline const Token* peek(size_t offset = 0) {
+        return m_tokens.peek(offset);
     }
 
-    inline Token try_consume(TokenType token, const std::string& err_msg) {
-        if (peek().has_value() && peek().value().type == token) {
-            return consume();
-        } else {
-            std::cerr << err_msg << std::endl;
-            exit(EXIT_FAILURE);
-        }
+    [[nodiscard]] inline bool peek_is(TokenType type, size_t offset = 0) {
+        return m_tokens.peek_is(type, offset);
     }
 
-    inline std::optional<Token> try_consume(TokenType token) {
-        if (peek().has_value() && peek().value().type == token) {
+    // err_msg is a view so the success path builds no std::string
+    inline Token try_consume(TokenType token, std::string_view err_msg) {
+        if (peek_is(token)) {
             return consume();
         } else {
-            return {};
+            error(std::string(err_msg));
         }
     }
 
-    inline Token consume() {
-        return m_tokens.at(m_index++);
-    }
-
-    ArenaAllocator m_allocator;
+    // Thrown after an error is reported, caught by the statement loops (panic mode)
+    struct ParseError {};
 
-    // Helper to create a dummy token for operators (since NodeBinExpr doesn't store the token)
-    Token make_token(TokenType type) {
-        return Token{.type = type};
-    }
-
-    Tree expr_to_tree(NodeExpr* expr) {
-        // 1. Check if it is a Binary Expression (Add, Sub, Multi, Div)
-        if (std::holds_alternative<NodeBinExpr*>(expr->var)) {
-            NodeBinExpr* bin_expr = std::get<NodeBinExpr*>(expr->var);
-
-            Tree root = {{}, {}}; // Placeholder
-
-            if (std::holds_alternative<NodeBinExprAdd*>(bin_expr->var)) {
-                auto node = std::get<NodeBinExprAdd*>(bin_expr->var);
-                root.tok = make_token(TokenType::plus);
-                root.children.push_back(expr_to_tree(node->lhs));
-                root.children.push_back(expr_to_tree(node->rhs));
-            }
-            else if (std::holds_alternative<NodeBinExprMinus*>(bin_expr->var)) {
-                auto node = std::get<NodeBinExprMinus*>(bin_expr->var);
-                root.tok = make_token(TokenType::minus);
-                root.children.push_back(expr_to_tree(node->lhs));
-                root.children.push_back(expr_to_tree(node->rhs));
-            }
-            else if (std::holds_alternative<NodeBinExprMulti*>(bin_expr->var)) {
-                auto node = std::get<NodeBinExprMulti*>(bin_expr->var);
-                root.tok = make_token(TokenType::star);
-                root.children.push_back(expr_to_tree(node->lhs));
-                root.children.push_back(expr_to_tree(node->rhs));
-            }
-            else if (std::holds_alternative<NodeBinExprDiv*>(bin_expr->var)) {
-                auto node = std::get<NodeBinExprDiv*>(bin_expr->var);
-                root.tok = make_token(TokenType::slash);
-                root.children.push_back(expr_to_tree(node->lhs));
-                root.children.push_back(expr_to_tree(node->rhs));
-            }
-            return root;
+    // Reports an error at the current token and abandons the statement
+    [[noreturn]] void error(const std::string& message) {
+        const Token* at = peek();
+        // invalid tokens were already reported by the tokenizer
+        if (at == nullptr || at->type != TokenType::invalid) {
+            m_diagnostics.error(at != nullptr ? at->span : Span { m_last_end, 0 }, message);
         }
-        // 2. Check if it is a Term (Number, Ident, etc.)
-        else if (std::holds_alternative<NodeTerm*>(expr->var)) {
-            NodeTerm* term = std::get<NodeTerm*>(expr->var);
+        throw ParseError {};
+    }
 
-            if (std::holds_alternative<NodeTermNumber*>(term->var)) {
-                auto node = std::get<NodeTermNumber*>(term->var);
-                return Tree{node->number, {}}; // Leaf node
-            }
-            else if (std::holds_alternative<NodeTermIdent*>(term->var)) {
-                auto node = std::get<NodeTermIdent*>(term->var);
-                return Tree{node->ident, {}}; // Leaf node
-            }
-            else if (std::holds_alternative<NodeTermParen*>(term->var)) {
-                auto node = std::get<NodeTermParen*>(term->var);
-                // We skip adding '()' to the visual tree to keep it clean,
-                // just show what's inside.
-                return expr_to_tree(node->expr);
+    // Skips tokens up to the end of the broken statement: past the next semi at
+    // the same brace depth, or up to the '}' closing the current scope (in_scope)
+    void synchronize(bool in_scope) {
+        size_t depth = 0;
+        while (const Token* token = peek()) {
+            if (token->type == TokenType::open_curly) {
+                depth++;
+            } else if (token->type == TokenType::close_curly) {
+                if (depth == 0 && in_scope) {
+                    return;
+                }
+                if (depth > 0) {
+                    depth--;
+                }
+            } else if (token->type == TokenType::semi && depth == 0) {
+                consume();
+                return;
             }
+            consume();
         }
-
-        return Tree{make_token(TokenType::ident), {}}; // Fallback
     }
 
-    Tree stmt_to_tree(NodeStatement* stmt) {
-        // Handle Exit
-        if (std::holds_alternative<NodeStatementExit*>(stmt->var)) {
-            auto node = std::get<NodeStatementExit*>(stmt->var);
-            Tree root = {make_token(TokenType::exit), {}};
-            root.children.push_back(expr_to_tree(node->expr));
-            return root;
-        }
-        // Handle Print
-        else if (std::holds_alternative<NodeStatementPrint*>(stmt->var)) {
-            auto node = std::get<NodeStatementPrint*>(stmt->var);
-            Tree root = {make_token(TokenType::print), {}};
-            root.children.push_back(expr_to_tree(node->expr));
-            return root;
-        }
-        // Handle Variable Declaration (Int)
-        else if (std::holds_alternative<NodeStatementInt*>(stmt->var)) {
-            auto node = std::get<NodeStatementInt*>(stmt->var);
-            Tree root = {make_token(TokenType::int_type), {}}; // Root is 'int'
-
-            // Child 1: The identifier name
-            root.children.push_back(Tree{node->ident, {}});
-
-            // Child 2: The assignment expression
-            root.children.push_back(expr_to_tree(node->expr));
-            return root;
+    inline std::optional<Token> try_consume(TokenType token) {
+        if (peek_is(token)) {
+            return consume();
+        } else {
+            return {};
         }
+    }
 
-        // ... Implement other statement types (If, While, Scope) similarly ...
-
-        return Tree{make_token(TokenType::semi), {}}; // Fallback
+    inline Token consume() {
+        const Token token = m_tokens.consume();
+        m_last_end = token.span.offset + token.span.length;
+        return token;
     }
+
+    Diagnostics& m_diagnostics;
+    uint32_t m_last_end = 0; // where errors at the end of the input are reported
+    ArenaAllocator& m_allocator;
 };
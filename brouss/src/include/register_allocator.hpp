@@ -0,0 +1,207 @@
+#pragma once
+
+#include "flat_ast.hpp"
+#include "ir.hpp"
+#include "symbols.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Linear-scan allocation of the int variables to callee-saved registers.
+// Every statement gets a position in program order. A variable lives from its
+// declaration to its last use, and to the end of every while loop that uses
+// it but does not declare it, since the next iteration reads it again. The
+// intervals are scanned by start: a variable takes a free register, or the one
+// of the live variable ending last if that one ends later, which is spilled.
+// A spilled variable lives in its stack slot for its whole life.
+class RegisterAllocator {
+public:
+  // rbp is kept for a frame pointer, the syscalls only clobber rcx and r11
+  static constexpr std::array<Reg, 5> k_registers { Reg::rbx, Reg::r12, Reg::r13, Reg::r14, Reg::r15 };
+
+  // Only the first `registers` of k_registers are handed out, 0 keeps every variable on the stack
+  explicit RegisterAllocator(const FlatAst& ast, size_t registers = k_registers.size())
+    : m_ast(ast), m_symbols(ast.ident_count()) {
+    walk_stmts(m_ast.root(), false);
+    scan(std::min(registers, k_registers.size()));
+  }
+
+  // Register of the variable declared by statement `stmt`, Reg::none when it is on the stack
+  [[nodiscard]] Reg reg(uint32_t stmt) const {
+    const auto it = m_regs.find(stmt);
+    return it == m_regs.end() ? Reg::none : it->second;
+  }
+
+  [[nodiscard]] size_t spilled_count() const {
+    return m_spilled;
+  }
+
+private:
+  struct Interval {
+    uint32_t stmt;
+    uint32_t start;
+    uint32_t end;
+  };
+
+  struct Loop {
+    uint32_t start;
+    std::vector<uint32_t> used; // intervals read or written in the loop
+  };
+
+  void walk_stmts(const FlatScope& scope, bool own_scope) {
+    if (own_scope) {
+      m_symbols.begin_scope();
+    }
+    for (uint32_t i = scope.first; i < scope.first + scope.count; ++i) {
+      walk_stmt(i);
+    }
+    if (own_scope) {
+      m_symbols.end_scope();
+    }
+  }
+
+  void walk_scope(uint32_t index) {
+    walk_stmts(m_ast.scope(index), true);
+  }
+
+  void walk_stmt(uint32_t index) {
+    const FlatStmt& stmt = m_ast.stmt(index);
+    const uint32_t position = m_position++;
+    switch (stmt.kind) {
+    case StmtKind::exit:
+    case StmtKind::print:
+      use_expr(stmt.expr, position);
+      break;
+
+    case StmtKind::int_decl:
+    case StmtKind::float_decl:
+    case StmtKind::string_decl: {
+      uint32_t interval = k_no_node;
+      if (stmt.kind == StmtKind::int_decl) {
+        interval = static_cast<uint32_t>(m_intervals.size());
+        m_intervals.push_back({ .stmt = index, .start = position, .end = position });
+      }
+      // Visible in its own initializer, like in the generator
+      m_symbols.declare(m_ast.ident(stmt.ident), interval);
+      use_expr(stmt.expr, position);
+      break;
+    }
+
+    case StmtKind::assign:
+      use(m_ast.ident(stmt.ident), position);
+      use_expr(stmt.expr, position);
+      break;
+
+    case StmtKind::scope:
+      walk_scope(stmt.scope);
+      break;
+
+    case StmtKind::if_:
+      use_expr(stmt.expr, position);
+      walk_scope(stmt.scope);
+      for (uint32_t pred = stmt.pred; pred != k_no_node; pred = m_ast.pred(pred).next) {
+        if (m_ast.pred(pred).expr != k_no_node) {
+          use_expr(m_ast.pred(pred).expr, m_position);
+        }
+        walk_scope(m_ast.pred(pred).scope);
+      }
+      break;
+
+    case StmtKind::while_: {
+      m_loops.push_back({ .start = position, .used = {} });
+      use_expr(stmt.expr, position);
+      walk_scope(stmt.scope);
+      const uint32_t end = m_position;
+      Loop loop = std::move(m_loops.back());
+      m_loops.pop_back();
+      for (const uint32_t interval : loop.used) {
+        if (m_intervals[interval].start < loop.start) {
+          m_intervals[interval].end = std::max(m_intervals[interval].end, end);
+          if (!m_loops.empty()) {
+            m_loops.back().used.push_back(interval);
+          }
+        }
+      }
+      break;
+    }
+    }
+  }
+
+  void use_expr(uint32_t index, uint32_t position) {
+    const FlatExpr& expr = m_ast.expr(index);
+    switch (expr.kind) {
+    case ExprKind::ident:
+      use(m_ast.ident(expr.lhs), position);
+      break;
+    case ExprKind::add:
+    case ExprKind::sub:
+    case ExprKind::mul:
+    case ExprKind::div:
+      use_expr(expr.lhs, position);
+      use_expr(expr.rhs, position);
+      break;
+    default:
+      break;
+    }
+  }
+
+  // Same lookup as the generator. The variables that are not int are declared
+  // with the interval k_no_node, which is also what an unknown name finds.
+  void use(uint32_t ident, uint32_t position) {
+    const uint32_t index = m_symbols.find(ident);
+    if (index == k_no_node) {
+      return;
+    }
+    Interval& interval = m_intervals[index];
+    interval.end = std::max(interval.end, position);
+    if (!m_loops.empty()) {
+      m_loops.back().used.push_back(index);
+    }
+  }
+
+  // The intervals are already sorted by start
+  void scan(size_t registers) {
+    std::vector<uint32_t> active; // by increasing end
+    std::vector<Reg> free(k_registers.rend() - static_cast<std::ptrdiff_t>(registers), k_registers.rend());
+    for (uint32_t current = 0; current < m_intervals.size(); ++current) {
+      const Interval& interval = m_intervals[current];
+      while (!active.empty() && m_intervals[active.front()].end < interval.start) {
+        free.push_back(m_regs[m_intervals[active.front()].stmt]);
+        active.erase(active.begin());
+      }
+
+      if (free.empty()) {
+        m_spilled++;
+        if (active.empty()) {
+          continue; // no register at all
+        }
+        const uint32_t last = active.back();
+        if (m_intervals[last].end <= interval.end) {
+          continue; // the current one is spilled
+        }
+        m_regs[interval.stmt] = m_regs[m_intervals[last].stmt];
+        m_regs.erase(m_intervals[last].stmt);
+        active.pop_back();
+      } else {
+        m_regs[interval.stmt] = free.back();
+        free.pop_back();
+      }
+
+      const auto at = std::upper_bound(active.begin(), active.end(), interval.end,
+                                       [&](uint32_t end, uint32_t other) { return end < m_intervals[other].end; });
+      active.insert(at, current);
+    }
+  }
+
+  const FlatAst& m_ast;
+  std::vector<Interval> m_intervals;
+  SymbolTable m_symbols; // identifier -> interval
+  std::vector<Loop> m_loops;
+  uint32_t m_position = 0;
+  std::unordered_map<uint32_t, Reg> m_regs; // declaring statement -> register
+  size_t m_spilled = 0;
+};
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) && !defined(BROUSS_NO_SIMD)
+#define BROUSS_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+// Kernels used by the Tokenizer to skip over long runs of bytes (whitespace,
+// identifiers, comment and string bodies). Each returns the length of the run
+// starting at p, i.e. the index of the first byte that ends it (or n).
+// The SIMD versions are picked at runtime and must match the scalar ones byte for byte.
+
+namespace scan {
+
+// Whitespace that is not a token ('\n' is a semi)
+[[nodiscard]] constexpr bool is_blank(unsigned char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+[[nodiscard]] constexpr bool is_alnum(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+}
+
+// Scalar fallback
+
+inline size_t blank_run_scalar(const char* p, size_t n) {
+    size_t i = 0;
+    while (i < n && is_blank(static_cast<unsigned char>(p[i]))) i++;
+    return i;
+}
+
+inline size_t alnum_run_scalar(const char* p, size_t n) {
+    size_t i = 0;
+    while (i < n && is_alnum(static_cast<unsigned char>(p[i]))) i++;
+    return i;
+}
+
+inline size_t find_newline_scalar(const char* p, size_t n) {
+    size_t i = 0;
+    while (i < n && p[i] != '\n') i++;
+    return i;
+}
+
+inline size_t find_quote_or_newline_scalar(const char* p, size_t n) {
+    size_t i = 0;
+    while (i < n && p[i] != '"' && p[i] != '\n') i++;
+    return i;
+}
+
+#ifdef BROUSS_SIMD_X86
+
+// SSE2 (always available on x86-64), 16 bytes at a time
+
+// Bytes x with lo <= x <= lo + len, as a compare mask
+inline __m128i in_range_sse2(__m128i v, char lo, char len) {
+    const __m128i shifted = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+    return _mm_cmpeq_epi8(_mm_subs_epu8(shifted, _mm_set1_epi8(len)), _mm_setzero_si128());
+}
+
+inline __m128i blank_mask_sse2(__m128i v) {
+    const __m128i ctrl = _mm_andnot_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), in_range_sse2(v, '\t', '\r' - '\t'));
+    return _mm_or_si128(ctrl, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+}
+
+inline __m128i alnum_mask_sse2(__m128i v) {
+    const __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    return _mm_or_si128(in_range_sse2(lower, 'a', 'z' - 'a'), in_range_sse2(v, '0', '9' - '0'));
+}
+
+// Runs while match(block) is set for every byte
+template <typename Match>
+inline size_t run_sse2(const char* p, size_t n, Match match) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        const uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(match(v)));
+        if (mask != 0xFFFF) {
+            return i + static_cast<size_t>(__builtin_ctz(~mask));
+        }
+    }
+    return i;
+}
+
+inline size_t blank_run_sse2(const char* p, size_t n) {
+    const size_t i = run_sse2(p, n, blank_mask_sse2);
+    return i + blank_run_scalar(p + i, n - i);
+}
+
+inline size_t alnum_run_sse2(const char* p, size_t n) {
+    const size_t i = run_sse2(p, n, alnum_mask_sse2);
+    return i + alnum_run_scalar(p + i, n - i);
+}
+
+inline size_t find_newline_sse2(const char* p, size_t n) {
+    const size_t i = run_sse2(p, n, [](__m128i v) {
+        return _mm_xor_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_set1_epi8(-1));
+    });
+    return i + find_newline_scalar(p + i, n - i);
+}
+
+inline size_t find_quote_or_newline_sse2(const char* p, size_t n) {
+    const size_t i = run_sse2(p, n, [](__m128i v) {
+        const __m128i stop = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+        return _mm_xor_si128(stop, _mm_set1_epi8(-1));
+    });
+    return i + find_quote_or_newline_scalar(p + i, n - i);
+}
+
+// AVX2, 32 bytes at a time. Only called when the CPU reports support.
+
+#define BROUSS_AVX2 __attribute__((target("avx2")))
+
+BROUSS_AVX2 inline __m256i in_range_avx2(__m256i v, char lo, char len) {
+    const __m256i shifted = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+    return _mm256_cmpeq_epi8(_mm256_subs_epu8(shifted, _mm256_set1_epi8(len)), _mm256_setzero_si256());
+}
+
+BROUSS_AVX2 inline uint32_t blank_bits_avx2(__m256i v) {
+    const __m256i ctrl = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), in_range_avx2(v, '\t', '\r' - '\t'));
+    return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(ctrl, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')))));
+}
+
+BROUSS_AVX2 inline uint32_t alnum_bits_avx2(__m256i v) {
+    const __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    const __m256i alnum = _mm256_or_si256(in_range_avx2(lower, 'a', 'z' - 'a'), in_range_avx2(v, '0', '9' - '0'));
+    return static_cast<uint32_t>(_mm256_movemask_epi8(alnum));
+}
+
+BROUSS_AVX2 inline uint32_t not_newline_bits_avx2(__m256i v) {
+    return ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))));
+}
+
+BROUSS_AVX2 inline uint32_t not_quote_or_newline_bits_avx2(__m256i v) {
+    const __m256i stop = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
+    return ~static_cast<uint32_t>(_mm256_movemask_epi8(stop));
+}
+
+// Tail (< 32 bytes) goes through the SSE2 kernel, which finishes with the scalar one
+#define BROUSS_AVX2_RUN(name, bits_fn, tail_fn) \
+    BROUSS_AVX2 inline size_t name(const char* p, size_t n) { \
+        size_t i = 0; \
+        for (; i + 32 <= n; i += 32) { \
+            const uint32_t bits = bits_fn(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i))); \
+            if (bits != 0xFFFFFFFFu) { \
+                return i + static_cast<size_t>(__builtin_ctz(~bits)); \
+            } \
+        } \
+        return i + tail_fn(p + i, n - i); \
+    }
+
+BROUSS_AVX2_RUN(blank_run_avx2, blank_bits_avx2, blank_run_sse2)
+BROUSS_AVX2_RUN(alnum_run_avx2, alnum_bits_avx2, alnum_run_sse2)
+BROUSS_AVX2_RUN(find_newline_avx2, not_newline_bits_avx2, find_newline_sse2)
+BROUSS_AVX2_RUN(find_quote_or_newline_avx2, not_quote_or_newline_bits_avx2, find_quote_or_newline_sse2)
+
+#undef BROUSS_AVX2_RUN
+#undef BROUSS_AVX2
+
+#endif // BROUSS_SIMD_X86
+
+struct Kernels {
+    size_t (*blank_run)(const char*, size_t);
+    size_t (*alnum_run)(const char*, size_t);
+    size_t (*find_newline)(const char*, size_t);
+    size_t (*find_quote_or_newline)(const char*, size_t);
+};
+
+inline constexpr Kernels k_scalar_kernels {
+    blank_run_scalar, alnum_run_scalar, find_newline_scalar, find_quote_or_newline_scalar,
+};
+
+// Picks the widest kernels the CPU supports (checked once)
+[[nodiscard]] inline const Kernels& kernels() {
+    static const Kernels selected = [] {
+#ifdef BROUSS_SIMD_X86
+        if (__builtin_cpu_supports("avx2")) {
+            return Kernels { blank_run_avx2, alnum_run_avx2, find_newline_avx2, find_quote_or_newline_avx2 };
+        }
+        return Kernels { blank_run_sse2, alnum_run_sse2, find_newline_sse2, find_quote_or_newline_sse2 };
+#else
+        return k_scalar_kernels;
+#endif
+    }();
+    return selected;
+}
+
+} // namespace scan
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Scoped symbol table over the interned identifiers of a FlatAst.
+// Every identifier id has a slot holding the index of its innermost
+// declaration in the caller's own list of variables. A declaration logs the
+// slot it overwrites, and end_scope undoes the log back to the mark of the
+// matching begin_scope, so entering, leaving and looking up are O(1) per
+// declaration whatever the number of variables.
+class SymbolTable {
+public:
+  static constexpr uint32_t k_none = UINT32_MAX;
+
+  explicit SymbolTable(size_t ident_count)
+    : m_slots(ident_count, k_none) {
+  }
+
+  // Index of the innermost declaration of the identifier, k_none when there is none
+  [[nodiscard]] uint32_t find(uint32_t ident) const {
+    return m_slots[ident];
+  }
+
+  void declare(uint32_t ident, uint32_t index) {
+    m_undo.push_back({ .ident = ident, .previous = m_slots[ident] });
+    m_slots[ident] = index;
+  }
+
+  void begin_scope() {
+    m_scopes.push_back(m_undo.size());
+  }
+
+  void end_scope() {
+    const size_t mark = m_scopes.back();
+    m_scopes.pop_back();
+    while (m_undo.size() > mark) {
+      m_slots[m_undo.back().ident] = m_undo.back().previous;
+      m_undo.pop_back();
+    }
+  }
+
+private:
+  struct Undo {
+    uint32_t ident;
+    uint32_t previous;
+  };
+
+  std::vector<uint32_t> m_slots; // identifier -> declaration
+  std::vector<Undo> m_undo;
+  std::vector<size_t> m_scopes; // undo log size at each begin_scope
+};
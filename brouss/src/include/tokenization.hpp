@@ -1,17 +1,26 @@
 #pragma once
 
-#include <cctype>
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <charconv>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <optional> 
 #include <ostream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "diagnostics.hpp"
+#include "scan.hpp"
+
 // (LEXER) File to identify the "token" and give it a type
 
-enum class TokenType {
+enum class TokenType : uint8_t {
     exit,
     return_, // TODO
     print, // TODO
@@ -51,6 +60,7 @@ enum class TokenType {
     elif,
     else_,
     while_,
+    invalid, // bad input, the lexeme is the offending text (already reported by the Tokenizer)
     // TODO add reasigment x = 1, add negative numbers, add x += 1, x < 5
 };
 
@@ -67,192 +77,613 @@ inline std::optional<int> bin_prio(TokenType type) {
     }
 }
 
+// Only these tokens carry a lexeme, everything else is fully described by its type
+[[nodiscard]] constexpr bool has_lexeme(TokenType type) {
+    return type == TokenType::ident || type == TokenType::int_lit || type == TokenType::float_lit
+        || type == TokenType::string_lit || type == TokenType::invalid;
+}
+
+// Value of a number literal, decoded once by the lexer (int_lit / float_lit),
+// or the id of an identifier, interned when the AST is lowered (ident)
+union Literal {
+    int64_t int_value;
+    float float_value;
+    uint32_t ident;
+};
+
+// Lightweight view of one token, the lexeme points into the source (no allocation)
 struct Token {
     TokenType type;
-    std::optional<std::string> value {};
+    std::string_view value {};
+    Span span {};
+    Literal literal {};
+
+    [[nodiscard]] bool has_value() const {
+        return has_lexeme(type);
+    }
 
     bool operator==(const Token& other) const {
-        if (!other.value.has_value() && !this->value.has_value()) {
+        if (!other.has_value() && !this->has_value()) {
             return (this->type == other.type);
         }
-        return (this->type == other.type && this->value.value() == other.value.value());
+        return (this->type == other.type && this->value == other.value);
     }
 };
 
-class Tokenizer{
+// Token stream stored as a structure of arrays: one type per token plus a span into the source.
+// Decoded number literals are kept aside, only for the tokens that have one, and
+// each token keeps the index of its literal so reading one is a direct lookup.
+// The source must outlive the buffer (and every Token read from it).
+class TokenBuffer {
 public:
-    inline explicit Tokenizer(const std::string& src)
-        : m_src(std::move(src)), m_index(0){
-
-    }
-
-    inline std::vector<Token> tokenize() {
-        std::vector<Token> tokens {};
-        std::string buf;
-
-        while (peek().has_value()) {
-            if (isalpha(peek().value())) { //Returns non-zero if the parameter is a letter
-                buf.push_back(consume());
-
-                while(peek().has_value() && std::isalnum(peek().value())) {
-                    buf.push_back(consume());
-                }
-
-                if (buf == "exit") {
-                    tokens.push_back({.type = TokenType::exit});
-
-                    buf.clear();
-                } else if (buf == "return") {
-                    tokens.push_back({ .type = TokenType::return_});
-                    buf.clear();
-                } else if (buf == "int") {
-                    tokens.push_back({ .type = TokenType::int_type});
-                    buf.clear();
-                } else if (buf == "float") {
-                    tokens.push_back({ .type = TokenType::float_type});
-                    buf.clear();
-                } else if (buf == "bool") {
-                    tokens.push_back({ .type = TokenType::bool_type});
-                    buf.clear();
-                } else if (buf == "true") {
-                    tokens.push_back({ .type = TokenType::bool_true_lit});
-                    buf.clear();
-                } else if (buf == "false") {
-                    tokens.push_back({ .type = TokenType::bool_false_lit});
-                    buf.clear();
-                } else if (buf == "char") {
-                    tokens.push_back({ .type = TokenType::char_type});
-                    buf.clear();
-                } else if (buf == "string") {
-                    tokens.push_back({ .type = TokenType::string_type});
-                    buf.clear();
-                } else if (buf == "print") {
-                    tokens.push_back({ .type = TokenType::print});
-                    buf.clear();
-                } else if (buf == "if") {
-                    tokens.push_back({ .type = TokenType::if_});
-                    buf.clear();
-                } else if (buf == "elif") {
-                    tokens.push_back({ .type = TokenType::elif});
-                    buf.clear();
-                } else if (buf == "else") {
-                    tokens.push_back({ .type = TokenType::else_});
-                    buf.clear();
-                } else if (buf == "while") {
-                    tokens.push_back({ .type = TokenType::while_});
-                    buf.clear();
-                } else {
-                    tokens.push_back({.type = TokenType::ident, .value = buf});
-                    buf.clear();
-                }
-
-            } else if (std::isdigit(peek().value())) { // Returns non-zero if the parameter is a digit
-                // TODO need to check if float
-                buf.push_back(consume());
-
-                while (peek().has_value() && std::isdigit(peek().value())) {
-                    buf.push_back(consume());
-                }
-
-                if (peek().has_value() && peek().value() == '.') { // TODO fix edge case: 12.56.48.15.48
-                    int first = std::stoi(buf);
-                    buf.clear();
-                    consume();
-                    while (peek().has_value() && std::isdigit(peek().value())) {
-                        buf.push_back(consume());
-                    }
-                    int second = std::stoi(buf);
-                    std::string float_str = std::to_string(first) + "." + std::to_string(second);
-
-                    tokens.push_back({.type = TokenType::float_lit, .value = float_str});
-                } else {
-                    tokens.push_back({.type = TokenType::int_lit, .value = buf});
-                }
-                buf.clear();
-            } else if (peek().value() == '(') {
-                consume();
-                tokens.push_back({ .type = TokenType::open_paren });
-            } else if (peek().value() == ')') {
-                consume();
-                tokens.push_back({ .type = TokenType::close_paren });
-            } else if (peek().value() == '=') {
-                consume();
-                tokens.push_back({ .type = TokenType::eq });
-            } else if (peek().value() == '.') {
-                consume();
-                tokens.push_back({ .type = TokenType::dot });
-            } else if (peek().value() == '+') {
-                consume();
-                tokens.push_back({.type = TokenType::plus });
-            } else if (peek().value() == '*') {
-                consume();
-                tokens.push_back({.type = TokenType::star });
-            } else if (peek().value() == '-') {
-                consume();
-                tokens.push_back({.type = TokenType::minus });
-            } else if (peek().value() == '/' && peek(1).has_value() && peek(1).value() == '/') {
-                consume();
-                consume();
-
-                while (peek().has_value() && peek().value() != '\n') {
-                    consume();
-                }
-            } else if (peek().value() == '/') {
-                consume();
-                tokens.push_back({.type = TokenType::slash });
-            } else if (peek().value() == '{') {
-                consume();
-                tokens.push_back({.type = TokenType::open_curly });
-            } else if (peek().value() == '}') {
-                consume();
-                tokens.push_back({.type = TokenType::close_curly });
-            } else if (peek().value() == '\n' || peek().value() == ';') {
-                consume();
-                tokens.push_back({.type = TokenType::semi });
-            } else if (peek().value() == '\'') {
-                consume();
-                tokens.push_back({.type = TokenType::quote_s });
-            } else if (peek().value() == '\"') {
-                consume();
-                tokens.push_back({.type = TokenType::quote_d });
-                while (peek().has_value() && peek().value() != '\"') {
-                    if (peek().value() == '\n') {
-                        std::cerr << "Could not found closing \"";
-                        exit(EXIT_FAILURE);
-                    }
-
-                    buf.push_back(consume());
-                }
-                tokens.push_back({.type = TokenType::string_lit, .value = buf});
-                buf.clear();
-
-                consume(); // last "
-                tokens.push_back({.type = TokenType::quote_d });
-            } else if (std::isspace(peek().value())) {
-                consume();
-            } else {
-                std::cerr << "Token not recognized " << peek().value() << std::endl;
-                exit(EXIT_FAILURE);
+    TokenBuffer() = default;
+
+    explicit TokenBuffer(std::string_view src)
+        : m_src(src) {
+    }
+
+    inline void reserve(size_t count) {
+        m_types.reserve(count);
+        m_spans.reserve(count);
+        m_literal_indices.reserve(count);
+    }
+
+    inline void push(TokenType type, size_t offset = 0, size_t length = 0, Literal literal = {}) {
+        m_types.push_back(type);
+        m_spans.push_back({ static_cast<uint32_t>(offset), static_cast<uint32_t>(length) });
+        m_literal_indices.push_back(static_cast<uint32_t>(m_literals.size()));
+        if (type == TokenType::int_lit || type == TokenType::float_lit) {
+            m_literals.push_back(literal);
+        }
+    }
+
+    // Appends the tokens of a buffer that was lexed from the slice of this
+    // buffer's source starting at base
+    inline void append(const TokenBuffer& part, size_t base) {
+        const auto first_literal = static_cast<uint32_t>(m_literals.size());
+        m_types.insert(m_types.end(), part.m_types.begin(), part.m_types.end());
+        m_literal_indices.reserve(m_literal_indices.size() + part.m_literal_indices.size());
+        for (const uint32_t literal : part.m_literal_indices) {
+            m_literal_indices.push_back(first_literal + literal);
+        }
+        m_literals.insert(m_literals.end(), part.m_literals.begin(), part.m_literals.end());
+        m_spans.reserve(m_spans.size() + part.m_spans.size());
+        for (const Span& span : part.m_spans) {
+            m_spans.push_back({ static_cast<uint32_t>(span.offset + base), span.length });
+        }
+    }
+
+    [[nodiscard]] inline size_t size() const {
+        return m_types.size();
+    }
+
+    [[nodiscard]] inline bool empty() const {
+        return m_types.empty();
+    }
+
+    [[nodiscard]] inline TokenType type(size_t index) const {
+        return m_types[index];
+    }
+
+    [[nodiscard]] inline Span span(size_t index) const {
+        return m_spans[index];
+    }
+
+    [[nodiscard]] inline Literal literal(size_t index) const {
+        const TokenType type = m_types[index];
+        if (type != TokenType::int_lit && type != TokenType::float_lit) {
+            return {};
+        }
+        return m_literals[m_literal_indices[index]];
+    }
+
+    [[nodiscard]] inline std::string_view lexeme(size_t index) const {
+        if (!has_lexeme(m_types[index])) {
+            return {};
+        }
+        return m_src.substr(m_spans[index].offset, m_spans[index].length);
+    }
+
+    [[nodiscard]] inline Token operator[](size_t index) const {
+        return { .type = m_types[index], .value = lexeme(index), .span = m_spans[index], .literal = literal(index) };
+    }
+
+    [[nodiscard]] inline std::string_view source() const {
+        return m_src;
+    }
+
+private:
+    std::string_view m_src;
+    std::vector<TokenType> m_types;
+    std::vector<Span> m_spans;
+    std::vector<uint32_t> m_literal_indices; // per token, its index in m_literals (when it has a literal)
+    std::vector<Literal> m_literals;
+};
+
+// Lexer tables, everything below is built at compile time
+
+// Character classes: every byte of the source is mapped to one of these
+enum class CharClass : uint8_t {
+    other,
+    space,
+    newline,
+    alpha,
+    digit,
+    dot,
+    slash,
+    quote_d,
+    punct, // single character token, see k_punct_tokens
+    end, // past the end of the source
+    count,
+};
+
+[[nodiscard]] consteval std::array<CharClass, 256> make_char_class_table() {
+    std::array<CharClass, 256> table {};
+    table.fill(CharClass::other);
+    for (unsigned char c : std::string_view(" \t\r\v\f")) table[c] = CharClass::space;
+    for (unsigned char c = 'a'; c <= 'z'; ++c) table[c] = CharClass::alpha;
+    for (unsigned char c = 'A'; c <= 'Z'; ++c) table[c] = CharClass::alpha;
+    for (unsigned char c = '0'; c <= '9'; ++c) table[c] = CharClass::digit;
+    for (unsigned char c : std::string_view("()=+*-{};'")) table[c] = CharClass::punct;
+    table['\n'] = CharClass::newline;
+    table['.'] = CharClass::dot;
+    table['/'] = CharClass::slash;
+    table['"'] = CharClass::quote_d;
+    return table;
+}
+
+inline constexpr std::array<CharClass, 256> k_char_class = make_char_class_table();
+
+// The scan kernels must agree with the table, otherwise SIMD and scalar output differ
+[[nodiscard]] consteval bool scan_matches_char_class() {
+    for (size_t c = 0; c < 256; ++c) {
+        const CharClass cls = k_char_class[c];
+        if (scan::is_blank(static_cast<unsigned char>(c)) != (cls == CharClass::space)) return false;
+        if (scan::is_alnum(static_cast<unsigned char>(c)) != (cls == CharClass::alpha || cls == CharClass::digit)) return false;
+    }
+    return true;
+}
+static_assert(scan_matches_char_class());
+
+// Token produced by a single character (only meaningful for punct, newline and dot)
+[[nodiscard]] consteval std::array<TokenType, 256> make_punct_table() {
+    std::array<TokenType, 256> table {};
+    table.fill(TokenType::semi);
+    table['('] = TokenType::open_paren;
+    table[')'] = TokenType::close_paren;
+    table['='] = TokenType::eq;
+    table['.'] = TokenType::dot;
+    table['+'] = TokenType::plus;
+    table['*'] = TokenType::star;
+    table['-'] = TokenType::minus;
+    table['{'] = TokenType::open_curly;
+    table['}'] = TokenType::close_curly;
+    table['\n'] = TokenType::semi;
+    table[';'] = TokenType::semi;
+    table['\''] = TokenType::quote_s;
+    return table;
+}
+
+inline constexpr std::array<TokenType, 256> k_punct_tokens = make_punct_table();
+
+// DFA states. `done` means the current character is not part of the token,
+// `error` means the input is invalid at the current character.
+enum class LexState : uint8_t {
+    start,
+    space,
+    single, // one character token
+    ident,
+    int_lit,
+    float_lit,
+    slash,
+    comment,
+    string, // inside "..."
+    string_end, // closing " consumed
+    done,
+    error,
+    count,
+};
+
+using LexTable = std::array<std::array<LexState, static_cast<size_t>(CharClass::count)>, static_cast<size_t>(LexState::count)>;
+
+[[nodiscard]] consteval LexTable make_lex_table() {
+    LexTable table {};
+    for (auto& row : table) row.fill(LexState::done);
+
+    auto set = [&](LexState from, CharClass cls, LexState to) {
+        table[static_cast<size_t>(from)][static_cast<size_t>(cls)] = to;
+    };
+
+    using enum CharClass;
+    set(LexState::start, other, LexState::error);
+    set(LexState::start, space, LexState::space);
+    set(LexState::start, newline, LexState::single);
+    set(LexState::start, alpha, LexState::ident);
+    set(LexState::start, digit, LexState::int_lit);
+    set(LexState::start, dot, LexState::single);
+    set(LexState::start, slash, LexState::slash);
+    set(LexState::start, quote_d, LexState::string);
+    set(LexState::start, punct, LexState::single);
+
+    set(LexState::space, space, LexState::space);
+
+    set(LexState::ident, alpha, LexState::ident);
+    set(LexState::ident, digit, LexState::ident);
+
+    set(LexState::int_lit, digit, LexState::int_lit);
+    set(LexState::int_lit, dot, LexState::float_lit); // TODO fix edge case: 12.56.48.15.48
+    set(LexState::float_lit, digit, LexState::float_lit);
+
+    set(LexState::slash, slash, LexState::comment);
+
+    for (size_t cls = 0; cls < static_cast<size_t>(CharClass::count); ++cls) {
+        table[static_cast<size_t>(LexState::comment)][cls] = LexState::comment;
+        table[static_cast<size_t>(LexState::string)][cls] = LexState::string;
+    }
+    set(LexState::comment, newline, LexState::done);
+    set(LexState::comment, end, LexState::done);
+
+    set(LexState::string, quote_d, LexState::string_end);
+    set(LexState::string, newline, LexState::error);
+    set(LexState::string, end, LexState::error);
+    return table;
+}
+
+inline constexpr LexTable k_lex_table = make_lex_table();
+
+// Keywords are found with a perfect hash on (first char, last char, length),
+// the multiplier is searched at compile time so that no two keywords collide.
+struct Keyword {
+    std::string_view word;
+    TokenType type;
+};
+
+inline constexpr std::array<Keyword, 14> k_keywords {{
+    { "exit", TokenType::exit },
+    { "return", TokenType::return_ },
+    { "int", TokenType::int_type },
+    { "float", TokenType::float_type },
+    { "bool", TokenType::bool_type },
+    { "true", TokenType::bool_true_lit },
+    { "false", TokenType::bool_false_lit },
+    { "char", TokenType::char_type },
+    { "string", TokenType::string_type },
+    { "print", TokenType::print },
+    { "if", TokenType::if_ },
+    { "elif", TokenType::elif },
+    { "else", TokenType::else_ },
+    { "while", TokenType::while_ },
+}};
+
+inline constexpr uint32_t k_keyword_bits = 5;
+
+[[nodiscard]] constexpr uint32_t keyword_hash(std::string_view word, uint32_t seed) {
+    const uint32_t key = static_cast<uint32_t>(static_cast<unsigned char>(word.front())) << 16
+        | static_cast<uint32_t>(static_cast<unsigned char>(word.back())) << 8
+        | static_cast<uint32_t>(word.size() & 0xFF);
+    return (key * seed) >> (32 - k_keyword_bits);
+}
+
+[[nodiscard]] consteval uint32_t find_keyword_seed() {
+    for (uint32_t seed = 0x9E3779B1; seed != 0; seed += 2) {
+        std::array<bool, 1 << k_keyword_bits> used {};
+        bool collision = false;
+        for (const Keyword& kw : k_keywords) {
+            const uint32_t h = keyword_hash(kw.word, seed);
+            if (used[h]) {
+                collision = true;
+                break;
             }
+            used[h] = true;
+        }
+        if (!collision) {
+            return seed;
+        }
+    }
+    return 0;
+}
+
+inline constexpr uint32_t k_keyword_seed = find_keyword_seed();
+static_assert(k_keyword_seed != 0, "no perfect hash for the keyword set");
+
+[[nodiscard]] consteval std::array<Keyword, 1 << k_keyword_bits> make_keyword_table() {
+    std::array<Keyword, 1 << k_keyword_bits> table {};
+    for (const Keyword& kw : k_keywords) {
+        table[keyword_hash(kw.word, k_keyword_seed)] = kw;
+    }
+    return table;
+}
+
+inline constexpr std::array<Keyword, 1 << k_keyword_bits> k_keyword_table = make_keyword_table();
+
+// Returns the keyword token for word, or ident if it is not a keyword
+[[nodiscard]] constexpr TokenType keyword_or_ident(std::string_view word) {
+    const Keyword& kw = k_keyword_table[keyword_hash(word, k_keyword_seed)];
+    return kw.word == word ? kw.type : TokenType::ident;
+}
+
+class Tokenizer{
+public:
+    // Bad input never stops the tokenizer, it becomes an invalid token and,
+    // when diagnostics are given, an error
+    inline explicit Tokenizer(std::string_view src, Diagnostics* diagnostics = nullptr)
+        : m_src(src), m_index(0), m_scan(scan::kernels()), m_diagnostics(diagnostics){
+
+    }
+
+    inline TokenBuffer tokenize() {
+        TokenBuffer tokens(m_src);
+        // Dense code has about one token per 3 bytes. Growing the buffer past a
+        // short guess copies it and faults in twice the pages, while reserved
+        // pages cost nothing until a token is written to them.
+        tokens.reserve(m_src.size() / 2);
+
+        while (lex_next([&](TokenType type, size_t offset, size_t length, Literal literal = {}) {
+            tokens.push(type, offset, length, literal);
+        })) {
         }
 
         m_index = 0;
         return tokens;
     }
 
+    // Pull API: lexes only as far as needed for the next token, nothing is buffered
+    // except the (at most 2) extra tokens produced by a string literal.
+    // Returns nothing at the end of the source.
+    inline std::optional<Token> next_token() {
+        while (m_pending_count == 0) {
+            const bool more = lex_next([&](TokenType type, size_t offset, size_t length, Literal literal = {}) {
+                m_pending[(m_pending_head + m_pending_count++) % m_pending.size()] = {
+                    .type = type,
+                    .value = has_lexeme(type) ? m_src.substr(offset, length) : std::string_view {},
+                    .span = { static_cast<uint32_t>(offset), static_cast<uint32_t>(length) },
+                    .literal = literal,
+                };
+            });
+            if (!more) {
+                return {};
+            }
+        }
+        const Token token = m_pending[m_pending_head];
+        m_pending_head = (m_pending_head + 1) % m_pending.size();
+        m_pending_count--;
+        return token;
+    }
+
+    [[nodiscard]] inline std::string_view source() const {
+        return m_src;
+    }
+
 private:
-    [[nodiscard]] inline std::optional<char> peek(int offset = 0) const {
-        if (m_index + offset >= m_src.size()) {
-            return {};
+    // Lexes one lexeme (blank, comment, token or string literal) and hands its
+    // tokens to push_token(type, offset, length[, literal]). Returns false at the end of the source.
+    template <typename PushToken>
+    inline bool lex_next(PushToken&& push_token) {
+        if (m_index >= m_src.size()) {
+            return false;
+        }
+
+        const size_t start = m_index;
+        const LexState state = run_dfa();
+
+        switch (state) {
+        case LexState::space:
+        case LexState::comment:
+            break;
+        case LexState::single:
+            push_token(k_punct_tokens[static_cast<unsigned char>(m_src[start])], start, 1);
+            break;
+        case LexState::ident: {
+            const std::string_view word = m_src.substr(start, m_index - start);
+            const TokenType type = keyword_or_ident(word);
+            push_token(type, start, word.size());
+            break;
+        }
+        case LexState::int_lit:
+        case LexState::float_lit:
+            lex_number(state, start, push_token);
+            break;
+        case LexState::slash:
+            push_token(TokenType::slash, start, 1);
+            break;
+        case LexState::string_end:
+            push_token(TokenType::quote_d, start, 1);
+            push_token(TokenType::string_lit, start + 1, m_index - start - 2);
+            push_token(TokenType::quote_d, m_index - 1, 1);
+            break;
+        case LexState::string: // the rest of the line is the unterminated string
+            push_token(TokenType::quote_d, start, 1);
+            push_token(TokenType::invalid, start + 1, m_index - start - 1);
+            report(start, 1, "Could not found closing \"");
+            break;
+        default:
+            m_index++;
+            push_token(TokenType::invalid, start, 1);
+            report(start, 1, std::string("Token not recognized ") + m_src[start]);
+            break;
+        }
+        return true;
+    }
+
+    // Decodes the literal the DFA just matched, a value out of range is an invalid token
+    template <typename PushToken>
+    inline void lex_number(LexState state, size_t start, PushToken&& push_token) {
+        const char* first = m_src.data() + start;
+        const char* last = m_src.data() + m_index;
+        Literal literal {};
+        std::from_chars_result result;
+        TokenType type;
+        if (state == LexState::int_lit) {
+            type = TokenType::int_lit;
+            result = std::from_chars(first, last, literal.int_value);
         } else {
-            return m_src.at(m_index + offset);
+            type = TokenType::float_lit;
+            result = std::from_chars(first, last, literal.float_value, std::chars_format::fixed);
+        }
+        if (result.ec != std::errc {}) {
+            push_token(TokenType::invalid, start, m_index - start);
+            report(start, m_index - start, "Number out of range " + std::string(first, last));
+            return;
+        }
+        push_token(type, start, m_index - start, literal);
+    }
+
+    inline void report(size_t offset, size_t length, std::string message) {
+        if (m_diagnostics != nullptr) {
+            m_diagnostics->error({ static_cast<uint32_t>(offset), static_cast<uint32_t>(length) }, std::move(message));
         }
     }
 
-    inline char consume() {
-        return m_src.at(m_index++);
+    [[nodiscard]] inline CharClass char_class(size_t index) const {
+        if (index >= m_src.size()) {
+            return CharClass::end;
+        }
+        return k_char_class[static_cast<unsigned char>(m_src[index])];
+    }
+
+    // Advances m_index over one lexeme and returns the last state reached.
+    // On error m_index is left on the offending character.
+    inline LexState run_dfa() {
+        LexState state = LexState::start;
+        while (true) {
+            const LexState next = k_lex_table[static_cast<size_t>(state)][static_cast<size_t>(char_class(m_index))];
+            if (next == LexState::done) {
+                return state;
+            }
+            if (next == LexState::error) {
+                return state == LexState::start ? LexState::error : state;
+            }
+            state = next;
+            m_index++;
+            m_index += skip_run(state);
+        }
+    }
+
+    // Skips the rest of a long run in one go, the DFA then resumes on the byte ending it
+    [[nodiscard]] inline size_t skip_run(LexState state) const {
+        const char* p = m_src.data() + m_index;
+        const size_t n = m_src.size() - m_index;
+        switch (state) {
+        case LexState::space:
+            return short_run(p, n, scan::is_blank, m_scan.blank_run);
+        case LexState::ident:
+            return short_run(p, n, scan::is_alnum, m_scan.alnum_run);
+        case LexState::comment:
+            return m_scan.find_newline(p, n);
+        case LexState::string:
+            return m_scan.find_quote_or_newline(p, n);
+        default:
+            return 0;
+        }
+    }
+
+    // Most blanks and identifiers are only a few bytes long, those are finished
+    // inline and only longer runs pay for the call into the vector kernel
+    template <typename Pred>
+    [[nodiscard]] static inline size_t short_run(const char* p, size_t n, Pred pred, size_t (*kernel)(const char*, size_t)) {
+        constexpr size_t inline_len = 8;
+        size_t i = 0;
+        while (i < n && i < inline_len) {
+            if (!pred(static_cast<unsigned char>(p[i]))) {
+                return i;
+            }
+            i++;
+        }
+        return i == n ? i : i + kernel(p + i, n - i);
+    }
+
+    const std::string_view m_src;
+    size_t m_index;
+    const scan::Kernels& m_scan;
+    std::array<Token, 3> m_pending {};
+    size_t m_pending_head = 0;
+    size_t m_pending_count = 0;
+    Diagnostics* m_diagnostics;
+};
+
+// Parser input: either a complete TokenBuffer, or tokens pulled lazily from a
+// Tokenizer with a bounded lookahead window, so a huge (mapped) source never
+// needs a token vector. In both modes the stream ends with a semi, because
+// the last statement needs its end of line. A range of a shared buffer can
+// also be read, for the statements handed to one parser thread.
+class TokenStream {
+public:
+    static constexpr size_t max_lookahead = 3; // Parser::peek(2)
+
+    explicit TokenStream(TokenBuffer tokens)
+        : m_buffer(std::move(tokens)) {
+        m_buffer.push(TokenType::semi, m_buffer.source().size());
+        m_end = m_buffer.size();
+    }
+
+    // Tokens [begin, end) of a buffer that outlives the stream, nothing is
+    // copied and no semi is added: the range ends where a statement ends
+    TokenStream(const TokenBuffer& tokens, size_t begin, size_t end)
+        : m_shared(&tokens), m_index(begin), m_end(end) {
+    }
+
+    explicit TokenStream(Tokenizer& tokenizer)
+        : m_tokenizer(&tokenizer) {
+    }
+
+    // Token `offset` ahead, or nullptr past the end. The pointer stays valid
+    // until the token is consumed.
+    [[nodiscard]] inline const Token* peek(size_t offset = 0) {
+        assert(offset < max_lookahead);
+        while (m_count <= offset) {
+            if (!pull()) {
+                return nullptr;
+            }
+        }
+        return &m_window[(m_head + offset) % max_lookahead];
+    }
+
+    [[nodiscard]] inline bool peek_is(TokenType type, size_t offset = 0) {
+        const Token* token = peek(offset);
+        return token != nullptr && token->type == type;
+    }
+
+    inline Token consume() {
+        if (m_count == 0 && !pull()) {
+            throw std::out_of_range("TokenStream::consume past the end");
+        }
+        const Token token = m_window[m_head];
+        m_head = (m_head + 1) % max_lookahead;
+        m_count--;
+        return token;
+    }
+
+private:
+    // Both modes go through the same window, a buffered token is only turned
+    // into a Token once, when it enters the window
+    inline bool pull() {
+        Token& slot = m_window[(m_head + m_count) % max_lookahead];
+        if (m_tokenizer == nullptr) {
+            if (m_index >= m_end) {
+                return false;
+            }
+            slot = m_shared != nullptr ? (*m_shared)[m_index++] : m_buffer[m_index++];
+        } else if (std::optional<Token> token = m_tokenizer->next_token()) {
+            slot = token.value();
+        } else {
+            if (m_ended) {
+                return false;
+            }
+            m_ended = true;
+            slot = Token { .type = TokenType::semi, .span = { static_cast<uint32_t>(m_tokenizer->source().size()), 0 } };
+        }
+        m_count++;
+        return true;
     }
 
-    const std::string m_src;
-    int m_index;
+    TokenBuffer m_buffer;
+    const TokenBuffer* m_shared = nullptr; // range mode, read instead of m_buffer
+    size_t m_index = 0;
+    size_t m_end = 0;
+
+    Tokenizer* m_tokenizer = nullptr;
+    std::array<Token, max_lookahead> m_window {};
+    size_t m_head = 0;
+    size_t m_count = 0;
+    bool m_ended = false;
 };
@@ -0,0 +1,200 @@
+#pragma once
+
+#include "tree_view.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// (AST) Hash-consed syntax trees. Every distinct subtree is stored once and
+// named by a TreeId, so two subtrees are equal exactly when their ids are: a
+// comparison is O(1) and interning a tree twice (or two trees sharing most of
+// their statements) reuses the nodes already in the table.
+// Labels are copied into the table, a tree stays valid after its source and
+// AST are gone, which is what diffing successive edits needs.
+
+using TreeId = uint32_t;
+inline constexpr TreeId k_no_tree = UINT32_MAX;
+
+class TreeTable {
+public:
+    struct Node {
+        TokenType type;
+        std::string_view value; // owned by the table, empty for nodes without a lexeme
+        uint32_t first_child;   // in the child pool
+        uint32_t child_count;
+        uint32_t size;          // number of nodes of the subtree, itself included
+        size_t hash;
+    };
+
+    // Interns the node built from a label and already interned children
+    TreeId intern(const Token& token, std::span<const TreeId> children) {
+        const std::string_view value = token.has_value() ? *m_strings.emplace(token.value).first : std::string_view {};
+        size_t hash = std::hash<std::string_view> {}(value) ^ (static_cast<size_t>(token.type) * 0x9E3779B97F4A7C15ull);
+        uint32_t size = 1;
+        for (const TreeId child : children) {
+            hash = (hash ^ m_nodes[child].hash) * 0x100000001B3ull;
+            size += m_nodes[child].size;
+        }
+
+        const auto [first, last] = m_by_hash.equal_range(hash);
+        for (auto it = first; it != last; ++it) {
+            const Node& node = m_nodes[it->second];
+            if (node.type == token.type && node.value == value && std::ranges::equal(this->children(it->second), children)) {
+                return it->second;
+            }
+        }
+
+        const auto id = static_cast<TreeId>(m_nodes.size());
+        m_nodes.push_back({
+            .type = token.type,
+            .value = value,
+            .first_child = static_cast<uint32_t>(m_children.size()),
+            .child_count = static_cast<uint32_t>(children.size()),
+            .size = size,
+            .hash = hash,
+        });
+        m_children.insert(m_children.end(), children.begin(), children.end());
+        m_by_hash.emplace(hash, id);
+        return id;
+    }
+
+    // Interns the whole tree of a view, bottom up
+    TreeId intern(const AstView& view, AstView::Node node) {
+        const size_t base = m_stack.size();
+        view.for_each_child(node, [&](AstView::Node child) {
+            const TreeId id = intern(view, child);
+            m_stack.push_back(id);
+        });
+        const TreeId id = intern(view.token(node), std::span<const TreeId>(m_stack).subspan(base));
+        m_stack.resize(base);
+        return id;
+    }
+
+    [[nodiscard]] const Node& node(TreeId id) const {
+        return m_nodes[id];
+    }
+
+    [[nodiscard]] std::span<const TreeId> children(TreeId id) const {
+        const Node& node = m_nodes[id];
+        return std::span<const TreeId>(m_children).subspan(node.first_child, node.child_count);
+    }
+
+    [[nodiscard]] Token token(TreeId id) const {
+        return { .type = m_nodes[id].type, .value = m_nodes[id].value };
+    }
+
+    // Distinct subtrees stored
+    [[nodiscard]] size_t size() const {
+        return m_nodes.size();
+    }
+
+    void clear() {
+        m_nodes.clear();
+        m_children.clear();
+        m_by_hash.clear();
+        m_strings.clear();
+        m_occurrences.clear();
+        m_indexed_root = k_no_tree;
+    }
+
+    // Every place where `needle` appears in the tree of `root`, as the
+    // position of its top node in pre-order (the line of AstView::print).
+    // The positions of all the subtrees of root are indexed on the first
+    // call, the following lookups on the same root are one hash lookup.
+    // Interning never changes the tree of an existing id, so the index is
+    // kept across intern calls. The vector is valid until another root is
+    // searched or the table is cleared.
+    [[nodiscard]] const std::vector<uint32_t>& find(TreeId root, TreeId needle) {
+        if (m_indexed_root != root) {
+            m_occurrences.clear();
+            uint32_t position = 0;
+            index(root, position);
+            m_indexed_root = root;
+        }
+        static const std::vector<uint32_t> none;
+        const auto it = m_occurrences.find(needle);
+        return it == m_occurrences.end() ? none : it->second;
+    }
+
+    // Pre-order positions, in the tree of `after`, of the subtrees that are
+    // not in `before`. Equal subtrees are skipped without being walked, the
+    // children of two nodes with the same label are matched one to one.
+    [[nodiscard]] std::vector<uint32_t> diff(TreeId before, TreeId after) const {
+        std::vector<uint32_t> changed;
+        if (after != k_no_tree) {
+            diff(before, after, 0, changed);
+        }
+        return changed;
+    }
+
+    // Same text as AstView::print
+    [[nodiscard]] std::string print(TreeId root) const {
+        std::string out;
+        print(root, 0, out);
+        return out;
+    }
+
+    // Appends the lines of a subtree printed at the given depth
+    void print(TreeId id, int depth, std::string& out) const {
+        out.append(static_cast<size_t>(depth) * 2, ' ');
+        if (depth > 0) {
+            out.append("|- ");
+        }
+        const Token tok = token(id);
+        if (tok.has_value()) {
+            out.append(tok.value).append(": ");
+        }
+        out.append(to_string(tok.type)).push_back('\n');
+        for (const TreeId child : children(id)) {
+            print(child, depth + 1, out);
+        }
+    }
+
+private:
+    void index(TreeId id, uint32_t& position) {
+        m_occurrences[id].push_back(position++);
+        for (const TreeId child : children(id)) {
+            index(child, position);
+        }
+    }
+
+    void diff(TreeId before, TreeId after, uint32_t position, std::vector<uint32_t>& changed) const {
+        if (before == after) {
+            return;
+        }
+        const Node& old_node = before == k_no_tree ? m_nodes[after] : m_nodes[before];
+        const Node& new_node = m_nodes[after];
+        if (before == k_no_tree || old_node.type != new_node.type || old_node.value != new_node.value) {
+            changed.push_back(position);
+            return;
+        }
+
+        const std::span<const TreeId> old_children = children(before);
+        const std::span<const TreeId> new_children = children(after);
+        uint32_t child_position = position + 1;
+        for (size_t i = 0; i < new_children.size(); ++i) {
+            diff(i < old_children.size() ? old_children[i] : k_no_tree, new_children[i], child_position, changed);
+            child_position += m_nodes[new_children[i]].size;
+        }
+        if (old_children.size() > new_children.size()) {
+            changed.push_back(position); // children were removed
+        }
+    }
+
+    std::vector<Node> m_nodes;
+    std::vector<TreeId> m_children;
+    std::unordered_multimap<size_t, TreeId> m_by_hash;
+    std::unordered_set<std::string> m_strings; // node based, the views stay valid
+    std::vector<TreeId> m_stack;               // children being interned
+
+    TreeId m_indexed_root = k_no_tree;
+    std::unordered_map<TreeId, std::vector<uint32_t>> m_occurrences;
+};
@@ -0,0 +1,189 @@
+#pragma once
+
+#include "flat_ast.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// (AST) Syntax tree shown by the UI, read straight from the FlatAst when it is
+// asked for. Nothing is built or copied: a node is a (kind, index) handle,
+// its label and its children are computed from the pools on the fly.
+class AstView {
+public:
+    struct Node {
+        enum class Kind : uint8_t {
+            root,
+            stmt,
+            expr,
+            ident,
+            scope,
+            pred,
+        };
+
+        Kind kind;
+        uint32_t index;
+    };
+
+    explicit AstView(const FlatAst& ast)
+        : m_ast(ast) {
+    }
+
+    [[nodiscard]] Node root() const {
+        return { Node::Kind::root, 0 };
+    }
+
+    // Label of a node: the token of a leaf, or the keyword / operator of the construct
+    [[nodiscard]] Token token(Node node) const {
+        switch (node.kind) {
+        case Node::Kind::root:
+            return {}; // empty token, shown as before the view existed
+        case Node::Kind::stmt:
+            return { .type = stmt_type(m_ast.stmt(node.index).kind) };
+        case Node::Kind::expr:
+            return expr_token(m_ast.expr(node.index));
+        case Node::Kind::ident:
+            return m_ast.leaf(node.index, TokenType::ident);
+        case Node::Kind::scope:
+            return { .type = TokenType::open_curly };
+        case Node::Kind::pred:
+            return { .type = m_ast.pred(node.index).expr == k_no_node ? TokenType::else_ : TokenType::elif };
+        }
+        return {};
+    }
+
+    // Calls visit(Node) for every child, in source order. The elif / else
+    // chain of an if is flattened into children of the if.
+    template <typename Visit>
+    void for_each_child(Node node, Visit&& visit) const {
+        switch (node.kind) {
+        case Node::Kind::root:
+            for_each_stmt(m_ast.root(), visit);
+            break;
+        case Node::Kind::scope:
+            for_each_stmt(m_ast.scope(node.index), visit);
+            break;
+        case Node::Kind::stmt: {
+            const FlatStmt& stmt = m_ast.stmt(node.index);
+            if (stmt.kind == StmtKind::scope) {
+                for_each_stmt(m_ast.scope(stmt.scope), visit);
+                break;
+            }
+            if (stmt.ident != k_no_node) {
+                visit(Node { Node::Kind::ident, stmt.ident });
+            }
+            if (stmt.expr != k_no_node) {
+                visit(Node { Node::Kind::expr, stmt.expr });
+            }
+            if (stmt.scope != k_no_node) {
+                visit(Node { Node::Kind::scope, stmt.scope });
+            }
+            for (uint32_t pred = stmt.pred; pred != k_no_node; pred = m_ast.pred(pred).next) {
+                visit(Node { Node::Kind::pred, pred });
+            }
+            break;
+        }
+        case Node::Kind::pred: {
+            const FlatPred& pred = m_ast.pred(node.index);
+            if (pred.expr != k_no_node) {
+                visit(Node { Node::Kind::expr, pred.expr });
+            }
+            visit(Node { Node::Kind::scope, pred.scope });
+            break;
+        }
+        case Node::Kind::expr: {
+            const FlatExpr& expr = m_ast.expr(node.index);
+            if (is_operator(expr.kind)) {
+                visit(Node { Node::Kind::expr, expr.lhs });
+                visit(Node { Node::Kind::expr, expr.rhs });
+            }
+            break;
+        }
+        case Node::Kind::ident:
+            break;
+        }
+    }
+
+    // One line per node, "value: type" for leaves, indented by depth.
+    // The text is measured first so it is written into a single allocation.
+    [[nodiscard]] std::string print() const {
+        Measure measure;
+        write(root(), 0, measure);
+        Append out;
+        out.text.reserve(measure.size);
+        write(root(), 0, out);
+        return std::move(out.text);
+    }
+
+private:
+    struct Measure {
+        size_t size = 0;
+        void append(std::string_view text) { size += text.size(); }
+        void append(size_t count, char) { size += count; }
+    };
+
+    struct Append {
+        std::string text;
+        void append(std::string_view text_) { text.append(text_); }
+        void append(size_t count, char c) { text.append(count, c); }
+    };
+
+    template <typename Sink>
+    void write(Node node, int depth, Sink& sink) const {
+        sink.append(static_cast<size_t>(depth) * 2, ' ');
+        if (depth > 0) {
+            sink.append("|- ");
+        }
+        const Token tok = token(node);
+        if (tok.has_value()) {
+            sink.append(tok.value);
+            sink.append(": ");
+        }
+        sink.append(to_string(tok.type));
+        sink.append(1, '\n');
+        for_each_child(node, [&](Node child) { write(child, depth + 1, sink); });
+    }
+
+    template <typename Visit>
+    void for_each_stmt(const FlatScope& scope, Visit& visit) const {
+        for (uint32_t i = scope.first; i < scope.first + scope.count; ++i) {
+            visit(Node { Node::Kind::stmt, i });
+        }
+    }
+
+    [[nodiscard]] static bool is_operator(ExprKind kind) {
+        return kind == ExprKind::add || kind == ExprKind::sub || kind == ExprKind::mul || kind == ExprKind::div;
+    }
+
+    [[nodiscard]] Token expr_token(const FlatExpr& expr) const {
+        switch (expr.kind) {
+        case ExprKind::int_lit: return m_ast.leaf(expr.lhs, TokenType::int_lit);
+        case ExprKind::float_lit: return m_ast.leaf(expr.lhs, TokenType::float_lit);
+        case ExprKind::ident: return m_ast.leaf(expr.lhs, TokenType::ident);
+        case ExprKind::string_lit: return m_ast.leaf(expr.lhs, TokenType::string_lit);
+        case ExprKind::add: return { .type = TokenType::plus };
+        case ExprKind::sub: return { .type = TokenType::minus };
+        case ExprKind::mul: return { .type = TokenType::star };
+        case ExprKind::div: return { .type = TokenType::slash };
+        }
+        return {};
+    }
+
+    [[nodiscard]] static TokenType stmt_type(StmtKind kind) {
+        switch (kind) {
+        case StmtKind::exit: return TokenType::exit;
+        case StmtKind::print: return TokenType::print;
+        case StmtKind::int_decl: return TokenType::int_type;
+        case StmtKind::float_decl: return TokenType::float_type;
+        case StmtKind::string_decl: return TokenType::string_type;
+        case StmtKind::assign: return TokenType::eq;
+        case StmtKind::scope: return TokenType::open_curly;
+        case StmtKind::if_: return TokenType::if_;
+        case StmtKind::while_: return TokenType::while_;
+        }
+        return TokenType::semi;
+    }
+
+    const FlatAst& m_ast;
+};
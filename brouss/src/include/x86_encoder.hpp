@@ -0,0 +1,324 @@
+#pragma once
+
+#include "ir.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Machine code of an IrProgram, without an assembler.
+// The IR only uses a small part of x86-64: mov, movd, lea rel, push, pop,
+// add, sub, imul, mul, xor, div, test, jz, jmp and syscall, on 64-bit
+// registers (32-bit for zeroing and float bits), immediates and [rsp + d] or
+// [rbp - d] memory. Jumps are encoded with 32-bit displacements and patched
+// once every block has its offset. The data follows the layout of the NASM
+// listing: the length of each string as a qword, then its bytes.
+
+// A rip-relative displacement at `at` in the text, to `offset` in the data.
+// It depends on where the two are loaded, so the ELF writer fills it in.
+struct DataRef {
+  uint32_t at;
+  uint32_t offset;
+};
+
+struct MachineCode {
+  std::vector<uint8_t> text;
+  std::vector<uint8_t> data;
+  std::vector<DataRef> data_refs;
+  std::vector<uint32_t> host_calls; // rel32 of each call to the embedder's syscall stub
+};
+
+enum class Syscalls : uint8_t {
+  native, // syscall
+  host, // call rel32, the embedder fills in its stub (see MachineCode::host_calls)
+};
+
+class X86Encoder {
+public:
+  explicit X86Encoder(const IrProgram& program, Syscalls syscalls = Syscalls::native)
+    : m_program(program), m_syscalls(syscalls), m_labels(program.label_count(), 0) {
+  }
+
+  // Throws std::logic_error on an instruction form the IR is not expected to produce
+  [[nodiscard]] MachineCode encode() {
+    for (const std::string& value : m_program.strings()) {
+      m_string_offsets.push_back(static_cast<uint32_t>(m_code.data.size() + 8));
+      put_le(m_code.data, value.size(), 8);
+      m_code.data.insert(m_code.data.end(), value.begin(), value.end());
+    }
+
+    for (const Block& block : m_program.blocks()) {
+      if (block.label != k_no_label) {
+        m_labels[block.label] = static_cast<uint32_t>(m_code.text.size());
+      }
+      for (uint32_t i = block.first; i < block.first + block.count; ++i) {
+        encode(m_program.insn(i));
+      }
+    }
+
+    for (const Jump& jump : m_jumps) {
+      const int64_t rel = static_cast<int64_t>(m_labels[jump.label]) - (jump.at + 4);
+      patch_le(m_code.text, jump.at, static_cast<uint64_t>(rel), 4);
+    }
+    return std::move(m_code);
+  }
+
+private:
+  // rel32 at `at`, to the start of a label
+  struct Jump {
+    uint32_t at;
+    uint32_t label;
+  };
+
+  // Two-operand ALU instructions: op r/m, r - op r, r/m - op r/m, imm (/ext)
+  struct Alu {
+    uint8_t store;
+    uint8_t load;
+    uint8_t ext;
+  };
+
+  void encode(const Insn& insn) {
+    const auto arg = [&](size_t i) -> const Operand& { return m_program.operand(insn, i); };
+    switch (insn.op) {
+    case Op::mov:
+      mov(arg(0), arg(1));
+      break;
+    case Op::movd: // movd xmm, r32
+      expect(arg(0).kind == OperandKind::reg && arg(1).kind == OperandKind::dword, "movd");
+      byte(0x66);
+      rm_op(false, { 0x0F, 0x6E }, hw(arg(0).reg), arg(1));
+      break;
+    case Op::lea:
+      expect(arg(0).kind == OperandKind::reg && arg(1).kind == OperandKind::str, "lea");
+      rex(true, hw(arg(0).reg), 0);
+      byte(0x8D);
+      byte(static_cast<uint8_t>(((hw(arg(0).reg) & 7) << 3) | 0b101)); // [rip + disp32]
+      m_code.data_refs.push_back({ .at = here(), .offset = m_string_offsets[static_cast<size_t>(arg(1).value)] });
+      put_le(m_code.text, 0, 4);
+      break;
+    case Op::push:
+      push(arg(0));
+      break;
+    case Op::pop:
+      expect(arg(0).kind == OperandKind::reg, "pop");
+      rex(false, 0, hw(arg(0).reg));
+      byte(static_cast<uint8_t>(0x58 + (hw(arg(0).reg) & 7)));
+      break;
+    case Op::add:
+      alu({ .store = 0x01, .load = 0x03, .ext = 0 }, arg(0), arg(1));
+      break;
+    case Op::sub:
+      alu({ .store = 0x29, .load = 0x2B, .ext = 5 }, arg(0), arg(1));
+      break;
+    case Op::xor_:
+      expect(is_reg(arg(0)) && arg(1).kind == arg(0).kind, "xor");
+      rm_op(arg(0).kind == OperandKind::reg, { 0x31 }, hw(arg(1).reg), arg(0));
+      break;
+    case Op::imul:
+      expect(arg(0).kind == OperandKind::reg, "imul");
+      if (insn.count == 2) {
+        rm_op(true, { 0x0F, 0xAF }, hw(arg(0).reg), arg(1));
+      } else if (fits8(arg(2).value)) {
+        rm_op(true, { 0x6B }, hw(arg(0).reg), arg(1));
+        byte(static_cast<uint8_t>(arg(2).value));
+      } else {
+        expect(fits32(arg(2).value), "imul immediate");
+        rm_op(true, { 0x69 }, hw(arg(0).reg), arg(1));
+        put_le(m_code.text, static_cast<uint64_t>(arg(2).value), 4);
+      }
+      break;
+    case Op::mul:
+      rm_op(true, { 0xF7 }, 4, arg(0));
+      break;
+    case Op::div:
+      rm_op(true, { 0xF7 }, 6, arg(0));
+      break;
+    case Op::test:
+      expect(is_reg(arg(1)), "test");
+      rm_op(true, { 0x85 }, hw(arg(1).reg), arg(0));
+      break;
+    case Op::jz:
+      byte(0x0F);
+      byte(0x84);
+      jump_to(arg(0));
+      break;
+    case Op::jmp:
+      byte(0xE9);
+      jump_to(arg(0));
+      break;
+    case Op::syscall:
+      if (m_syscalls == Syscalls::host) {
+        byte(0xE8);
+        m_code.host_calls.push_back(here());
+        put_le(m_code.text, 0, 4);
+      } else {
+        byte(0x0F);
+        byte(0x05);
+      }
+      break;
+    case Op::note:
+    case Op::nop:
+      break;
+    }
+  }
+
+  void mov(const Operand& dst, const Operand& src) {
+    if (dst.kind == OperandKind::dword) {
+      if (src.kind == OperandKind::dword) {
+        rm_op(false, { 0x89 }, hw(src.reg), dst);
+        return;
+      }
+      expect(src.kind == OperandKind::bits || src.kind == OperandKind::imm, "mov r32");
+      rex(false, 0, hw(dst.reg));
+      byte(static_cast<uint8_t>(0xB8 + (hw(dst.reg) & 7)));
+      put_le(m_code.text, static_cast<uint64_t>(src.value), 4);
+      return;
+    }
+    if (src.kind == OperandKind::imm) {
+      if (dst.kind == OperandKind::reg && src.value >= 0 && src.value <= UINT32_MAX) {
+        rex(false, 0, hw(dst.reg)); // mov r32 zero extends
+        byte(static_cast<uint8_t>(0xB8 + (hw(dst.reg) & 7)));
+        put_le(m_code.text, static_cast<uint64_t>(src.value), 4);
+      } else if (fits32(src.value)) {
+        rm_op(true, { 0xC7 }, 0, dst);
+        put_le(m_code.text, static_cast<uint64_t>(src.value), 4);
+      } else {
+        expect(dst.kind == OperandKind::reg, "mov imm64");
+        rex(true, 0, hw(dst.reg));
+        byte(static_cast<uint8_t>(0xB8 + (hw(dst.reg) & 7)));
+        put_le(m_code.text, static_cast<uint64_t>(src.value), 8);
+      }
+      return;
+    }
+    if (is_reg(src)) {
+      rm_op(true, { 0x89 }, hw(src.reg), dst);
+    } else {
+      expect(is_reg(dst), "mov memory to memory");
+      rm_op(true, { 0x8B }, hw(dst.reg), src);
+    }
+  }
+
+  void push(const Operand& value) {
+    if (value.kind == OperandKind::reg) {
+      rex(false, 0, hw(value.reg));
+      byte(static_cast<uint8_t>(0x50 + (hw(value.reg) & 7)));
+    } else if (value.kind == OperandKind::imm && fits8(value.value)) {
+      byte(0x6A);
+      byte(static_cast<uint8_t>(value.value));
+    } else if (value.kind == OperandKind::imm) {
+      expect(fits32(value.value), "push immediate");
+      byte(0x68);
+      put_le(m_code.text, static_cast<uint64_t>(value.value), 4);
+    } else {
+      rm_op(false, { 0xFF }, 6, value); // 64-bit without REX.W
+    }
+  }
+
+  void alu(Alu alu, const Operand& dst, const Operand& src) {
+    if (src.kind == OperandKind::imm) {
+      const bool short_imm = fits8(src.value);
+      expect(fits32(src.value), "immediate operand");
+      rm_op(true, { static_cast<uint8_t>(short_imm ? 0x83 : 0x81) }, alu.ext, dst);
+      put_le(m_code.text, static_cast<uint64_t>(src.value), short_imm ? 1 : 4);
+    } else if (is_reg(src)) {
+      rm_op(true, { alu.store }, hw(src.reg), dst);
+    } else {
+      expect(is_reg(dst), "memory to memory");
+      rm_op(true, { alu.load }, hw(dst.reg), src);
+    }
+  }
+
+  // [REX] opcode ModRM [SIB] [disp]: reg is a register number or an opcode extension
+  void rm_op(bool wide, std::initializer_list<uint8_t> opcode, uint8_t reg, const Operand& rm) {
+    const bool memory = rm.kind == OperandKind::stack || rm.kind == OperandKind::frame;
+    expect(memory || is_reg(rm), "operand");
+    const uint8_t base = hw(rm.reg);
+    rex(wide, reg, base);
+    for (const uint8_t b : opcode) {
+      byte(b);
+    }
+    if (!memory) {
+      byte(static_cast<uint8_t>(0xC0 | ((reg & 7) << 3) | (base & 7)));
+      return;
+    }
+    const int64_t disp = rm.kind == OperandKind::frame ? -rm.value : rm.value;
+    const uint8_t mod = disp == 0 && (base & 7) != 5 ? 0b00 : fits8(disp) ? 0b01 : 0b10;
+    byte(static_cast<uint8_t>((mod << 6) | ((reg & 7) << 3) | (base & 7)));
+    if ((base & 7) == 4) {
+      byte(0x24); // SIB: base rsp, no index
+    }
+    if (mod == 0b01) {
+      byte(static_cast<uint8_t>(disp));
+    } else if (mod == 0b10) {
+      put_le(m_code.text, static_cast<uint64_t>(disp), 4);
+    }
+  }
+
+  void rex(bool wide, uint8_t reg, uint8_t base) {
+    const uint8_t bits = static_cast<uint8_t>((wide ? 8 : 0) | ((reg >> 3) << 2) | (base >> 3));
+    if (bits != 0) {
+      byte(static_cast<uint8_t>(0x40 | bits));
+    }
+  }
+
+  void jump_to(const Operand& label) {
+    m_jumps.push_back({ .at = here(), .label = static_cast<uint32_t>(label.value) });
+    put_le(m_code.text, 0, 4);
+  }
+
+  // Number of the register in the instruction encoding
+  [[nodiscard]] static uint8_t hw(Reg reg) {
+    static constexpr std::array<uint8_t, 18> k_numbers { 0, 3, 1, 2, 6, 7, 5, 4, 8, 9, 10, 11, 12, 13, 14, 15, 0, 0 };
+    return k_numbers[static_cast<size_t>(reg)];
+  }
+
+  [[nodiscard]] static bool is_reg(const Operand& operand) {
+    return operand.kind == OperandKind::reg || operand.kind == OperandKind::dword;
+  }
+
+  [[nodiscard]] static bool fits8(int64_t value) {
+    return value >= INT8_MIN && value <= INT8_MAX;
+  }
+
+  [[nodiscard]] static bool fits32(int64_t value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+  }
+
+  static void expect(bool condition, const char* what) {
+    if (!condition) {
+      throw std::logic_error(std::string("Cannot encode ") + what);
+    }
+  }
+
+  static void put_le(std::vector<uint8_t>& out, uint64_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; ++i) {
+      out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+  }
+
+  static void patch_le(std::vector<uint8_t>& out, size_t at, uint64_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; ++i) {
+      out[at + i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+  }
+
+  void byte(uint8_t value) {
+    m_code.text.push_back(value);
+  }
+
+  [[nodiscard]] uint32_t here() const {
+    return static_cast<uint32_t>(m_code.text.size());
+  }
+
+  const IrProgram& m_program;
+  Syscalls m_syscalls;
+  MachineCode m_code;
+  std::vector<uint32_t> m_labels; // label -> text offset
+  std::vector<Jump> m_jumps;
+  std::vector<uint32_t> m_string_offsets; // string -> data offset of its bytes
+};
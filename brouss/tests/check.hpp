@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdio>
+
+// Minimal checks for the test executables: a failed check is printed and
+// makes the test return non-zero, the run goes on to report the others
+
+namespace check {
+
+inline int failures = 0;
+
+[[nodiscard]] inline int exit_code() {
+    if (failures > 0) {
+        std::fprintf(stderr, "%d check(s) failed\n", failures);
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+} // namespace check
+
+#define CHECK(condition, ...)                                                   \
+    do {                                                                        \
+        if (!(condition)) {                                                     \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed: ", __FILE__, __LINE__, #condition); \
+            std::fprintf(stderr, __VA_ARGS__);                                  \
+            std::fprintf(stderr, "\n");                                         \
+            check::failures++;                                                  \
+        }                                                                       \
+    } while (false)
@@ -0,0 +1,115 @@
+// ArenaAllocator::emplace_tracked: the destructors of tracked objects run
+// once, most recent first, on reset() and on the arena's destruction, also
+// when the objects are spread over a chain of blocks or the arena was moved.
+
+#include "check.hpp"
+
+#include "arena.hpp"
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Records its id when destroyed. The string makes it non-trivially
+// destructible and puts memory on the heap that only the destructor frees.
+struct Tracked {
+    std::vector<int>* destroyed;
+    int id;
+    std::string name = std::string(32, 'x');
+
+    ~Tracked() {
+        destroyed->push_back(id);
+    }
+};
+
+// Ids first, first + 1, ... last - 1 in reverse order
+std::vector<int> reversed(int first, int last) {
+    std::vector<int> ids;
+    for (int id = last - 1; id >= first; --id) {
+        ids.push_back(id);
+    }
+    return ids;
+}
+
+void check_reset_across_blocks() {
+    std::vector<int> destroyed;
+    ArenaAllocator arena(64);
+    for (int id = 0; id < 100; ++id) {
+        (void)arena.emplace_tracked<Tracked>(&destroyed, id);
+        (void)arena.emplace<int>(id); // untracked objects in between
+    }
+    const size_t capacity = arena.capacity();
+    CHECK(capacity > 64 * 4, "the objects fit in %zu bytes, no block chain was made", capacity);
+    CHECK(destroyed.empty(), "%zu objects destroyed before reset", destroyed.size());
+
+    arena.reset();
+    CHECK(destroyed == reversed(0, 100), "reset destroyed %zu objects, not 0 to 99 in reverse", destroyed.size());
+    CHECK(arena.capacity() == capacity, "reset kept %zu bytes instead of %zu", arena.capacity(), capacity);
+
+    // The destructors that ran are not run again, only the objects made since
+    destroyed.clear();
+    for (int id = 100; id < 110; ++id) {
+        (void)arena.emplace_tracked<Tracked>(&destroyed, id);
+    }
+    arena.reset();
+    CHECK(destroyed == reversed(100, 110), "second reset destroyed %zu objects, not 100 to 109 in reverse", destroyed.size());
+    arena.reset();
+    CHECK(destroyed.size() == 10, "an empty reset destroyed %zu more objects", destroyed.size() - 10);
+}
+
+void check_destruction() {
+    std::vector<int> destroyed;
+    {
+        ArenaAllocator arena(64);
+        for (int id = 0; id < 50; ++id) {
+            (void)arena.emplace_tracked<Tracked>(&destroyed, id);
+        }
+    }
+    CHECK(destroyed == reversed(0, 50), "the arena's destructor destroyed %zu objects, not 0 to 49 in reverse", destroyed.size());
+}
+
+void check_moves() {
+    std::vector<int> destroyed;
+    {
+        ArenaAllocator first(64);
+        for (int id = 0; id < 20; ++id) {
+            (void)first.emplace_tracked<Tracked>(&destroyed, id);
+        }
+        ArenaAllocator moved(std::move(first));
+        first.reset();
+        CHECK(destroyed.empty(), "resetting a moved-from arena destroyed %zu objects", destroyed.size());
+
+        ArenaAllocator other(64);
+        for (int id = 20; id < 30; ++id) {
+            (void)other.emplace_tracked<Tracked>(&destroyed, id);
+        }
+        // other now owns 0..19, moved owns 20..29
+        other = std::move(moved);
+        moved.reset();
+        CHECK(destroyed == reversed(20, 30), "the moved-to arena's objects: %zu destroyed, not 20 to 29", destroyed.size());
+        destroyed.clear();
+    }
+    CHECK(destroyed == reversed(0, 20), "destroyed %zu objects, not 0 to 19 in reverse", destroyed.size());
+}
+
+// Trivially destructible objects are not registered, emplace_tracked is then
+// the same as emplace
+void check_trivial() {
+    ArenaAllocator arena(64);
+    const int* value = arena.emplace_tracked<int>(7);
+    CHECK(*value == 7, "value %d", *value);
+    CHECK(arena.allocation_count() == 1, "%zu allocations for one int", arena.allocation_count());
+}
+
+} // namespace
+
+int main() {
+    check_reset_across_blocks();
+    check_destruction();
+    check_moves();
+    check_trivial();
+    return check::exit_code();
+}
@@ -0,0 +1,117 @@
+// ConstantFolder against the generator alone: folding removes the branches
+// that cannot run, the errors in them are still reported, with the same
+// messages and spans. A multiplication by zero keeps an operand that divides,
+// so the program still faults on a division by zero.
+
+#include "check.hpp"
+
+#include "arena.hpp"
+#include "constant_folding.hpp"
+#include "diagnostics.hpp"
+#include "flat_ast.hpp"
+#include "generation.hpp"
+#include "ir.hpp"
+#include "jit.hpp"
+#include "parser.hpp"
+#include "tokenization.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+namespace {
+
+struct Compiled {
+    std::vector<Diagnostic> errors; // by position
+    IrProgram ir;
+    size_t folded = 0;
+};
+
+Compiled compile(std::string_view src, bool fold) {
+    Diagnostics diagnostics;
+    ArenaAllocator arena;
+    Tokenizer tokenizer(src, &diagnostics);
+    Parser parser(tokenizer, diagnostics, arena);
+    const NodeProg prog = parser.parse_prog().value();
+    FlatAst ast = FlatAst::lower(prog);
+
+    Compiled compiled;
+    if (fold) {
+        ConstantFolder folder(ast, diagnostics);
+        folder.run();
+        compiled.folded = folder.folded_count();
+    }
+    compiled.ir = Generator(ast, diagnostics).gen_ir();
+    compiled.errors = diagnostics.all();
+    std::sort(compiled.errors.begin(), compiled.errors.end(), [](const Diagnostic& a, const Diagnostic& b) {
+        return std::tie(a.span.offset, a.message) < std::tie(b.span.offset, b.message);
+    });
+    return compiled;
+}
+
+// Each program has `errors` errors, all in branches that folding removes
+struct DeadBranch {
+    std::string_view name;
+    std::string_view src;
+    size_t errors;
+};
+
+constexpr DeadBranch k_dead_branches[] = {
+    { "if (0)", "if (0) {\n    exit(nope)\n}\nexit(0)\n", 1 },
+    { "while (0)", "while (0) {\n    exit(nope)\n}\nexit(0)\n", 1 },
+    { "elif after if (1)", "if (1) {\n    exit(0)\n} elif (nope) {\n    exit(also)\n} else {\n    exit(nope)\n}\n", 3 },
+    { "declarations", "int a = 1\nif (a - 1) {\n    int a = 2\n    int b = 3\n    int b = b\n}\nexit(a)\n", 2 },
+    { "assignment", "int a = 0\nint d = 1\nwhile (a) {\n    b = 1\n    {\n        d = nope\n    }\n}\nexit(d)\n", 2 },
+    { "declared in the branch", "if (0) {\n    int c = 1\n    {\n        exit(c)\n    }\n}\nexit(c)\n", 1 },
+};
+
+void check_dead_branch(const DeadBranch& program) {
+    const Compiled plain = compile(program.src, false);
+    const Compiled folded = compile(program.src, true);
+    const int name_length = static_cast<int>(program.name.size());
+    CHECK(plain.errors.size() == program.errors, "%.*s: %zu errors without folding instead of %zu", name_length, program.name.data(),
+          plain.errors.size(), program.errors);
+    CHECK(folded.errors.size() == plain.errors.size(), "%.*s: %zu errors with folding, %zu without", name_length, program.name.data(),
+          folded.errors.size(), plain.errors.size());
+    for (size_t i = 0; i < std::min(folded.errors.size(), plain.errors.size()); ++i) {
+        CHECK(folded.errors[i].message == plain.errors[i].message && folded.errors[i].span.offset == plain.errors[i].span.offset,
+              "%.*s: \"%s\" at %u with folding, \"%s\" at %u without", name_length, program.name.data(), folded.errors[i].message.c_str(),
+              folded.errors[i].span.offset, plain.errors[i].message.c_str(), plain.errors[i].span.offset);
+    }
+}
+
+void check_runs(std::string_view src, int exit_code, std::string_view fault) {
+    for (const bool fold : { false, true }) {
+        const Compiled compiled = compile(src, fold);
+        CHECK(compiled.errors.empty(), "%.*s does not compile", static_cast<int>(src.size()), src.data());
+        IrProgram ir = compiled.ir;
+        PassManager::standard().run(ir);
+        const JitResult result = Jit::run(ir, std::chrono::milliseconds(1000));
+        CHECK(result.fault.value_or("") == fault && (!fault.empty() || result.exit_code == exit_code),
+              "%.*s, folding %s: exit code %d, fault \"%s\"", static_cast<int>(src.size()), src.data(), fold ? "on" : "off", result.exit_code,
+              result.fault.value_or("").c_str());
+    }
+}
+
+} // namespace
+
+int main() {
+    for (const DeadBranch& program : k_dead_branches) {
+        check_dead_branch(program);
+    }
+
+    // A zero operand drops the other one only when it cannot fault
+    check_runs("exit((1 / 0) * 0)\n", 0, "Division by zero");
+    check_runs("exit(0 * (1 / 0))\n", 0, "Division by zero");
+    check_runs("int z = 0\nexit(z * (2 / z))\n", 0, "Division by zero");
+    check_runs("int x = 5\nwhile (x) {\n    x = x - 1\n}\nexit(x * 0 + 3)\n", 3, "");
+    check_runs("exit((6 / 3) * 0 + 7)\n", 7, "");
+
+    // Still folded when nothing divides
+    const Compiled zero = compile("int x = 2\nwhile (x) {\n    x = x - 1\n}\nexit((x + 1) * 0)\n", true);
+    CHECK(zero.folded > 0, "(x + 1) * 0 not folded");
+    return check::exit_code();
+}
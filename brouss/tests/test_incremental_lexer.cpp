@@ -0,0 +1,97 @@
+// IncrementalLexer::apply_edit against lexing the edited text from scratch,
+// over random edits: line starts, tokens of every line and the tokens of the
+// whole text must all match after each edit. The defaults keep the run short,
+// longer runs are done by hand with other seeds:
+//   test_incremental_lexer [seed [edits]]
+
+#include "check.hpp"
+
+#include "incremental_lexer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdlib>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace {
+
+constexpr unsigned k_seed = 5;
+constexpr int k_edits = 2000;
+// The text stops growing past this size
+constexpr size_t k_max_text = 500;
+
+// Pieces that hit the line and string handling: newlines, quotes, comments,
+// keywords, numbers and characters the lexer rejects
+constexpr std::array<std::string_view, 16> k_pieces {
+    "\n", "\"", "//", " ", "int", "x", "= ", "12", "3.5", "\"str\"", "while(x) {", "}\n", "print(s)\n", "@", "\n\n", "elif",
+};
+
+std::string random_text(std::mt19937& rng, size_t pieces) {
+    std::string text;
+    for (size_t i = 0; i < pieces; ++i) {
+        text += k_pieces[rng() % k_pieces.size()];
+    }
+    return text;
+}
+
+bool same_tokens(std::span<const LineToken> a, std::span<const LineToken> b) {
+    return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](const LineToken& x, const LineToken& y) {
+        return x.type == y.type && x.offset == y.offset && x.length == y.length;
+    });
+}
+
+void check_matches_full_lex(const IncrementalLexer& lexer, int edit) {
+    const IncrementalLexer full(lexer.text());
+    CHECK(lexer.line_count() == full.line_count(), "edit %d: %zu lines instead of %zu", edit, lexer.line_count(), full.line_count());
+    if (lexer.line_count() != full.line_count()) {
+        return;
+    }
+    for (size_t line = 0; line < full.line_count(); ++line) {
+        CHECK(lexer.line_start(line) == full.line_start(line), "edit %d: line %zu starts at %zu instead of %zu", edit, line,
+              lexer.line_start(line), full.line_start(line));
+        CHECK(same_tokens(lexer.line_tokens(line), full.line_tokens(line)), "edit %d: tokens of line %zu differ", edit, line);
+    }
+    CHECK(same_tokens(lexer.tokens(), full.tokens()), "edit %d: token buffers differ", edit);
+
+    // Strings do not span lines, so the lines lexed alone give the tokens of the whole text
+    Tokenizer tokenizer(lexer.text());
+    const TokenBuffer whole = tokenizer.tokenize();
+    size_t index = 0;
+    for (size_t line = 0; line < lexer.line_count() && index <= whole.size(); ++line) {
+        for (const LineToken& token : lexer.line_tokens(line)) {
+            const bool same = index < whole.size() && whole.type(index) == token.type
+                && whole.span(index).offset == lexer.line_start(line) + token.offset && whole.span(index).length == token.length;
+            CHECK(same, "edit %d: token %zu differs from the whole text lexer", edit, index);
+            index++;
+        }
+    }
+    CHECK(index == whole.size(), "edit %d: %zu tokens instead of %zu", edit, index, whole.size());
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const auto seed = argc > 1 ? static_cast<unsigned>(std::strtoul(argv[1], nullptr, 10)) : k_seed;
+    const int edits = argc > 2 ? std::atoi(argv[2]) : k_edits;
+    std::mt19937 rng(seed);
+    IncrementalLexer lexer(random_text(rng, 100));
+    check_matches_full_lex(lexer, -1);
+
+    for (int edit = 0; edit < edits && check::failures == 0; ++edit) {
+        const size_t size = lexer.text().size();
+        const size_t pos = size == 0 ? 0 : rng() % (size + 1);
+        const size_t removed = rng() % 4 == 0 ? 0 : rng() % 12;
+        // Keeps the text from growing or shrinking for good
+        const std::string inserted = random_text(rng, size > k_max_text ? 0 : rng() % 4);
+
+        const IncrementalLexer::LineRange range = lexer.apply_edit(pos, removed, inserted);
+        CHECK(range.count > 0 && range.first + range.count <= lexer.line_count(), "edit %d: lines [%zu, +%zu) out of %zu", edit,
+              range.first, range.count, lexer.line_count());
+        check_matches_full_lex(lexer, edit);
+    }
+    return check::exit_code();
+}
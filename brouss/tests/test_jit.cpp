@@ -0,0 +1,134 @@
+// Jit::run on small programs: the output and the exit code (masked to 8 bits
+// like the kernel does), a division by zero and an endless loop stopped and
+// reported as faults, and runs one after the other leaving the signal
+// handlers of the process as they found them. A signal that is not the run's
+// own goes on to the handler the process had installed.
+
+#include "check.hpp"
+
+#include "arena.hpp"
+#include "diagnostics.hpp"
+#include "flat_ast.hpp"
+#include "generation.hpp"
+#include "ir.hpp"
+#include "jit.hpp"
+#include "parser.hpp"
+#include "tokenization.hpp"
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <csignal>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace {
+
+constexpr std::chrono::milliseconds k_timeout(200);
+
+constexpr std::string_view k_endless = "int n = 1\nwhile (n) {\n    n = n + 1\n}\nexit(0)\n";
+
+volatile sig_atomic_t g_fpe_hits = 0;
+volatile sig_atomic_t g_bus_hits = 0;
+
+void on_fpe(int, siginfo_t*, void*) {
+    g_fpe_hits = g_fpe_hits + 1;
+}
+
+void on_bus(int) {
+    g_bus_hits = g_bus_hits + 1;
+}
+
+IrProgram compile(std::string_view src) {
+    Diagnostics diagnostics;
+    ArenaAllocator arena;
+    Tokenizer tokenizer(src, &diagnostics);
+    Parser parser(tokenizer, diagnostics, arena);
+    const NodeProg prog = parser.parse_prog().value();
+    const FlatAst ast = FlatAst::lower(prog);
+    IrProgram ir = Generator(ast, diagnostics).gen_ir();
+    CHECK(!diagnostics.has_errors(), "%.*s does not compile", static_cast<int>(src.size()), src.data());
+    PassManager::standard().run(ir);
+    return ir;
+}
+
+JitResult run(std::string_view src) {
+    return Jit::run(compile(src), k_timeout);
+}
+
+// The handlers installed by main, as they must be after every run
+bool handlers_restored() {
+    struct sigaction fpe {};
+    struct sigaction bus {};
+    struct sigaction segv {};
+    ::sigaction(SIGFPE, nullptr, &fpe);
+    ::sigaction(SIGBUS, nullptr, &bus);
+    ::sigaction(SIGSEGV, nullptr, &segv);
+    return (fpe.sa_flags & SA_SIGINFO) != 0 && fpe.sa_sigaction == on_fpe && (bus.sa_flags & SA_SIGINFO) == 0
+        && bus.sa_handler == on_bus && segv.sa_handler == SIG_DFL;
+}
+
+void check_output() {
+    const JitResult result = run("string s = \"out\"\nprint(s)\nprint(\"put\")\nexit(300)\n");
+    CHECK(!result.fault.has_value(), "fault: %s", result.fault.value_or("").c_str());
+    CHECK(result.output == "output", "output \"%s\"", result.output.c_str());
+    CHECK(result.exit_code == 44, "exit code %d instead of 300 & 255", result.exit_code);
+}
+
+void check_division_by_zero() {
+    const int fpe_hits = g_fpe_hits;
+    const JitResult result = run("int z = 0\nprint(\"before\")\nexit(5 / z)\n");
+    CHECK(result.fault == "Division by zero", "fault: %s", result.fault.value_or("none").c_str());
+    CHECK(result.output == "before", "output \"%s\"", result.output.c_str());
+    CHECK(g_fpe_hits == fpe_hits, "the program's SIGFPE reached the process handler");
+}
+
+void check_timeout() {
+    const auto start = std::chrono::steady_clock::now();
+    const JitResult result = run(k_endless);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    CHECK(result.fault == "Stopped after 200 ms", "fault: %s", result.fault.value_or("none").c_str());
+    CHECK(elapsed < k_timeout * 10, "stopped after %lld ms",
+          static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count()));
+}
+
+// Signals raised on another thread while a run is in progress are not the
+// run's: they reach the handlers of the process
+void check_chaining() {
+    const int fpe_hits = g_fpe_hits;
+    const int bus_hits = g_bus_hits;
+    JitResult result;
+    std::thread runner([&] { result = run(k_endless); });
+    std::this_thread::sleep_for(k_timeout / 4);
+    ::raise(SIGFPE);
+    ::raise(SIGBUS);
+    runner.join();
+    CHECK(g_fpe_hits == fpe_hits + 1, "SIGFPE reached the process handler %d times", g_fpe_hits - fpe_hits);
+    CHECK(g_bus_hits == bus_hits + 1, "SIGBUS reached the process handler %d times", g_bus_hits - bus_hits);
+    CHECK(result.fault == "Stopped after 200 ms", "fault: %s", result.fault.value_or("none").c_str());
+}
+
+} // namespace
+
+int main() {
+    struct sigaction fpe {};
+    fpe.sa_sigaction = on_fpe;
+    fpe.sa_flags = SA_SIGINFO;
+    ::sigaction(SIGFPE, &fpe, nullptr);
+    std::signal(SIGBUS, on_bus);
+
+    // Twice, so that every run starts after another one
+    for (int round = 0; round < 2; ++round) {
+        check_output();
+        CHECK(handlers_restored(), "handlers changed by a run that exits");
+        check_division_by_zero();
+        CHECK(handlers_restored(), "handlers changed by a run that divides by zero");
+        check_timeout();
+        CHECK(handlers_restored(), "handlers changed by a run that times out");
+        check_chaining();
+        CHECK(handlers_restored(), "handlers changed by a run on another thread");
+    }
+    return check::exit_code();
+}
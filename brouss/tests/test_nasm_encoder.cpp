@@ -0,0 +1,343 @@
+// The built-in backend (X86Encoder and ElfWriter) against nasm and ld: each
+// sample program is built both ways from the same IR, in a temporary
+// directory, and the two executables must exit with the same code and print
+// the same output. That part is skipped when the tools are not found. The
+// bytes of the memory and immediate forms whose encoding has special cases
+// are always checked.
+//   test_nasm_encoder [nasm ld]
+
+#include "check.hpp"
+
+#include "arena.hpp"
+#include "asm_writer.hpp"
+#include "constant_folding.hpp"
+#include "diagnostics.hpp"
+#include "elf_writer.hpp"
+#include "flat_ast.hpp"
+#include "generation.hpp"
+#include "ir.hpp"
+#include "parser.hpp"
+#include "tokenization.hpp"
+#include "x86_encoder.hpp"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// A tool or a program that runs longer than this is killed
+constexpr std::chrono::seconds k_timeout(5);
+
+constexpr std::array<std::string_view, 6> k_programs {
+    "exit(1 * 3 - 6 / 2 + 2)\n",
+
+    R"(string greeting = "hello"
+print(greeting)
+print(" world")
+int n = 3
+while (n) {
+    print(" tick")
+    n = n - 1
+}
+exit(n)
+)",
+
+    R"(int x = 7
+int y = x * 6 - 2
+if (x - 7) {
+    exit(1)
+} elif (y - 40) {
+    exit(2)
+} else {
+    {
+        int quarter = y / 4
+        y = y + quarter
+    }
+}
+exit(y)
+)",
+
+    R"(int total = 0
+int start = 30
+while (start) {
+    int n = start
+    while (n - 1) {
+        int half = n / 2
+        if (n - half * 2) {
+            n = n * 3 + 1
+        } else {
+            n = half
+        }
+        total = total + 1
+    }
+    start = start - 1
+}
+exit(total - total / 256 * 256)
+)",
+
+    // More int variables live in the loop than there are registers
+    R"(int a = 1
+int b = 2
+int c = 3
+int d = 4
+int e = 5
+int f = 6
+int g = 7
+int n = 50
+while (n) {
+    a = a + b
+    b = b + c
+    c = c + d
+    d = d + e
+    e = e + f
+    f = f + g
+    g = g + a * (b - c) / (d + 1)
+    n = n - 1
+}
+exit(g - g / 256 * 256)
+)",
+
+    R"(float ratio = 2.5
+string s = "scopes"
+int depth = 0
+{
+    int inner = 5
+    {
+        print(s)
+        inner = inner + 1
+    }
+    if (inner - 6) {
+        exit(9)
+    }
+    depth = inner * 2
+}
+exit(depth)
+)",
+};
+
+struct Run {
+    int exit_code;
+    std::string output;
+};
+
+std::optional<std::string> read_file(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return std::nullopt;
+    }
+    return std::string(std::istreambuf_iterator<char>(file), {});
+}
+
+bool write_file(const std::string& path, std::string_view bytes, bool executable) {
+    const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, executable ? 0755 : 0644);
+    if (fd < 0) {
+        return false;
+    }
+    const bool written = ::write(fd, bytes.data(), bytes.size()) == static_cast<ssize_t>(bytes.size());
+    return ::close(fd) == 0 && written;
+}
+
+// Searched in PATH when it has no slash. Its stdout goes to `output`. Nothing
+// when the process did not start, crashed or timed out.
+std::optional<Run> run(const std::string& program, const std::vector<std::string>& args, const std::string& output) {
+    std::vector<char*> argv;
+    argv.push_back(const_cast<char*>(program.c_str()));
+    for (const std::string& arg : args) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    ::posix_spawn_file_actions_init(&actions);
+    ::posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    pid_t pid = 0;
+    const int error = ::posix_spawnp(&pid, program.c_str(), &actions, nullptr, argv.data(), environ);
+    ::posix_spawn_file_actions_destroy(&actions);
+    if (error != 0) {
+        return std::nullopt;
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + k_timeout;
+    int status = 0;
+    while (::waitpid(pid, &status, WNOHANG) == 0) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            ::kill(pid, SIGKILL);
+            ::waitpid(pid, &status, 0);
+            return std::nullopt;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (!WIFEXITED(status)) {
+        return std::nullopt;
+    }
+    return Run { .exit_code = WEXITSTATUS(status), .output = read_file(output).value_or("") };
+}
+
+// Whether the tool starts and exits, asked for its version
+bool available(const std::string& tool, const std::string& dir) {
+    const std::optional<Run> version = run(tool, { "-v" }, dir + "/version");
+    return version.has_value() && version->exit_code == 0;
+}
+
+// Same stages as the compiler: lowering, folding, generation and the IR passes
+std::optional<IrProgram> compile(std::string_view src) {
+    Diagnostics diagnostics;
+    ArenaAllocator arena;
+    Tokenizer tokenizer(src, &diagnostics);
+    Parser parser(tokenizer, diagnostics, arena);
+    const NodeProg prog = parser.parse_prog().value();
+    FlatAst ast = FlatAst::lower(prog);
+    ConstantFolder(ast, diagnostics).run();
+    IrProgram ir = Generator(ast, diagnostics).gen_ir();
+    if (diagnostics.has_errors()) {
+        std::fprintf(stderr, "does not compile: %s\n", diagnostics.all().front().message.c_str());
+        return std::nullopt;
+    }
+    PassManager::standard().run(ir);
+    return ir;
+}
+
+void check_program(size_t index, const std::string& dir, const std::string& nasm, const std::string& ld) {
+    const std::optional<IrProgram> ir = compile(k_programs[index]);
+    CHECK(ir.has_value(), "program %zu", index);
+    if (!ir.has_value()) {
+        return;
+    }
+
+    const std::string name = dir + "/program" + std::to_string(index);
+    AsmWriter assembly;
+    emit_nasm(*ir, assembly);
+    MachineCode code = X86Encoder(*ir).encode();
+    const std::vector<uint8_t> executable = ElfWriter::write(code);
+    const std::string_view executable_bytes(reinterpret_cast<const char*>(executable.data()), executable.size());
+    if (!write_file(name + ".asm", assembly.bytes(), false) || !write_file(name + "_builtin", executable_bytes, true)) {
+        CHECK(false, "program %zu: could not write to %s", index, dir.c_str());
+        return;
+    }
+
+    const std::optional<Run> assembled = run(nasm, { "-felf64", name + ".asm", "-o", name + ".o" }, name + ".log");
+    const std::optional<Run> linked = run(ld, { name + ".o", "-o", name + "_nasm" }, name + ".log");
+    const bool built = assembled.has_value() && assembled->exit_code == 0 && linked.has_value() && linked->exit_code == 0;
+    CHECK(built, "program %zu: nasm and ld could not build it", index);
+    if (!built) {
+        return;
+    }
+
+    const std::optional<Run> with_nasm = run(name + "_nasm", {}, name + "_nasm.out");
+    const std::optional<Run> builtin = run(name + "_builtin", {}, name + "_builtin.out");
+    CHECK(with_nasm.has_value(), "program %zu: the nasm build did not exit", index);
+    CHECK(builtin.has_value(), "program %zu: the built-in build did not exit", index);
+    if (!with_nasm.has_value() || !builtin.has_value()) {
+        return;
+    }
+    CHECK(with_nasm->exit_code == builtin->exit_code, "program %zu: exit code %d with nasm and ld, %d built in", index,
+          with_nasm->exit_code, builtin->exit_code);
+    CHECK(with_nasm->output == builtin->output, "program %zu: output \"%s\" with nasm and ld, \"%s\" built in", index,
+          with_nasm->output.c_str(), builtin->output.c_str());
+}
+
+// One instruction and its bytes, as nasm assembles it
+struct Encoding {
+    std::string_view name;
+    Op op;
+    std::array<Operand, 3> operands;
+    size_t count;
+    std::vector<uint8_t> bytes;
+};
+
+// Memory operands built by hand: a base whose low bits are 5 (rbp, r13) has
+// no form without displacement, one whose low bits are 4 (rsp, r12) needs a
+// SIB byte
+Operand memory(OperandKind kind, Reg base, int64_t value) {
+    return { kind, base, value };
+}
+
+const std::vector<Encoding>& encodings() {
+    static const std::vector<Encoding> s_encodings {
+        { "add rax, [rbp - 0]", Op::add, { Operand::of(Reg::rax), memory(OperandKind::frame, Reg::rbp, 0) }, 2, { 0x48, 0x03, 0x45, 0x00 } },
+        { "add rax, [rbp - 8]", Op::add, { Operand::of(Reg::rax), Operand::frame(0) }, 2, { 0x48, 0x03, 0x45, 0xF8 } },
+        { "add rax, [rbp - 256]", Op::add, { Operand::of(Reg::rax), Operand::frame(31) }, 2, { 0x48, 0x03, 0x85, 0x00, 0xFF, 0xFF, 0xFF } },
+        { "add rax, [r13 + 0]", Op::add, { Operand::of(Reg::rax), memory(OperandKind::stack, Reg::r13, 0) }, 2, { 0x49, 0x03, 0x45, 0x00 } },
+        { "add rax, [rsp]", Op::add, { Operand::of(Reg::rax), Operand::stack(0) }, 2, { 0x48, 0x03, 0x04, 0x24 } },
+        { "add rax, [r12]", Op::add, { Operand::of(Reg::rax), memory(OperandKind::stack, Reg::r12, 0) }, 2, { 0x49, 0x03, 0x04, 0x24 } },
+        { "add [r12 + 8], r9", Op::add, { memory(OperandKind::stack, Reg::r12, 8), Operand::of(Reg::r9) }, 2,
+          { 0x4D, 0x01, 0x4C, 0x24, 0x08 } },
+        { "sub r10, [r12 + 512]", Op::sub, { Operand::of(Reg::r10), memory(OperandKind::stack, Reg::r12, 512) }, 2,
+          { 0x4D, 0x2B, 0x94, 0x24, 0x00, 0x02, 0x00, 0x00 } },
+        { "imul rax, rcx, 5", Op::imul, { Operand::of(Reg::rax), Operand::of(Reg::rcx), Operand::imm(5) }, 3, { 0x48, 0x6B, 0xC1, 0x05 } },
+        { "imul rax, rcx, -128", Op::imul, { Operand::of(Reg::rax), Operand::of(Reg::rcx), Operand::imm(-128) }, 3,
+          { 0x48, 0x6B, 0xC1, 0x80 } },
+        { "imul r8, r8, 128", Op::imul, { Operand::of(Reg::r8), Operand::of(Reg::r8), Operand::imm(128) }, 3,
+          { 0x4D, 0x69, 0xC0, 0x80, 0x00, 0x00, 0x00 } },
+        { "imul rax, rcx, 1000", Op::imul, { Operand::of(Reg::rax), Operand::of(Reg::rcx), Operand::imm(1000) }, 3,
+          { 0x48, 0x69, 0xC1, 0xE8, 0x03, 0x00, 0x00 } },
+        { "imul r9, [rbp - 16], -3", Op::imul, { Operand::of(Reg::r9), Operand::frame(1), Operand::imm(-3) }, 3,
+          { 0x4C, 0x6B, 0x4D, 0xF0, 0xFD } },
+        { "imul rdx, [r12 + 8], 100000", Op::imul, { Operand::of(Reg::rdx), memory(OperandKind::stack, Reg::r12, 8), Operand::imm(100000) }, 3,
+          { 0x49, 0x69, 0x54, 0x24, 0x08, 0xA0, 0x86, 0x01, 0x00 } },
+    };
+    return s_encodings;
+}
+
+void check_encoding(const Encoding& encoding) {
+    IrProgram ir;
+    switch (encoding.count) {
+    case 2:
+        ir.emit(encoding.op, { encoding.operands[0], encoding.operands[1] });
+        break;
+    default:
+        ir.emit(encoding.op, { encoding.operands[0], encoding.operands[1], encoding.operands[2] });
+        break;
+    }
+    const std::vector<uint8_t> text = X86Encoder(ir).encode().text;
+    std::string got;
+    for (const uint8_t byte : text) {
+        char hex[4];
+        std::snprintf(hex, sizeof(hex), " %02X", byte);
+        got += hex;
+    }
+    CHECK(text == encoding.bytes, "%.*s encoded as%s", static_cast<int>(encoding.name.size()), encoding.name.data(), got.c_str());
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    for (const Encoding& encoding : encodings()) {
+        check_encoding(encoding);
+    }
+
+    const char* tmp = std::getenv("TMPDIR");
+    std::string dir = std::string(tmp != nullptr ? tmp : "/tmp") + "/test_nasm_encoder_XXXXXX";
+    if (::mkdtemp(dir.data()) == nullptr) {
+        std::perror("test_nasm_encoder: temporary directory");
+        return 1;
+    }
+    const std::string nasm = argc >= 3 ? argv[1] : "nasm";
+    const std::string ld = argc >= 3 ? argv[2] : "ld";
+    if (available(nasm, dir) && available(ld, dir)) {
+        for (size_t i = 0; i < k_programs.size(); ++i) {
+            check_program(i, dir, nasm, ld);
+        }
+    } else {
+        std::fprintf(stderr, "%s or %s not found, only the encodings are checked\n", nasm.c_str(), ld.c_str());
+    }
+    std::filesystem::remove_all(dir);
+    return check::exit_code();
+}
@@ -0,0 +1,105 @@
+// The SSE2 and AVX2 scan kernels against their scalar versions, on buffers of
+// every length from 0 to 64 at every alignment: random bytes that mostly
+// continue the run, and aligned runs ended at each position by every byte value.
+// The AVX2 kernels are only checked when the CPU has them.
+
+#include "check.hpp"
+
+#include "scan.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string_view>
+
+namespace {
+
+constexpr size_t k_max_length = 64;
+constexpr size_t k_alignments = 32;
+constexpr int k_random_buffers = 10;
+
+using Kernel = size_t (*)(const char*, size_t);
+
+struct Family {
+    std::string_view name;
+    Kernel scalar;
+    std::array<Kernel, 2> vector; // null when not built or not supported
+    std::string_view continues; // bytes that do not end the run
+};
+
+// Aligned to the widest load, so p + alignment covers every alignment
+struct alignas(k_alignments) Buffer {
+    std::array<char, k_alignments + k_max_length> bytes;
+};
+
+void check_kernels(const Family& family, const char* p, size_t n, std::string_view what) {
+    const size_t expected = family.scalar(p, n);
+    for (size_t i = 0; i < family.vector.size(); ++i) {
+        if (family.vector[i] == nullptr) {
+            continue;
+        }
+        const size_t length = family.vector[i](p, n);
+        CHECK(length == expected, "%.*s %s: %zu instead of %zu, length %zu, alignment %zu, %.*s", static_cast<int>(family.name.size()),
+              family.name.data(), i == 0 ? "sse2" : "avx2", length, expected, n,
+              static_cast<size_t>(reinterpret_cast<uintptr_t>(p) % k_alignments), static_cast<int>(what.size()), what.data());
+    }
+}
+
+void check_family(const Family& family, std::mt19937& rng) {
+    Buffer buffer {};
+    for (size_t alignment = 0; alignment < k_alignments; ++alignment) {
+        char* p = buffer.bytes.data() + alignment;
+        for (size_t n = 0; n <= k_max_length; ++n) {
+            for (int round = 0; round < k_random_buffers; ++round) {
+                for (size_t i = 0; i < n; ++i) {
+                    p[i] = rng() % 16 == 0 ? static_cast<char>(rng()) : family.continues[rng() % family.continues.size()];
+                }
+                check_kernels(family, p, n, "random bytes");
+            }
+
+            for (size_t end = 0; end < n && alignment == 0; ++end) {
+                for (size_t i = 0; i < n; ++i) {
+                    p[i] = family.continues[i % family.continues.size()];
+                }
+                for (int byte = 0; byte < 256; ++byte) {
+                    p[end] = static_cast<char>(byte);
+                    check_kernels(family, p, n, "one byte set");
+                }
+            }
+        }
+    }
+}
+
+} // namespace
+
+int main() {
+    std::array<Family, 4> families { {
+        { "blank_run", scan::blank_run_scalar, {}, " \t\r\v\f" },
+        { "alnum_run", scan::alnum_run_scalar, {}, "azAZ09mQ5" },
+        { "find_newline", scan::find_newline_scalar, {}, "a \"\t/@\x7F\x80" },
+        { "find_quote_or_newline", scan::find_quote_or_newline_scalar, {}, "a \t/@'\x7F\x80" },
+    } };
+#ifdef BROUSS_SIMD_X86
+    families[0].vector = { scan::blank_run_sse2, nullptr };
+    families[1].vector = { scan::alnum_run_sse2, nullptr };
+    families[2].vector = { scan::find_newline_sse2, nullptr };
+    families[3].vector = { scan::find_quote_or_newline_sse2, nullptr };
+    if (__builtin_cpu_supports("avx2")) {
+        families[0].vector[1] = scan::blank_run_avx2;
+        families[1].vector[1] = scan::alnum_run_avx2;
+        families[2].vector[1] = scan::find_newline_avx2;
+        families[3].vector[1] = scan::find_quote_or_newline_avx2;
+    } else {
+        std::fprintf(stderr, "no AVX2 on this CPU, only the SSE2 kernels are checked\n");
+    }
+#else
+    std::fprintf(stderr, "built without SIMD, nothing to compare\n");
+#endif
+
+    std::mt19937 rng(3);
+    for (const Family& family : families) {
+        check_family(family, rng);
+    }
+    return check::exit_code();
+}
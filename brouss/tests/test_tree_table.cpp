@@ -0,0 +1,158 @@
+// TreeTable::find on programs with repeated subtrees: every position it gives
+// is a line of AstView::print where the subtree is printed, the positions of
+// all the subtrees cover each line once, and the index of a root still holds
+// after other trees are interned into the same table.
+
+#include "check.hpp"
+
+#include "arena.hpp"
+#include "diagnostics.hpp"
+#include "flat_ast.hpp"
+#include "parser.hpp"
+#include "tokenization.hpp"
+#include "tree_table.hpp"
+#include "tree_view.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+// `1 + 2` appears three times, once in parentheses and once in a nested scope
+constexpr std::string_view k_program = R"(int a = 1 + 2
+int b = (1 + 2) * 3
+{
+    int c = 1 + 2
+    exit(c)
+}
+exit(a + b)
+)";
+
+// Shares `1 + 2` and `exit(c)` with k_program, the rest is new to the table
+constexpr std::string_view k_other = R"(int c = 1 + 2
+while (c) {
+    c = c - 1
+}
+exit(c)
+)";
+
+FlatAst lower(std::string_view src) {
+    Diagnostics diagnostics;
+    ArenaAllocator arena;
+    Tokenizer tokenizer(src, &diagnostics);
+    Parser parser(tokenizer, diagnostics, arena);
+    const NodeProg prog = parser.parse_prog().value();
+    CHECK(!diagnostics.has_errors(), "does not parse: %s", diagnostics.all().front().message.c_str());
+    return FlatAst::lower(prog);
+}
+
+std::vector<std::string_view> lines(std::string_view text) {
+    std::vector<std::string_view> result;
+    while (!text.empty()) {
+        const size_t end = text.find('\n');
+        result.push_back(text.substr(0, end));
+        text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+    }
+    return result;
+}
+
+// The lines of `printed` from `position` are those of `id` printed at the
+// depth of that line
+bool printed_at(const TreeTable& trees, TreeId id, const std::vector<std::string_view>& printed, uint32_t position) {
+    if (position >= printed.size()) {
+        return false;
+    }
+    const size_t indent = printed[position].find_first_not_of(' ');
+    std::string subtree;
+    trees.print(id, static_cast<int>(indent / 2), subtree);
+    const std::vector<std::string_view> expected = lines(subtree);
+    if (position + expected.size() > printed.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < expected.size(); ++i) {
+        if (printed[position + i] != expected[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Every distinct subtree of root, each once
+void collect(const TreeTable& trees, TreeId id, std::vector<bool>& seen, std::vector<TreeId>& ids) {
+    if (seen[id]) {
+        return;
+    }
+    seen[id] = true;
+    ids.push_back(id);
+    for (const TreeId child : trees.children(id)) {
+        collect(trees, child, seen, ids);
+    }
+}
+
+// find for every subtree of root against the printed view of its program
+void check_find(TreeTable& trees, TreeId root, const std::string& printed_text, std::string_view name) {
+    const std::vector<std::string_view> printed = lines(printed_text);
+    CHECK(printed.size() == trees.node(root).size, "%.*s: %zu lines for %u nodes", static_cast<int>(name.size()), name.data(),
+          printed.size(), trees.node(root).size);
+
+    std::vector<bool> seen(trees.size(), false);
+    std::vector<TreeId> ids;
+    collect(trees, root, seen, ids);
+    std::vector<int> covered(printed.size(), 0);
+    for (const TreeId id : ids) {
+        const std::vector<uint32_t> positions = trees.find(root, id);
+        CHECK(!positions.empty(), "%.*s: subtree %u not found", static_cast<int>(name.size()), name.data(), id);
+        for (const uint32_t position : positions) {
+            CHECK(printed_at(trees, id, printed, position), "%.*s: subtree %u is not printed at line %u", static_cast<int>(name.size()),
+                  name.data(), id, position);
+            if (position < covered.size()) {
+                covered[position]++;
+            }
+        }
+    }
+    for (size_t line = 0; line < covered.size(); ++line) {
+        CHECK(covered[line] == 1, "%.*s: line %zu is the top of %d subtrees", static_cast<int>(name.size()), name.data(), line,
+              covered[line]);
+    }
+}
+
+// The `1 + 2` of `int a = 1 + 2`
+TreeId one_plus_two(const TreeTable& trees, TreeId root) {
+    const TreeId declaration = trees.children(root)[0];
+    const TreeId sum = trees.children(declaration)[1];
+    CHECK(trees.token(sum).type == TokenType::plus, "%s instead of +", to_string(trees.token(sum).type).c_str());
+    return sum;
+}
+
+} // namespace
+
+int main() {
+    TreeTable trees;
+    const FlatAst program = lower(k_program);
+    const TreeId root = trees.intern(AstView(program), AstView(program).root());
+    check_find(trees, root, AstView(program).print(), "program");
+
+    const TreeId sum = one_plus_two(trees, root);
+    const std::vector<uint32_t> positions = trees.find(root, sum);
+    CHECK(positions.size() == 3, "1 + 2 found %zu times instead of 3", positions.size());
+
+    // New nodes in the table do not change the tree of an interned root, the
+    // index made for it stays right
+    const FlatAst other = lower(k_other);
+    const size_t nodes_before = trees.size();
+    const TreeId other_root = trees.intern(AstView(other), AstView(other).root());
+    CHECK(trees.size() > nodes_before, "k_other added no node");
+    CHECK(trees.find(root, sum) == positions, "the positions of 1 + 2 changed after interning another tree");
+    CHECK(trees.find(other_root, sum).size() == 1, "1 + 2 found %zu times in k_other", trees.find(other_root, sum).size());
+    check_find(trees, other_root, AstView(other).print(), "other");
+
+    // Going back to the first root indexes it again
+    CHECK(trees.find(root, sum) == positions, "the positions of 1 + 2 changed after indexing another root");
+    const TreeId loop = trees.children(other_root)[1];
+    CHECK(trees.find(root, loop).empty(), "the while of k_other found in k_program");
+    check_find(trees, root, AstView(program).print(), "program again");
+    return check::exit_code();
+}